@@ -0,0 +1,138 @@
+/**
+ * alloc.c
+ *
+ * Implements counted allocation and arenas. Each counted block carries a small
+ * header recording its size so that xfree can keep track of the live bytes.
+ */
+
+#include "alloc.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+
+// Size of the header before each counted block, keeping blocks aligned.
+#define HEADER 16
+
+// Alignment of allocations from an arena.
+#define ARENA_ALIGN 16
+
+// The statistics, updated with relaxed atomics.
+static struct alloc_stats stats;
+
+/*
+ * Allocates size bytes, counting the allocation. Returns NULL on failure.
+ */
+void *xmalloc(size_t size)
+{
+    uint8_t *p = malloc(HEADER + size);
+    if (p == NULL)
+    {
+        return NULL;
+    }
+    *(size_t *) p = size;
+
+    __atomic_fetch_add(&stats.calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.bytes, size, __ATOMIC_RELAXED);
+    metrics_add(M_ALLOCS, 1);
+    metrics_add(M_ALLOC_BYTES, size);
+
+    // Raise the peak if the live bytes now exceed it.
+    uint64_t live = __atomic_add_fetch(&stats.live, size, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&stats.peak, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&stats.peak, &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    return p + HEADER;
+}
+
+/*
+ * Allocates zeroed space for count objects of size bytes, counting the
+ * allocation. Returns NULL on failure.
+ */
+void *xcalloc(size_t count, size_t size)
+{
+    if (size && count > (size_t) -1 / size)
+    {
+        return NULL;
+    }
+
+    uint8_t *p = xmalloc(count * size);
+    for (size_t i = 0; p && i < count * size; i++)
+    {
+        p[i] = 0;
+    }
+    return p;
+}
+
+/*
+ * Frees a block from xmalloc or xcalloc. Does nothing if ptr is NULL.
+ */
+void xfree(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    uint8_t *p = (uint8_t *) ptr - HEADER;
+    __atomic_fetch_sub(&stats.live, *(size_t *) p, __ATOMIC_RELAXED);
+    free(p);
+}
+
+/*
+ * Returns a snapshot of the allocation statistics.
+ */
+struct alloc_stats alloc_stats(void)
+{
+    struct alloc_stats s;
+    s.calls = __atomic_load_n(&stats.calls, __ATOMIC_RELAXED);
+    s.bytes = __atomic_load_n(&stats.bytes, __ATOMIC_RELAXED);
+    s.live = __atomic_load_n(&stats.live, __ATOMIC_RELAXED);
+    s.peak = __atomic_load_n(&stats.peak, __ATOMIC_RELAXED);
+    return s;
+}
+
+/*
+ * Creates an arena of size bytes. Returns true iff successful.
+ */
+bool arena_init(struct arena *a, size_t size)
+{
+    a->base = xmalloc(size);
+    a->size = a->base ? size : 0;
+    a->used = 0;
+    return a->base != NULL;
+}
+
+/*
+ * Returns size bytes from the arena, or NULL if it is full.
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+    size_t start = (a->used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (start > a->size || size > a->size - start)
+    {
+        return NULL;
+    }
+    a->used = start + size;
+    return a->base + start;
+}
+
+/*
+ * Empties the arena, invalidating everything allocated from it.
+ */
+void arena_reset(struct arena *a)
+{
+    a->used = 0;
+}
+
+/*
+ * Frees the arena's memory.
+ */
+void arena_destroy(struct arena *a)
+{
+    xfree(a->base);
+    a->base = NULL;
+    a->size = a->used = 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * alloc.h
+ *
+ * Counted heap allocation and arenas. Everything the game and tools allocate
+ * goes through here, so the counters can confirm that nothing is allocated
+ * once they reach their steady state.
+ */
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation statistics: calls made, bytes allocated in total, and bytes live
+// now and at most.
+struct alloc_stats
+{
+    uint64_t calls, bytes, live, peak;
+};
+
+// Counted versions of malloc, calloc and free.
+void *xmalloc(size_t size);
+void *xcalloc(size_t count, size_t size);
+void xfree(void *ptr);
+
+// Returns the allocation statistics so far.
+struct alloc_stats alloc_stats(void);
+
+// A bump allocator over one block, emptied all at once by arena_reset.
+struct arena
+{
+    uint8_t *base;
+    size_t size, used;
+};
+
+// Functions for creating, using, emptying and destroying arenas.
+bool arena_init(struct arena *a, size_t size);
+void *arena_alloc(struct arena *a, size_t size);
+void arena_reset(struct arena *a);
+void arena_destroy(struct arena *a);
+
+#endif
@@ -0,0 +1,219 @@
+/**
+ * autotune.c
+ *
+ * Implements tuning of the solver to a pack. Boards sampled evenly from the
+ * pack are solved as batch solves them with every combination of solver
+ * settings, each timed as the best of a few rounds so that noise only ever
+ * flatters a setting. The fastest is stored in the pack's index, where the
+ * game and batch find it, unless it's no real gain on the defaults.
+ */
+
+#include "autotune.h"
+#include "alloc.h"
+#include "index.h"
+#include "metrics.h"
+#include "pack.h"
+#include "solver.h"
+#include "sudoku.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Rounds each setting is timed for, and how much faster than the defaults
+// (as a ratio) the best must be to be worth storing.
+#define ROUNDS 3
+#define MIN_GAIN 1.05
+
+// Timing of one combination of settings.
+struct trial
+{
+    struct solver_config config;
+    double seconds;
+    uint64_t nodes;
+};
+
+// Function prototypes.
+static bool run(struct trial *t, uint8_t (*boards)[81], int count,
+                int *solutions, struct table *table);
+static bool same_config(const struct solver_config *a,
+                        const struct solver_config *b);
+
+/*
+ * Tunes the solver to a level's pack, printing the results. Returns 0 iff
+ * successful.
+ */
+int autotune_main(int argc, char *argv[])
+{
+    // Check usage.
+    const char *usage = "Usage: sudoku autotune n00b|l33t [samples]\n";
+    int samples = 200;
+    char c;
+    if (argc < 2 || argc > 3 ||
+        (argc > 2 && (sscanf(argv[2], " %d %c", &samples, &c) != 1 ||
+                      samples < 1)))
+    {
+        fprintf(stderr, usage);
+        return 1;
+    }
+
+    char filename[strlen(argv[1]) + 5], path[strlen(argv[1]) + 5];
+    sprintf(filename, "%s.bin", argv[1]);
+    sprintf(path, "%s.idx", argv[1]);
+    uint8_t (*boards)[81];
+    int count = pack_load(filename, &boards);
+    if (count <= 0)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", filename);
+        return 2;
+    }
+    struct solver_config current = solver_defaults;
+    if (!index_config(path, &current))
+    {
+        fprintf(stderr, "Could not read %s! Build it with sudoku index %s.\n",
+                path, argv[1]);
+        xfree(boards);
+        return 2;
+    }
+
+    // Sample boards evenly from across the pack.
+    if (samples > count)
+    {
+        samples = count;
+    }
+    uint8_t (*sample)[81] = xmalloc(samples * sizeof(*sample));
+    int *expected = xmalloc(samples * sizeof(int));
+    int *solutions = xmalloc(samples * sizeof(int));
+    struct table table;
+    if (!sample || !expected || !solutions ||
+        !table_create(&table, SOLVER_TABLE_BITS))
+    {
+        fprintf(stderr, "Out of memory!\n");
+        xfree(solutions);
+        xfree(expected);
+        xfree(sample);
+        xfree(boards);
+        return 3;
+    }
+    for (int i = 0; i < samples; i++)
+    {
+        memcpy(sample[i], boards[(long) i * count / samples], 81);
+    }
+
+    printf("Tuning the solver to %d of %d %s boards, best of %d rounds.\n\n",
+           samples, count, argv[1], ROUNDS);
+    printf("%-10s %-12s %-8s %10s %10s\n", "branching", "propagation",
+           "engine", "us/board", "nodes");
+
+    // Time the defaults first, noting their answers to check the rest by.
+    struct trial defaults = { solver_defaults };
+    run(&defaults, sample, samples, expected, &table);
+    struct trial best = defaults;
+    int status = 0;
+
+    for (int b = BRANCH_FIRST; b <= BRANCH_UNITS; b++)
+    {
+        for (int p = 0; p <= PROPAGATE_MAX; p++)
+        {
+            for (int e = ENGINE_SEARCH; e <= ENGINE_TABLE; e++)
+            {
+                struct trial t = { { b, p, e } };
+                if (same_config(&t.config, &solver_defaults))
+                {
+                    t = defaults;
+                }
+                else if (!run(&t, sample, samples, solutions, &table) ||
+                         memcmp(solutions, expected,
+                                samples * sizeof(int)) != 0)
+                {
+                    fprintf(stderr, "Settings %s, %d, %s got a count "
+                            "wrong!\n", branching_names[b], p,
+                            engine_names[e]);
+                    status = 4;
+                    continue;
+                }
+                printf("%-10s %-12d %-8s %10.1f %10.1f%s\n",
+                       branching_names[b], p, engine_names[e],
+                       t.seconds / samples * 1e6, (double) t.nodes / samples,
+                       same_config(&t.config, &solver_defaults) ?
+                       "  (defaults)" : "");
+                if (t.seconds < best.seconds)
+                {
+                    best = t;
+                }
+            }
+        }
+    }
+
+    double gain = defaults.seconds / best.seconds;
+    printf("\nBest: %s branching, propagation %d, %s engine, %.2fx as fast as "
+           "the defaults.\n", branching_names[best.config.branching],
+           best.config.propagation, engine_names[best.config.engine], gain);
+    if (gain < MIN_GAIN)
+    {
+        best = defaults;
+        printf("Too small a gain to keep, so using the defaults.\n");
+    }
+    if (status == 0 && !index_tune(path, &best.config))
+    {
+        fprintf(stderr, "Could not write %s!\n", path);
+        status = 5;
+    }
+    else if (status == 0)
+    {
+        printf("Stored in %s%s.\n", path,
+               same_config(&best.config, &current) ? " (unchanged)" : "");
+    }
+
+    table_destroy(&table);
+    xfree(solutions);
+    xfree(expected);
+    xfree(sample);
+    xfree(boards);
+    return status;
+}
+
+/*
+ * Solves count boards as batch does, with the settings of t, noting in t the
+ * best time of ROUNDS rounds and the nodes visited, and the number of
+ * solutions of each board in solutions. Returns false iff the rounds disagree.
+ */
+static bool run(struct trial *t, uint8_t (*boards)[81], int count,
+                int *solutions, struct table *table)
+{
+    bool agree = true;
+    t->seconds = 0;
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        // Each round starts with the table empty, as a batch would.
+        table_clear(table);
+
+        t->nodes = 0;
+        double start = metrics_now();
+        for (int i = 0; i < count; i++)
+        {
+            uint8_t solution[81];
+            struct solve_stats stats;
+            int n = count_solutions_config(boards[i], 2, solution, &t->config,
+                                           table, &stats);
+            agree = agree && (r == 0 || solutions[i] == n);
+            solutions[i] = n;
+            t->nodes += stats.nodes;
+        }
+        double seconds = metrics_now() - start;
+        if (r == 0 || seconds < t->seconds)
+        {
+            t->seconds = seconds;
+        }
+    }
+    return agree;
+}
+
+/*
+ * Returns true iff a and b are the same settings.
+ */
+static bool same_config(const struct solver_config *a,
+                        const struct solver_config *b)
+{
+    return a->branching == b->branching && a->propagation == b->propagation &&
+           a->engine == b->engine;
+}
@@ -0,0 +1,13 @@
+/**
+ * autotune.h
+ *
+ * Tuning of the solver's settings to a pack, storing the best in its index.
+ */
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+// Entry point for "sudoku autotune ...".
+int autotune_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,389 @@
+/**
+ * batch.c
+ *
+ * Implements batch solving. Every board of a pack is solved by a pool of
+ * threads, each taking the next unsolved board in turn, and the solutions are
+ * printed in the pack's order, one line of 81 digits per board (all 0 if the
+ * board has no solution). The solver uses the settings tuned for the pack, if
+ * its index has any.
+ *
+ * With --dashboard, progress is shown live using ncurses. The workers only
+ * bump lock-free counters in their own cache line, which the main thread reads
+ * a few times a second to draw the dashboard.
+ */
+
+#include "batch.h"
+#include "alloc.h"
+#include "cache.h"
+#include "index.h"
+#include "metrics.h"
+#include "pack.h"
+#include "solver.h"
+#include "sudoku.h"
+
+#include <assert.h>
+#include <ncurses.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Most threads in the pool.
+#define MAX_THREADS 256
+
+// Latency buckets, four per power of two nanoseconds.
+#define BUCKETS 256
+
+// Bits of the slowest solve's word holding its board's index, the rest
+// holding its time in ns (saturating at about 18 minutes).
+#define INDEX_BITS 24
+
+// Result of solving one board.
+struct result
+{
+    uint8_t solution[81];
+    int count;
+};
+
+// Work shared by the pool's threads.
+static struct
+{
+    uint8_t (*boards)[81];
+    struct result *results;
+    int count;
+
+    // Solver settings, and each thread's table if they use one.
+    struct solver_config config;
+    struct table *tables;
+
+    // Index of the next board to solve and number of boards solved.
+    int next, done;
+
+    // Count of solve times in each latency bucket.
+    uint64_t latency[BUCKETS];
+
+    // Slowest solve so far, its time in ns above its board's index, so the
+    // two change together.
+    uint64_t slowest;
+}
+work;
+
+// Counters for each thread, in separate cache lines.
+static struct
+{
+    uint64_t solved, busy_ns;
+}
+__attribute__((aligned(64))) stats[MAX_THREADS];
+
+// Function prototypes.
+static void *worker(void *arg);
+static int bucket(uint64_t ns);
+static double percentile(double p);
+static void draw_dashboard(const char *filename, int threads, double elapsed);
+
+/*
+ * Solves every board of a pack, printing the solutions to stdout and a summary
+ * to stderr. Returns 0 iff successful.
+ */
+int batch_main(int argc, char *argv[])
+{
+    // Check usage, allowing --dashboard anywhere after the level.
+    const char *usage =
+        "Usage: sudoku batch n00b|l33t [threads] [--dashboard]\n";
+    bool dashboard = false;
+    if (argc > 2 && strcmp(argv[argc - 1], "--dashboard") == 0)
+    {
+        dashboard = true;
+        argc--;
+    }
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, usage);
+        return 1;
+    }
+
+    // Default to one thread per processor.
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc == 3)
+    {
+        char c;
+        if (sscanf(argv[2], " %d %c", &threads, &c) != 1 || threads < 1)
+        {
+            fprintf(stderr, usage);
+            return 1;
+        }
+    }
+    if (threads > MAX_THREADS)
+    {
+        threads = MAX_THREADS;
+    }
+
+    char filename[strlen(argv[1]) + 5];
+    sprintf(filename, "%s.bin", argv[1]);
+    work.count = pack_load(filename, &work.boards);
+    if (work.count < 0 || work.count > 1 << INDEX_BITS)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", filename);
+        return 2;
+    }
+
+    char path[strlen(argv[1]) + 5];
+    sprintf(path, "%s.idx", argv[1]);
+    work.config = solver_defaults;
+    index_config(path, &work.config);
+
+    // Answer from the solution cache where possible.
+    cache_open(CACHE_FILE);
+
+    work.results = xcalloc(work.count, sizeof(struct result));
+    work.tables = xcalloc(threads, sizeof(struct table));
+    pthread_t *pool = xmalloc(threads * sizeof(pthread_t));
+    bool tables = true;
+    for (int i = 0; work.config.engine == ENGINE_TABLE && work.tables &&
+                    i < threads; i++)
+    {
+        tables = tables && table_create(&work.tables[i], SOLVER_TABLE_BITS);
+    }
+    if (!work.results || !work.tables || !tables || !pool)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 3;
+    }
+
+    if (dashboard && !startup())
+    {
+        fprintf(stderr, "Error starting up ncurses!\n");
+        return 5;
+    }
+
+    const char *metrics = getenv(METRICS_ENV);
+    double start = metrics_now();
+
+    // Solving allocates nothing, everything being set aside above.
+    uint64_t allocations = alloc_stats().calls;
+
+    // Start the pool.
+    for (intptr_t i = 0; i < threads; i++)
+    {
+        if (pthread_create(&pool[i], NULL, worker, (void *) i) != 0)
+        {
+            if (dashboard)
+                endwin();
+            fprintf(stderr, "Could not start thread!\n");
+            return 4;
+        }
+    }
+
+    // Export metrics, and draw the dashboard, periodically while the pool
+    // works.
+    double last = start, drawn = start;
+    while (__atomic_load_n(&work.done, __ATOMIC_ACQUIRE) < work.count)
+    {
+        usleep(10000);
+        if (dashboard && metrics_now() - drawn >= DASHBOARD_MS / 1e3)
+        {
+            draw_dashboard(filename, threads, metrics_now() - start);
+            drawn = metrics_now();
+        }
+        if (metrics && metrics_now() - last >= METRICS_INTERVAL)
+        {
+            metrics_write(metrics);
+            last = metrics_now();
+        }
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(pool[i], NULL);
+    }
+    double elapsed = metrics_now() - start;
+    assert(alloc_stats().calls == allocations);
+
+    // Leave the final dashboard up until a key is pressed.
+    if (dashboard)
+    {
+        draw_dashboard(filename, threads, elapsed);
+        getch();
+        endwin();
+    }
+
+    // Print the solutions in order.
+    for (int i = 0; i < work.count; i++)
+    {
+        char line[82];
+        for (int j = 0; j < 81; j++)
+        {
+            line[j] = work.results[i].count ?
+                      '0' + work.results[i].solution[j] : '0';
+        }
+        line[81] = '\0';
+        puts(line);
+    }
+
+    fprintf(stderr, "Solved %d boards in %.3f s (%.0f boards/s) with %d "
+            "threads, %s branching, propagation %d, %s engine.\n", work.count,
+            elapsed, work.count / elapsed, threads,
+            branching_names[work.config.branching], work.config.propagation,
+            engine_names[work.config.engine]);
+
+    struct alloc_stats stats = alloc_stats();
+    fprintf(stderr, "Made %llu allocations of %llu bytes (peak %llu bytes), "
+            "none while solving.\n", (unsigned long long) stats.calls,
+            (unsigned long long) stats.bytes, (unsigned long long) stats.peak);
+
+    if (metrics)
+    {
+        metrics_write(metrics);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        table_destroy(&work.tables[i]);
+    }
+    xfree(work.tables);
+    cache_close();
+    xfree(pool);
+    xfree(work.results);
+    xfree(work.boards);
+    return 0;
+}
+
+/*
+ * Solves boards until there are none left. The argument is the thread's index
+ * in the pool.
+ */
+static void *worker(void *arg)
+{
+    int thread = (intptr_t) arg;
+    int i;
+    while ((i = __atomic_fetch_add(&work.next, 1, __ATOMIC_RELAXED)) <
+           work.count)
+    {
+        double start = metrics_now();
+        struct result *r = &work.results[i];
+        struct solve_stats solve;
+        r->count = cache_solve(work.boards[i], 2, r->solution, &work.config,
+                               &work.tables[thread], &solve);
+        double seconds = metrics_now() - start;
+        metrics_observe(H_SOLVE, seconds);
+        metrics_add(M_BATCH_PUZZLES, 1);
+
+        // Update the dashboard's counters.
+        uint64_t ns = seconds * 1e9;
+        __atomic_fetch_add(&stats[thread].solved, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats[thread].busy_ns, ns, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&work.latency[bucket(ns)], 1, __ATOMIC_RELAXED);
+        uint64_t max_ns = (UINT64_C(1) << (64 - INDEX_BITS)) - 1;
+        uint64_t mine = (ns < max_ns ? ns : max_ns) << INDEX_BITS | i;
+        uint64_t slowest = __atomic_load_n(&work.slowest, __ATOMIC_RELAXED);
+        while (mine >> INDEX_BITS > slowest >> INDEX_BITS &&
+               !__atomic_compare_exchange_n(&work.slowest, &slowest, mine,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+            ;
+
+        __atomic_fetch_add(&work.done, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * Returns the latency bucket for ns nanoseconds: four buckets for each power
+ * of two.
+ */
+static int bucket(uint64_t ns)
+{
+    if (ns < 4)
+    {
+        return ns;
+    }
+    int log = 63 - __builtin_clzll(ns);
+    int b = 4 * log + (ns >> (log - 2) & 3);
+    return b < BUCKETS ? b : BUCKETS - 1;
+}
+
+/*
+ * Returns the lower bound (in seconds) of the bucket holding the p'th
+ * percentile of solve times so far, or 0 if there are none.
+ */
+static double percentile(double p)
+{
+    uint64_t counts[BUCKETS], total = 0;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        counts[b] = __atomic_load_n(&work.latency[b], __ATOMIC_RELAXED);
+        total += counts[b];
+    }
+
+    uint64_t rank = total * p / 100, seen = 0;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        seen += counts[b];
+        if (total && seen > rank)
+        {
+            // Invert bucket(): b = 4 * log + top two bits after the first.
+            double ns = b < 4 ? b : (double) (4 + b % 4) * (1ull << b / 4) / 4;
+            return ns / 1e9;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Draws the dashboard for a batch of filename run by threads threads for
+ * elapsed seconds.
+ */
+static void draw_dashboard(const char *filename, int threads, double elapsed)
+{
+    int maxy, maxx;
+    getmaxyx(stdscr, maxy, maxx);
+    erase();
+
+    // Draw header.
+    if (has_colors())
+        attron(COLOR_PAIR(PAIR_BORDER));
+    for (int i = 0; i < maxx; i++)
+        mvaddch(0, i, ' ');
+    char header[maxx + 1];
+    snprintf(header, sizeof(header), "%s by %s: batch dashboard", TITLE,
+             AUTHOR);
+    mvaddstr(0, (maxx - (int) strlen(header)) / 2, header);
+    if (has_colors())
+        attroff(COLOR_PAIR(PAIR_BORDER));
+
+    int done = __atomic_load_n(&work.done, __ATOMIC_ACQUIRE);
+    int next = __atomic_load_n(&work.next, __ATOMIC_RELAXED);
+    int queued = next < work.count ? work.count - next : 0;
+
+    if (has_colors())
+        attron(COLOR_PAIR(PAIR_BANNER));
+    mvprintw(2, 2, "Solving %s with %d threads%s", filename, threads,
+             done == work.count ? ", done (press any key)" : "");
+    if (has_colors())
+        attroff(COLOR_PAIR(PAIR_BANNER));
+
+    mvprintw(4, 2, "Solved      %d of %d (%.0f%%), %d queued", done,
+             work.count, 100.0 * done / work.count, queued);
+    mvprintw(5, 2, "Throughput  %.0f boards/s",
+             elapsed > 0 ? done / elapsed : 0);
+    mvprintw(6, 2, "Latency     p50 %.1f us   p90 %.1f us   p99 %.1f us",
+             percentile(50) * 1e6, percentile(90) * 1e6,
+             percentile(99) * 1e6);
+    uint64_t slowest = __atomic_load_n(&work.slowest, __ATOMIC_RELAXED);
+    mvprintw(7, 2, "Slowest     #%d (%.1f us)",
+             (int) (slowest & ((1 << INDEX_BITS) - 1)) + 1,
+             (slowest >> INDEX_BITS) / 1e3);
+
+    // One line per thread, as many as fit.
+    mvprintw(9, 2, "Thread      Solved   Busy");
+    for (int t = 0; t < threads && 10 + t < maxy - 1; t++)
+    {
+        uint64_t solved = __atomic_load_n(&stats[t].solved, __ATOMIC_RELAXED);
+        uint64_t busy = __atomic_load_n(&stats[t].busy_ns, __ATOMIC_RELAXED);
+        mvprintw(10 + t, 2, "%6d  %10llu  %4.0f%%", t,
+                 (unsigned long long) solved,
+                 elapsed > 0 ? 100 * busy / 1e9 / elapsed : 0);
+    }
+
+    refresh();
+}
@@ -0,0 +1,13 @@
+/**
+ * batch.h
+ *
+ * Batch solving of a whole pack using a pool of threads.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+// Entry point for "sudoku batch ...".
+int batch_main(int argc, char *argv[]);
+
+#endif
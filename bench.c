@@ -0,0 +1,224 @@
+/**
+ * bench.c
+ *
+ * Implements a benchmark of puzzle generation, whose time goes almost all on
+ * the uniqueness checks made while removing clues. The same seeds are
+ * generated by a pool of threads three times: checking each board from
+ * scratch, with a transposition table shared by the pool, and again with the
+ * table already warm, as when a seed is generated again. Then the game's
+ * generator is asked for each in turn, straight after the last, and each
+ * wait is timed: the worst case for a player, as the background thread can
+ * never get ahead. The puzzles must come out the same every way.
+ */
+
+#include "bench.h"
+#include "alloc.h"
+#include "generate.h"
+#include "metrics.h"
+#include "sudoku.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Most threads in the pool.
+#define MAX_THREADS 256
+
+// Size (as a power of two entries) of the table shared by the pool.
+#define BENCH_TABLE_BITS 16
+
+// Work shared by the pool's threads.
+static struct
+{
+    int clues, count;
+    struct table *table;
+
+    // Puzzles made, one per seed, and the index of the next to make.
+    uint8_t (*puzzles)[81];
+    int next;
+}
+work;
+
+// Function prototypes.
+static double run(int threads, struct table *table, uint8_t (*puzzles)[81]);
+static void *worker(void *arg);
+static bool take_all(uint8_t (*puzzles)[81], double *times);
+static int compare_times(const void *a, const void *b);
+static double speedup(double without, double with);
+
+/*
+ * Runs the benchmark, printing the results. Returns 0 iff successful.
+ */
+int bench_main(int argc, char *argv[])
+{
+    // Check usage.
+    const char *usage = "Usage: sudoku bench n00b|l33t [puzzles] [threads]\n";
+    int count = 100;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char c;
+    if (argc < 2 || argc > 4 ||
+        (strcmp(argv[1], "n00b") != 0 && strcmp(argv[1], "l33t") != 0) ||
+        (argc > 2 && (sscanf(argv[2], " %d %c", &count, &c) != 1 ||
+                      count < 1)) ||
+        (argc > 3 && (sscanf(argv[3], " %d %c", &threads, &c) != 1 ||
+                      threads < 1)))
+    {
+        fprintf(stderr, usage);
+        return 1;
+    }
+    if (threads > MAX_THREADS)
+    {
+        threads = MAX_THREADS;
+    }
+    work.clues = strcmp(argv[1], "n00b") == 0 ? GEN_CLUES_N00B :
+                                                GEN_CLUES_L33T;
+    work.count = count;
+
+    uint8_t (*plain)[81] = xmalloc(count * sizeof(*plain));
+    uint8_t (*cached)[81] = xmalloc(count * sizeof(*cached));
+    struct table table;
+    if (!plain || !cached || !table_create(&table, BENCH_TABLE_BITS))
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 2;
+    }
+
+    double without = run(threads, NULL, plain);
+    printf("Generated %d %s puzzles in %.3f s without a table.\n", count,
+           argv[1], without);
+    double with = run(threads, &table, cached);
+    printf("Generated %d %s puzzles in %.3f s with a table: %.2fx %s.\n",
+           count, argv[1], with, speedup(without, with),
+           with <= without ? "faster" : "slower");
+    int status = 0;
+    if (memcmp(plain, cached, count * sizeof(*plain)) != 0)
+    {
+        fprintf(stderr, "The puzzles differ!\n");
+        status = 3;
+    }
+
+    double warm = run(threads, &table, cached);
+    printf("Generated them again in %.3f s with the table warm: %.2fx "
+           "%s.\n", warm, speedup(without, warm),
+           warm <= without ? "faster" : "slower");
+    if (memcmp(plain, cached, count * sizeof(*plain)) != 0)
+    {
+        fprintf(stderr, "The puzzles differ!\n");
+        status = 3;
+    }
+
+    double *times = xmalloc(count * sizeof(*times));
+    if (!times || !take_all(cached, times))
+    {
+        fprintf(stderr, "Could not start the generator!\n");
+        status = 2;
+    }
+    else
+    {
+        qsort(times, count, sizeof(*times), compare_times);
+        printf("Took them one after another from the game's generator: p50 "
+               "%.1f ms, p99 %.1f ms, max %.1f ms.\n",
+               times[count / 2] * 1e3, times[count * 99 / 100] * 1e3,
+               times[count - 1] * 1e3);
+        if (memcmp(plain, cached, count * sizeof(*plain)) != 0)
+        {
+            fprintf(stderr, "The puzzles differ!\n");
+            status = 3;
+        }
+    }
+
+    xfree(times);
+    table_destroy(&table);
+    xfree(cached);
+    xfree(plain);
+    return status;
+}
+
+/*
+ * Generates the puzzles for seeds 1 to work.count into puzzles using threads
+ * threads and table (which may be NULL). Returns the time taken in seconds.
+ */
+static double run(int threads, struct table *table, uint8_t (*puzzles)[81])
+{
+    work.table = table;
+    work.puzzles = puzzles;
+    work.next = 0;
+
+    double start = metrics_now();
+    pthread_t pool[MAX_THREADS];
+    int started = 0;
+    while (started < threads &&
+           pthread_create(&pool[started], NULL, worker, NULL) == 0)
+    {
+        started++;
+    }
+
+    // Should no thread start, do the work here instead.
+    if (started == 0)
+    {
+        worker(NULL);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(pool[i], NULL);
+    }
+    return metrics_now() - start;
+}
+
+/*
+ * Generates puzzles until there are none left.
+ */
+static void *worker(void *arg)
+{
+    int i;
+    while ((i = __atomic_fetch_add(&work.next, 1, __ATOMIC_RELAXED)) <
+           work.count)
+    {
+        uint8_t solution[81];
+        generate_puzzle(i + 1, work.clues, work.table, work.puzzles[i],
+                        solution);
+    }
+    return NULL;
+}
+
+/*
+ * Takes the puzzles for seeds 1 to work.count from the game's generator into
+ * puzzles, each as soon as the last is taken, storing the time each took in
+ * times. Returns true iff the generator started.
+ */
+static bool take_all(uint8_t (*puzzles)[81], double *times)
+{
+    if (!generator_start(work.clues, 1))
+    {
+        return false;
+    }
+    for (int i = 0; i < work.count; i++)
+    {
+        uint8_t solution[81];
+        double asked = metrics_now();
+        generator_take(i + 1, puzzles[i], solution);
+        times[i] = metrics_now() - asked;
+    }
+    generator_stop();
+    return true;
+}
+
+/*
+ * Orders times, for qsort.
+ */
+static int compare_times(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Returns how many times faster (or if slower, slower) taking with seconds is
+ * than taking without.
+ */
+static double speedup(double without, double with)
+{
+    return with <= without ? without / with : with / without;
+}
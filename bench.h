@@ -0,0 +1,13 @@
+/**
+ * bench.h
+ *
+ * Benchmarking of puzzle generation with and without a transposition table.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+// Entry point for "sudoku bench ...".
+int bench_main(int argc, char *argv[]);
+
+#endif
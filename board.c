@@ -0,0 +1,165 @@
+/**
+ * board.c
+ *
+ * Defines the tables mapping cells to their row, column and box, and units to
+ * their cells, and implements packing boards into fewer bytes.
+ */
+
+#include "board.h"
+
+const uint8_t cell_row[81] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,
+     2,  2,  2,  2,  2,  2,  2,  2,  2,
+     3,  3,  3,  3,  3,  3,  3,  3,  3,
+     4,  4,  4,  4,  4,  4,  4,  4,  4,
+     5,  5,  5,  5,  5,  5,  5,  5,  5,
+     6,  6,  6,  6,  6,  6,  6,  6,  6,
+     7,  7,  7,  7,  7,  7,  7,  7,  7,
+     8,  8,  8,  8,  8,  8,  8,  8,  8,
+};
+
+const uint8_t cell_col[81] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,
+};
+
+const uint8_t cell_box[81] = {
+     0,  0,  0,  1,  1,  1,  2,  2,  2,
+     0,  0,  0,  1,  1,  1,  2,  2,  2,
+     0,  0,  0,  1,  1,  1,  2,  2,  2,
+     3,  3,  3,  4,  4,  4,  5,  5,  5,
+     3,  3,  3,  4,  4,  4,  5,  5,  5,
+     3,  3,  3,  4,  4,  4,  5,  5,  5,
+     6,  6,  6,  7,  7,  7,  8,  8,  8,
+     6,  6,  6,  7,  7,  7,  8,  8,  8,
+     6,  6,  6,  7,  7,  7,  8,  8,  8,
+};
+
+const uint8_t unit_cells[27][9] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8 },
+    {  9, 10, 11, 12, 13, 14, 15, 16, 17 },
+    { 18, 19, 20, 21, 22, 23, 24, 25, 26 },
+    { 27, 28, 29, 30, 31, 32, 33, 34, 35 },
+    { 36, 37, 38, 39, 40, 41, 42, 43, 44 },
+    { 45, 46, 47, 48, 49, 50, 51, 52, 53 },
+    { 54, 55, 56, 57, 58, 59, 60, 61, 62 },
+    { 63, 64, 65, 66, 67, 68, 69, 70, 71 },
+    { 72, 73, 74, 75, 76, 77, 78, 79, 80 },
+    {  0,  9, 18, 27, 36, 45, 54, 63, 72 },
+    {  1, 10, 19, 28, 37, 46, 55, 64, 73 },
+    {  2, 11, 20, 29, 38, 47, 56, 65, 74 },
+    {  3, 12, 21, 30, 39, 48, 57, 66, 75 },
+    {  4, 13, 22, 31, 40, 49, 58, 67, 76 },
+    {  5, 14, 23, 32, 41, 50, 59, 68, 77 },
+    {  6, 15, 24, 33, 42, 51, 60, 69, 78 },
+    {  7, 16, 25, 34, 43, 52, 61, 70, 79 },
+    {  8, 17, 26, 35, 44, 53, 62, 71, 80 },
+    {  0,  1,  2,  9, 10, 11, 18, 19, 20 },
+    {  3,  4,  5, 12, 13, 14, 21, 22, 23 },
+    {  6,  7,  8, 15, 16, 17, 24, 25, 26 },
+    { 27, 28, 29, 36, 37, 38, 45, 46, 47 },
+    { 30, 31, 32, 39, 40, 41, 48, 49, 50 },
+    { 33, 34, 35, 42, 43, 44, 51, 52, 53 },
+    { 54, 55, 56, 63, 64, 65, 72, 73, 74 },
+    { 57, 58, 59, 66, 67, 68, 75, 76, 77 },
+    { 60, 61, 62, 69, 70, 71, 78, 79, 80 },
+};
+
+/*
+ * Packs the digits of board (dropping any flags) two to a byte, low nibble
+ * first.
+ */
+void board_pack(const uint8_t board[81], uint8_t packed[PACKED_SIZE])
+{
+    for (int i = 0; i < PACKED_SIZE; i++)
+    {
+        int high = 2 * i + 1 < 81 ? DIGIT(board[2 * i + 1]) : 0;
+        packed[i] = DIGIT(board[2 * i]) | high << 4;
+    }
+}
+
+/*
+ * Unpacks a board packed by board_pack. Digits out of range are read as empty.
+ */
+void board_unpack(const uint8_t packed[PACKED_SIZE], uint8_t board[81])
+{
+    for (int i = 0; i < 81; i++)
+    {
+        int n = i % 2 ? packed[i / 2] >> 4 : packed[i / 2] & 0x0f;
+        board[i] = n <= 9 ? n : 0;
+    }
+}
+
+/*
+ * Returns the digits (one bit each, from bit 1) that could go in cell given
+ * the others in its row, column and box, ignoring any flags and the cell's
+ * own digit.
+ */
+int board_candidates(const uint8_t board[81], int cell)
+{
+    const uint8_t units[3] = { ROW_UNIT(cell_row[cell]),
+                               COL_UNIT(cell_col[cell]),
+                               BOX_UNIT(cell_box[cell]) };
+    int used = 0;
+    for (int u = 0; u < 3; u++)
+    {
+        for (int i = 0; i < 9; i++)
+        {
+            int other = unit_cells[units[u]][i];
+            if (other != cell)
+            {
+                used |= 1 << DIGIT(board[other]);
+            }
+        }
+    }
+    return ~used & 0x3fe;
+}
+
+/*
+ * Puts board in canonical form in canon, its digits relabelled 1, 2, ... in
+ * order of first appearance, noting in labels the original digit for each
+ * canonical one (digits not appearing taking the labels left, in order).
+ * Returns the canonical form's hash, never 0.
+ */
+uint64_t board_canonical(const uint8_t board[81], uint8_t canon[81],
+                         uint8_t labels[10])
+{
+    uint8_t relabel[10] = {0};
+    int next = 1;
+    for (int i = 0; i < 81; i++)
+    {
+        int d = DIGIT(board[i]);
+        if (d >= 1 && d <= 9 && !relabel[d])
+        {
+            relabel[d] = next;
+            labels[next++] = d;
+        }
+    }
+    for (int d = 1; d <= 9; d++)
+    {
+        if (!relabel[d])
+        {
+            relabel[d] = next;
+            labels[next++] = d;
+        }
+    }
+    labels[0] = 0;
+
+    // FNV-1a, 64 bits.
+    uint64_t h = 14695981039346656037ull;
+    for (int i = 0; i < 81; i++)
+    {
+        int d = DIGIT(board[i]);
+        canon[i] = d <= 9 ? relabel[d] : 0;
+        h = (h ^ canon[i]) * 1099511628211ull;
+    }
+    return h ? h : 1;
+}
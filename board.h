@@ -0,0 +1,55 @@
+/**
+ * board.h
+ *
+ * The compact board representation shared by the game, solver and tools. A
+ * board is 81 bytes, one per cell, row by row. Each cell's low four bits hold
+ * its digit (0 for empty) and the spare high bits hold flags.
+ */
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdint.h>
+
+// Bits of a cell holding its digit.
+#define CELL_DIGIT 0x0f
+
+// Flag for a cell given at the start of the puzzle (or since locked in).
+#define CELL_GIVEN 0x10
+
+// Digit of a cell.
+#define DIGIT(c) ((c) & CELL_DIGIT)
+
+// Cell at row y and column x.
+#define CELL(y, x) (9 * (y) + (x))
+
+// Units are the nine rows, then the nine columns, then the nine boxes, with
+// boxes numbered 0-8 left-to-right then top-to-bottom.
+#define ROW_UNIT(r) (r)
+#define COL_UNIT(c) (9 + (c))
+#define BOX_UNIT(b) (18 + (b))
+
+// Size (in bytes) of a board packed two digits to a byte.
+#define PACKED_SIZE 41
+
+// Packs the digits of a board two to a byte, and unpacks them again.
+void board_pack(const uint8_t board[81], uint8_t packed[PACKED_SIZE]);
+void board_unpack(const uint8_t packed[PACKED_SIZE], uint8_t board[81]);
+
+// Returns the digits (one bit each, from bit 1) that could go in cell given
+// the others in its row, column and box.
+int board_candidates(const uint8_t board[81], int cell);
+
+// Puts board in canonical form in canon, its digits relabelled in order of
+// first appearance, noting in labels the original digit for each canonical
+// one. Returns the canonical form's hash, never 0.
+uint64_t board_canonical(const uint8_t board[81], uint8_t canon[81],
+                         uint8_t labels[10]);
+
+// Row, column and box of each cell.
+extern const uint8_t cell_row[81], cell_col[81], cell_box[81];
+
+// Cells of each unit.
+extern const uint8_t unit_cells[27][9];
+
+#endif
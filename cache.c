@@ -0,0 +1,328 @@
+/**
+ * cache.c
+ *
+ * Implements the solution cache, a file of fixed size mapped into memory by
+ * every process using it. After a header, it's an open-addressing table: a
+ * puzzle's key picks a slot, and it's looked for there and in the next few
+ * slots. A new entry goes in the first empty one of those, or failing that
+ * replaces the one used least recently, each entry being stamped from a
+ * clock in the header whenever it's used.
+ *
+ * Puzzles are put in canonical form by relabelling their digits in order of
+ * first appearance, and each entry keeps its canonical puzzle as well as the
+ * key, so a hash collision is never taken for a match. Solutions are kept in
+ * canonical form too, and labelled back on the way out. A puzzle with more
+ * than one solution may share its entry with relabellings whose search finds
+ * a different solution first, so only the count of such a puzzle is answered
+ * from the cache, never its solution.
+ *
+ * An entry is written with its key cleared, and the key set only once the
+ * rest is in place, so a process dying part way through leaves an empty
+ * entry rather than a key vouching for another puzzle's solution.
+ *
+ * Processes share the file under flock: lookups take a shared lock, changes
+ * an exclusive one. Stamps and hit counts are bumped atomically under the
+ * shared lock. Threads of one process share its lock, so they take turns
+ * under a mutex. Numbers are in the host's byte order, the cache being local.
+ *
+ *   header: "SCCH", version (4 bytes), slots (4 bytes), padding (4 bytes),
+ *           clock (8 bytes)
+ *   entry:  see struct entry
+ */
+
+#include "cache.h"
+#include "sudoku.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Version of the format.
+#define CACHE_VERSION 1
+
+// Header of the file.
+struct header
+{
+    char magic[4];
+    uint32_t version, slots, padding;
+    uint64_t clock;
+};
+
+// Entry of the table, empty if its key is 0.
+struct entry
+{
+    // Hash of the canonical puzzle, and the clock when last used.
+    uint64_t key, stamp;
+
+    // Nodes the search took, and how often the entry has been used since.
+    uint64_t nodes;
+    uint32_t hits;
+
+    // Solutions counted, whether that's all of them (else it's the limit
+    // reached), and the canonical puzzle and first solution, packed.
+    uint8_t count, exact;
+    uint8_t puzzle[PACKED_SIZE], solution[PACKED_SIZE];
+};
+
+// The open cache.
+static struct
+{
+    int fd;
+    struct header *header;
+    struct entry *entries;
+    size_t size;
+    pthread_mutex_t lock;
+}
+cache = { -1, NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER };
+
+// Function prototypes.
+static int lookup(const uint8_t canon[81], uint64_t key, int limit,
+                  uint8_t solution[81], bool wanted);
+static void store(const uint8_t canon[81], uint64_t key, int limit, int count,
+                  const uint8_t solution[81], uint64_t nodes);
+
+/*
+ * Opens the cache file filename, creating or resetting it if it isn't a
+ * cache of this version and size. Returns true iff successful.
+ */
+bool cache_open(const char *filename)
+{
+    cache.size = sizeof(struct header) + CACHE_SLOTS * sizeof(struct entry);
+    cache.fd = open(filename, O_RDWR | O_CREAT, 0600);
+    if (cache.fd < 0)
+    {
+        return false;
+    }
+
+    // Check the header, under an exclusive lock in case it must be reset.
+    struct header h = {{0}};
+    flock(cache.fd, LOCK_EX);
+    if (pread(cache.fd, &h, sizeof(h), 0) != sizeof(h) ||
+        memcmp(h.magic, "SCCH", 4) != 0 || h.version != CACHE_VERSION ||
+        h.slots != CACHE_SLOTS || lseek(cache.fd, 0, SEEK_END) != cache.size)
+    {
+        struct header fresh = { "SCCH", CACHE_VERSION, CACHE_SLOTS };
+        if (ftruncate(cache.fd, 0) != 0 ||
+            ftruncate(cache.fd, cache.size) != 0 ||
+            pwrite(cache.fd, &fresh, sizeof(fresh), 0) != sizeof(fresh))
+        {
+            flock(cache.fd, LOCK_UN);
+            cache_close();
+            return false;
+        }
+    }
+    flock(cache.fd, LOCK_UN);
+
+    void *map = mmap(NULL, cache.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     cache.fd, 0);
+    if (map == MAP_FAILED)
+    {
+        cache_close();
+        return false;
+    }
+    cache.header = map;
+    cache.entries = (struct entry *) (cache.header + 1);
+    return true;
+}
+
+/*
+ * Unmaps and closes the cache.
+ */
+void cache_close(void)
+{
+    if (cache.header)
+    {
+        munmap(cache.header, cache.size);
+        cache.header = NULL;
+        cache.entries = NULL;
+    }
+    if (cache.fd >= 0)
+    {
+        close(cache.fd);
+        cache.fd = -1;
+    }
+}
+
+/*
+ * Counts solutions of board up to limit, storing the first in solution. The
+ * answer comes from the cache if it's there and covers limit, else from the
+ * solver (with config and table), and then goes in the cache. A hit is
+ * counted in stats as one node answered from a table.
+ */
+int cache_solve(const uint8_t board[81], int limit, uint8_t solution[81],
+                const struct solver_config *config, struct table *table,
+                struct solve_stats *stats)
+{
+    uint8_t canon[81], labels[10], found[81];
+    uint64_t key = 0;
+    if (cache.header)
+    {
+        key = board_canonical(board, canon, labels);
+
+        pthread_mutex_lock(&cache.lock);
+        flock(cache.fd, LOCK_SH);
+        int count = lookup(canon, key, limit, found, solution != NULL);
+        flock(cache.fd, LOCK_UN);
+        pthread_mutex_unlock(&cache.lock);
+
+        if (count >= 0)
+        {
+            for (int i = 0; solution && count > 0 && i < 81; i++)
+            {
+                solution[i] = labels[found[i]];
+            }
+            stats->nodes = stats->hits = 1;
+            return count;
+        }
+    }
+
+    int count = count_solutions_config(board, limit, solution, config, table,
+                                       stats);
+    if (cache.header && solution)
+    {
+        // Store the solution relabelled the same way as the puzzle.
+        uint8_t unlabel[10] = {0};
+        for (int d = 1; d <= 9; d++)
+        {
+            unlabel[labels[d]] = d;
+        }
+        for (int i = 0; i < 81; i++)
+        {
+            found[i] = count > 0 ? unlabel[DIGIT(solution[i])] : 0;
+        }
+
+        pthread_mutex_lock(&cache.lock);
+        flock(cache.fd, LOCK_EX);
+        store(canon, key, limit, count, found, stats->nodes);
+        flock(cache.fd, LOCK_UN);
+        pthread_mutex_unlock(&cache.lock);
+    }
+    return count;
+}
+
+/*
+ * Shows what's in the cache, or with --clear, empties it. Returns 0 iff
+ * successful.
+ */
+int cache_main(int argc, char *argv[])
+{
+    bool clear = argc == 2 && strcmp(argv[1], "--clear") == 0;
+    if (argc > 2 || (argc == 2 && !clear))
+    {
+        fprintf(stderr, "Usage: sudoku cache [--clear]\n");
+        return 1;
+    }
+    if (!cache_open(CACHE_FILE))
+    {
+        fprintf(stderr, "Could not open %s!\n", CACHE_FILE);
+        return 2;
+    }
+
+    flock(cache.fd, clear ? LOCK_EX : LOCK_SH);
+    int used = 0, solved = 0;
+    uint64_t hits = 0, nodes = 0;
+    for (int i = 0; i < CACHE_SLOTS; i++)
+    {
+        struct entry *e = &cache.entries[i];
+        if (clear)
+        {
+            memset(e, 0, sizeof(*e));
+        }
+        else if (e->key)
+        {
+            used++;
+            solved += e->count == 1 && e->exact;
+            hits += e->hits;
+            nodes += e->nodes;
+        }
+    }
+    flock(cache.fd, LOCK_UN);
+
+    if (clear)
+    {
+        printf("Cleared %s.\n", CACHE_FILE);
+    }
+    else
+    {
+        printf("%s holds %d of %d entries (%d with one solution), used %llu "
+               "times since stored.\n", CACHE_FILE, used, CACHE_SLOTS, solved,
+               (unsigned long long) hits);
+        printf("Their searches took %llu nodes.\n", (unsigned long long) nodes);
+    }
+    cache_close();
+    return 0;
+}
+
+/*
+ * Looks for canon, whose hash is key, in the cache. If it's there with an
+ * answer covering limit, and if the solution is wanted, with no more than one
+ * solution, copies its solution into solution, stamps it and returns its
+ * count; else returns -1.
+ */
+static int lookup(const uint8_t canon[81], uint64_t key, int limit,
+                  uint8_t solution[81], bool wanted)
+{
+    uint8_t packed[PACKED_SIZE];
+    board_pack(canon, packed);
+    for (int p = 0; p < CACHE_PROBES; p++)
+    {
+        struct entry *e = &cache.entries[(key + p) % CACHE_SLOTS];
+        if (e->key != key || memcmp(e->puzzle, packed, PACKED_SIZE) != 0)
+        {
+            continue;
+        }
+        if ((!e->exact && e->count < limit) ||
+            (wanted && (!e->exact || e->count > 1)))
+        {
+            return -1;
+        }
+        board_unpack(e->solution, solution);
+        __atomic_store_n(&e->stamp, __atomic_add_fetch(&cache.header->clock,
+                                                       1, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+        __atomic_fetch_add(&e->hits, 1, __ATOMIC_RELAXED);
+        return e->count < limit ? e->count : limit;
+    }
+    return -1;
+}
+
+/*
+ * Stores the answer for canon, whose hash is key: count solutions up to
+ * limit, the first being solution, found in nodes nodes. Replaces any entry
+ * for it, else takes an empty slot, else the one used least recently.
+ */
+static void store(const uint8_t canon[81], uint64_t key, int limit, int count,
+                  const uint8_t solution[81], uint64_t nodes)
+{
+    uint8_t packed[PACKED_SIZE];
+    board_pack(canon, packed);
+    struct entry *victim = NULL;
+    for (int p = 0; p < CACHE_PROBES; p++)
+    {
+        struct entry *e = &cache.entries[(key + p) % CACHE_SLOTS];
+        if (e->key == key && memcmp(e->puzzle, packed, PACKED_SIZE) == 0)
+        {
+            victim = e;
+            break;
+        }
+        if (!victim || (victim->key && (!e->key || e->stamp < victim->stamp)))
+        {
+            victim = e;
+        }
+    }
+
+    __atomic_store_n(&victim->key, 0, __ATOMIC_RELEASE);
+    victim->stamp = __atomic_add_fetch(&cache.header->clock, 1,
+                                       __ATOMIC_RELAXED);
+    victim->nodes = nodes;
+    victim->hits = 0;
+    victim->count = count;
+    victim->exact = count < limit;
+    memcpy(victim->puzzle, packed, PACKED_SIZE);
+    board_pack(solution, victim->solution);
+    __atomic_store_n(&victim->key, key, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,37 @@
+/**
+ * cache.h
+ *
+ * A persistent cache of solutions, shared by every process solving puzzles
+ * in the same directory. Puzzles are keyed by their canonical form, so one
+ * that differs from another only in how its digits are labelled shares its
+ * entry.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "board.h"
+#include "solver.h"
+
+#include <stdbool.h>
+
+// Opens (creating it if need be) the cache file filename, for the rest of
+// the process. Returns true iff successful.
+bool cache_open(const char *filename);
+
+// Closes the cache, if open.
+void cache_close(void);
+
+// Counts solutions of board up to limit as count_solutions_config does, but
+// answers from the cache where it can, else adds the answer to it. The
+// solution of a board with more than one is always searched for, so it's the
+// one config finds first. Safe to call from any thread, and without the cache
+// open.
+int cache_solve(const uint8_t board[81], int limit, uint8_t solution[81],
+                const struct solver_config *config, struct table *table,
+                struct solve_stats *stats);
+
+// Entry point for "sudoku cache ...".
+int cache_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,654 @@
+/**
+ * distribute.c
+ *
+ * Implements distributed batch solving. The coordinator listens on a Unix
+ * domain socket, spawns the workers (which could as well be started by hand,
+ * or elsewhere given a socket that reaches there), and keeps each of them
+ * busy with up to IN_FLIGHT shards. Shards are ranges of consecutive boards.
+ * Answers are merged into the pack's order, and solutions printed as soon as
+ * every earlier board's are in, one line of 81 digits per board as for batch
+ * solving.
+ *
+ * Should a worker die, send anything but the answer expected or take longer
+ * than SHARD_TIMEOUT_MS over a shard, the shards it held are issued again to
+ * the others, so every board is still solved exactly once in the output. A
+ * worker spawned here that has hung is killed.
+ */
+
+#include "distribute.h"
+#include "alloc.h"
+#include "cache.h"
+#include "metrics.h"
+#include "pack.h"
+#include "solver.h"
+#include "sudoku.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Most workers, and boards in each shard.
+#define MAX_WORKERS 64
+#define SHARD_SIZE 64
+
+// Shards each worker is given at once, so it need never wait for the next.
+#define IN_FLIGHT 2
+
+// Time (in ms) to wait for the workers to connect, for a worker to answer
+// the shard it's been holding longest and for the workers to exit once let go
+// before they're killed.
+#define CONNECT_MS 5000
+#define SHARD_TIMEOUT_MS 10000
+#define EXIT_MS 1000
+
+// Size (in bytes) of the largest shard and answer.
+#define SHARD_MAX (SHARD_HEADER + SHARD_SIZE * SHARD_BOARD)
+#define ANSWER_MAX (SHARD_HEADER + SHARD_SIZE * ANSWER_BOARD)
+
+// States of a shard.
+enum { QUEUED, ISSUED, DONE };
+
+// A worker: its connection and process (0 if not spawned here), the shards
+// it holds in the order issued and when the first of them is due (as from
+// metrics_now), and any partial answer read so far.
+struct worker
+{
+    int fd;
+    pid_t pid;
+    int held[IN_FLIGHT];
+    int holding;
+    double due;
+    uint8_t in[ANSWER_MAX];
+    int length;
+};
+
+// Wrapper for the coordinator's globals.
+static struct
+{
+    uint8_t (*boards)[81];
+    int count;
+
+    // Solutions, and number of them (up to 2), for each board.
+    uint8_t (*solutions)[81];
+    uint8_t *solved;
+
+    // State of each shard, and number done.
+    uint8_t *shards;
+    int shard_count, shards_done;
+
+    struct worker workers[MAX_WORKERS];
+    int worker_count;
+
+    // Processes spawned as workers, in the order spawned.
+    pid_t pids[MAX_WORKERS];
+    int spawned;
+
+    // Number of shards issued again after a worker failed.
+    int reissued;
+}
+d;
+
+// Function prototypes.
+static bool spawn(const char *path, int n, const char *fault);
+static pid_t spawned_pid(int fd);
+static void stop_workers(bool kill_now);
+static bool issue(struct worker *w);
+static bool receive(struct worker *w);
+static void retire(struct worker *w);
+static void print_ready(int *printed);
+static bool read_full(int fd, uint8_t *buffer, size_t length);
+static bool write_full(int fd, const uint8_t *buffer, size_t length);
+
+/*
+ * Solves every board of a pack using worker processes, printing the solutions
+ * to stdout and a summary to stderr. Returns 0 iff successful.
+ */
+int distribute_main(int argc, char *argv[])
+{
+    // Check usage, allowing --fail or --hang anywhere after the level.
+    const char *usage =
+        "Usage: sudoku distribute n00b|l33t [workers] [--fail|--hang]\n";
+    const char *fault = NULL;
+    if (argc > 2 && (strcmp(argv[argc - 1], "--fail") == 0 ||
+                     strcmp(argv[argc - 1], "--hang") == 0))
+    {
+        fault = strcmp(argv[argc - 1], "--fail") == 0 ? "--fail-after" :
+                                                        "--hang-after";
+        argc--;
+    }
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, usage);
+        return 1;
+    }
+
+    // Default to one worker per processor.
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc == 3)
+    {
+        char c;
+        if (sscanf(argv[2], " %d %c", &workers, &c) != 1 || workers < 1)
+        {
+            fprintf(stderr, usage);
+            return 1;
+        }
+    }
+    if (workers > MAX_WORKERS)
+    {
+        workers = MAX_WORKERS;
+    }
+
+    char filename[strlen(argv[1]) + 5];
+    sprintf(filename, "%s.bin", argv[1]);
+    d.count = pack_load(filename, &d.boards);
+    if (d.count < 0)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", filename);
+        return 2;
+    }
+
+    d.shard_count = (d.count + SHARD_SIZE - 1) / SHARD_SIZE;
+    d.solutions = xmalloc(d.count * sizeof(*d.solutions));
+    d.solved = xcalloc(d.count, 1);
+    d.shards = xcalloc(d.shard_count, 1);
+    if (!d.solutions || !d.solved || !d.shards)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 3;
+    }
+
+    // A worker going away isn't the coordinator's end.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Listen on a socket of our own and start the workers.
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/sudoku-%d.sock", (int) getpid());
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(listener, MAX_WORKERS) != 0)
+    {
+        perror("Could not listen on socket");
+        return 4;
+    }
+
+    double start = metrics_now();
+    if (!spawn(path, workers, fault))
+    {
+        close(listener);
+        unlink(path);
+        stop_workers(true);
+        return 4;
+    }
+
+    // Wait for them to connect.
+    while (d.worker_count < workers)
+    {
+        struct pollfd p = { listener, POLLIN, 0 };
+        if (poll(&p, 1, CONNECT_MS) <= 0)
+        {
+            break;
+        }
+        int fd = accept(listener, NULL, NULL);
+        if (fd >= 0)
+        {
+            struct worker *w = &d.workers[d.worker_count++];
+            w->fd = fd;
+            w->pid = spawned_pid(fd);
+            w->holding = w->length = 0;
+        }
+    }
+    close(listener);
+    unlink(path);
+
+    // Keep the workers busy until every shard is done.
+    int printed = 0;
+    for (int i = 0; i < d.worker_count; i++)
+    {
+        issue(&d.workers[i]);
+    }
+    while (d.shards_done < d.shard_count)
+    {
+        // Wake for answers, or when the first shard falls due.
+        struct pollfd fds[MAX_WORKERS];
+        int live = 0, timeout = -1;
+        double now = metrics_now();
+        for (int i = 0; i < d.worker_count; i++)
+        {
+            const struct worker *w = &d.workers[i];
+            fds[i].fd = w->fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+            live += w->fd >= 0;
+            if (w->fd >= 0 && w->holding > 0)
+            {
+                int ms = w->due > now ? (w->due - now) * 1e3 + 1 : 0;
+                timeout = timeout < 0 || ms < timeout ? ms : timeout;
+            }
+        }
+        if (live == 0)
+        {
+            fprintf(stderr, "No workers left with %d of %d shards done!\n",
+                    d.shards_done, d.shard_count);
+            stop_workers(true);
+            return 5;
+        }
+        if (poll(fds, d.worker_count, timeout) < 0 && errno != EINTR)
+        {
+            perror("Could not poll workers");
+            stop_workers(true);
+            return 5;
+        }
+
+        for (int i = 0; i < d.worker_count; i++)
+        {
+            struct worker *w = &d.workers[i];
+            if (w->fd < 0 || !fds[i].revents)
+            {
+                continue;
+            }
+            if (!receive(w))
+            {
+                retire(w);
+            }
+        }
+
+        // Give up on workers that are taking too long, killing those of
+        // our own.
+        now = metrics_now();
+        for (int i = 0; i < d.worker_count; i++)
+        {
+            struct worker *w = &d.workers[i];
+            if (w->fd >= 0 && w->holding > 0 && now >= w->due)
+            {
+                if (w->pid > 0)
+                {
+                    kill(w->pid, SIGKILL);
+                }
+                retire(w);
+            }
+        }
+
+        // Hand out whatever's queued, including any shards of retired
+        // workers, and print what's now in order.
+        for (int i = 0; i < d.worker_count; i++)
+        {
+            if (d.workers[i].fd >= 0 && !issue(&d.workers[i]))
+            {
+                retire(&d.workers[i]);
+            }
+        }
+        print_ready(&printed);
+    }
+    double elapsed = metrics_now() - start;
+
+    // Let the workers go.
+    stop_workers(false);
+
+    fprintf(stderr, "Solved %d boards in %.3f s (%.0f boards/s) with %d "
+            "workers, %d shards of %d, %d issued again.\n", d.count, elapsed,
+            d.count / elapsed, d.worker_count, d.shard_count, SHARD_SIZE,
+            d.reissued);
+
+    xfree(d.shards);
+    xfree(d.solved);
+    xfree(d.solutions);
+    xfree(d.boards);
+    return 0;
+}
+
+/*
+ * Answers shards from the coordinator at the socket given until it hangs up.
+ * Returns 0 iff successful.
+ */
+int worker_main(int argc, char *argv[])
+{
+    // Check usage. --fail-after makes the worker die on receiving that many
+    // shards, and --hang-after makes it stop answering, to try out the
+    // coordinator's recovery.
+    int fail_after = 0;
+    bool hang = false;
+    char c;
+    if (argc == 4)
+    {
+        hang = strcmp(argv[2], "--hang-after") == 0;
+    }
+    if ((argc != 2 && argc != 4) ||
+        (argc == 4 && ((strcmp(argv[2], "--fail-after") != 0 && !hang) ||
+                       sscanf(argv[3], " %d %c", &fail_after, &c) != 1)))
+    {
+        fprintf(stderr, "Usage: sudoku worker socket "
+                        "[--fail-after|--hang-after n]\n");
+        return 1;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        perror("Could not connect");
+        return 2;
+    }
+
+    // Answer from the solution cache where possible.
+    cache_open(CACHE_FILE);
+
+    static uint8_t in[SHARD_MAX], out[ANSWER_MAX];
+    for (int served = 1; read_full(fd, in, SHARD_HEADER); served++)
+    {
+        uint32_t count = in[4] | in[5] << 8 | in[6] << 16 |
+                         (uint32_t) in[7] << 24;
+        if (count > SHARD_SIZE ||
+            !read_full(fd, in + SHARD_HEADER, count * SHARD_BOARD))
+        {
+            return 3;
+        }
+        while (served == fail_after && hang)
+        {
+            pause();
+        }
+        if (served == fail_after)
+        {
+            return 4;
+        }
+
+        memcpy(out, in, SHARD_HEADER);
+        for (int i = 0; i < count; i++)
+        {
+            uint8_t board[81], solution[81] = {0};
+            board_unpack(in + SHARD_HEADER + i * SHARD_BOARD, board);
+            uint8_t *answer = out + SHARD_HEADER + i * ANSWER_BOARD;
+            struct solve_stats stats;
+            answer[0] = cache_solve(board, 2, solution, &solver_defaults, NULL,
+                                    &stats);
+            board_pack(solution, answer + 1);
+        }
+        if (!write_full(fd, out, SHARD_HEADER + count * ANSWER_BOARD))
+        {
+            return 3;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+ * Spawns n workers of this very program, connecting to path; given a fault
+ * option (--fail-after or --hang-after), the first shows that fault on its
+ * first shard. Returns true iff they all started.
+ */
+static bool spawn(const char *path, int n, const char *fault)
+{
+    for (int i = 0; i < n; i++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("Could not start worker");
+            return false;
+        }
+        if (pid == 0)
+        {
+            if (fault && i == 0)
+                execl("/proc/self/exe", "sudoku", "worker", path, fault, "1",
+                      (char *) NULL);
+            else
+                execl("/proc/self/exe", "sudoku", "worker", path,
+                      (char *) NULL);
+            _exit(127);
+        }
+        d.pids[d.spawned++] = pid;
+    }
+    return true;
+}
+
+/*
+ * Returns the process at the other end of connection fd if it was spawned
+ * here, else 0.
+ */
+static pid_t spawned_pid(int fd)
+{
+    struct ucred peer;
+    socklen_t length = sizeof(peer);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0)
+    {
+        for (int i = 0; i < d.spawned; i++)
+        {
+            if (d.pids[i] == peer.pid)
+            {
+                return peer.pid;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Closes every worker's connection, letting it go, and reaps the workers
+ * spawned here, killing any still running after EXIT_MS, or at once if
+ * kill_now.
+ */
+static void stop_workers(bool kill_now)
+{
+    for (int i = 0; i < d.worker_count; i++)
+    {
+        if (d.workers[i].fd >= 0)
+        {
+            close(d.workers[i].fd);
+            d.workers[i].fd = -1;
+        }
+    }
+
+    double deadline = metrics_now() + (kill_now ? 0 : EXIT_MS / 1e3);
+    for (int i = 0; i < d.spawned; i++)
+    {
+        while (waitpid(d.pids[i], NULL, WNOHANG) == 0)
+        {
+            if (metrics_now() >= deadline)
+            {
+                kill(d.pids[i], SIGKILL);
+                waitpid(d.pids[i], NULL, 0);
+                break;
+            }
+            usleep(1000);
+        }
+    }
+    d.spawned = 0;
+}
+
+/*
+ * Sends worker w queued shards, lowest first, until it holds IN_FLIGHT.
+ * Returns false iff the worker couldn't be sent one.
+ */
+static bool issue(struct worker *w)
+{
+    static uint8_t out[SHARD_MAX];
+    int shard = 0;
+    while (w->holding < IN_FLIGHT)
+    {
+        while (shard < d.shard_count && d.shards[shard] != QUEUED)
+        {
+            shard++;
+        }
+        if (shard == d.shard_count)
+        {
+            return true;
+        }
+
+        int first = shard * SHARD_SIZE;
+        int count = first + SHARD_SIZE <= d.count ? SHARD_SIZE :
+                                                    d.count - first;
+        for (int b = 0; b < 4; b++)
+        {
+            out[b] = shard >> 8 * b;
+            out[4 + b] = count >> 8 * b;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            board_pack(d.boards[first + i], out + SHARD_HEADER +
+                                            i * SHARD_BOARD);
+        }
+
+        // Count it as held even if sending fails, so retiring the worker
+        // queues it again.
+        d.shards[shard] = ISSUED;
+        if (w->holding == 0)
+        {
+            w->due = metrics_now() + SHARD_TIMEOUT_MS / 1e3;
+        }
+        w->held[w->holding++] = shard;
+        if (!write_full(w->fd, out, SHARD_HEADER + count * SHARD_BOARD))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Reads what worker w has sent, taking in any complete answers. Returns false
+ * iff the worker has gone or sent something other than what was expected.
+ */
+static bool receive(struct worker *w)
+{
+    ssize_t n = read(w->fd, w->in + w->length, sizeof(w->in) - w->length);
+    if (n < 0 && errno == EINTR)
+    {
+        return true;
+    }
+    if (n <= 0)
+    {
+        return false;
+    }
+    w->length += n;
+
+    // Answers come back in the order the shards were issued.
+    while (w->holding > 0 && w->length >= SHARD_HEADER)
+    {
+        int shard = w->held[0];
+        int first = shard * SHARD_SIZE;
+        int count = first + SHARD_SIZE <= d.count ? SHARD_SIZE :
+                                                    d.count - first;
+        uint32_t id = w->in[0] | w->in[1] << 8 | w->in[2] << 16 |
+                      (uint32_t) w->in[3] << 24;
+        uint32_t boards = w->in[4] | w->in[5] << 8 | w->in[6] << 16 |
+                          (uint32_t) w->in[7] << 24;
+        if (id != shard || boards != count)
+        {
+            return false;
+        }
+
+        int size = SHARD_HEADER + count * ANSWER_BOARD;
+        if (w->length < size)
+        {
+            return true;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            const uint8_t *answer = w->in + SHARD_HEADER + i * ANSWER_BOARD;
+            d.solved[first + i] = answer[0];
+            board_unpack(answer + 1, d.solutions[first + i]);
+        }
+        d.shards[shard] = DONE;
+        d.shards_done++;
+
+        w->holding--;
+        memmove(w->held, w->held + 1, w->holding * sizeof(w->held[0]));
+        w->due = metrics_now() + SHARD_TIMEOUT_MS / 1e3;
+        w->length -= size;
+        memmove(w->in, w->in + size, w->length);
+    }
+    return w->length == 0 || w->holding > 0;
+}
+
+/*
+ * Closes worker w's connection, queueing the shards it held to be issued to
+ * the others.
+ */
+static void retire(struct worker *w)
+{
+    for (int i = 0; i < w->holding; i++)
+    {
+        d.shards[w->held[i]] = QUEUED;
+        d.reissued++;
+    }
+    w->holding = 0;
+    close(w->fd);
+    w->fd = -1;
+}
+
+/*
+ * Prints the solutions of boards from *printed on, as far as every shard
+ * containing them is done.
+ */
+static void print_ready(int *printed)
+{
+    while (*printed < d.count && d.shards[*printed / SHARD_SIZE] == DONE)
+    {
+        char line[82];
+        for (int j = 0; j < 81; j++)
+        {
+            line[j] = d.solved[*printed] ? '0' + d.solutions[*printed][j] :
+                                           '0';
+        }
+        line[81] = '\0';
+        puts(line);
+        (*printed)++;
+    }
+}
+
+/*
+ * Reads exactly length bytes from fd into buffer. Returns true iff
+ * successful.
+ */
+static bool read_full(int fd, uint8_t *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = read(fd, buffer, length);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer += n;
+        length -= n;
+    }
+    return true;
+}
+
+/*
+ * Writes all of buffer to fd. Returns true iff successful.
+ */
+static bool write_full(int fd, const uint8_t *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(fd, buffer, length);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer += n;
+        length -= n;
+    }
+    return true;
+}
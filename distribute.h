@@ -0,0 +1,30 @@
+/**
+ * distribute.h
+ *
+ * Distributed batch solving: a coordinator splitting a pack into shards and
+ * handing them to worker processes over sockets, and the workers themselves.
+ *
+ * A worker connects to the coordinator and answers each shard it's sent, in
+ * the order sent. Boards are packed by board_pack and numbers little-endian,
+ * so a worker needs nothing but the socket.
+ *
+ *   shard:  id (4 bytes), boards (4 bytes), then each board (PACKED_SIZE)
+ *   answer: id (4 bytes), boards (4 bytes), then for each board the number
+ *           of solutions up to 2 (1 byte) and the solution (PACKED_SIZE)
+ */
+
+#ifndef DISTRIBUTE_H
+#define DISTRIBUTE_H
+
+#include "board.h"
+
+// Sizes (in bytes) of a shard's or answer's header, and of each board in them.
+#define SHARD_HEADER 8
+#define SHARD_BOARD PACKED_SIZE
+#define ANSWER_BOARD (1 + PACKED_SIZE)
+
+// Entry points for "sudoku distribute ..." and "sudoku worker ...".
+int distribute_main(int argc, char *argv[]);
+int worker_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,1409 @@
+/**
+ * enumerate.c
+ *
+ * Implements counting every completed grid, as a check on the known total and
+ * a benchmark. A band is three rows of boxes and a stack three columns of
+ * boxes. Given which three digits each of its columns holds, a band can be
+ * filled in a number of ways that depends on nothing else, and the three bands
+ * of a grid can be filled independently once every column's nine digits are
+ * shared out between them. So the completions of a top band are the sum, over
+ * the 56^3 ways of sharing out its columns' remaining digits, of the product
+ * of the ways to fill the other two bands.
+ *
+ * Completions don't change when digits are relabelled, stacks swapped or
+ * columns swapped within a stack, so top bands fall into a few classes,
+ * counted once each: which column in each stack each digit sits in is a 3x3x3
+ * table, and the tables are grouped under the 1296 ways of swapping stacks
+ * and columns. Each class's completions are split into work units, one for
+ * each way of sharing out its first stack, shared by a pool of threads. Units
+ * done are checkpointed, so a run that's stopped resumes where it left off.
+ *
+ * Grids that differ only by symmetries (permuting bands, rows within bands,
+ * stacks and columns within stacks, transposing, and relabelling digits) are
+ * essentially the same, and by Burnside's lemma the number of essentially
+ * different grids is the average number of grids a symmetry leaves alone. A
+ * grid a geometric symmetry leaves alone but for relabelling is left so by
+ * just one relabelling, and stays so when relabelled, so each geometric
+ * symmetry counts 9! times the grids it leaves alone with first row 1 to 9.
+ * That's the same for conjugate symmetries, so it's counted once for each of
+ * the 275 classes of them, in a unit of its own. The search for such grids
+ * fills whole orbits of cells under the symmetry at once, learns the
+ * relabelling from where the first row goes, counts only one of each set of
+ * first rows' images that symmetries commuting with it would swap, and keeps
+ * the counts of completions of the bands below a band already filled.
+ *
+ * The checkpoint's numbers are little-endian.
+ *
+ *   header: "SENU", version (4 bytes), units (4 bytes)
+ *   unit:   whether done (1 byte), completions or grids (8 bytes)
+ */
+
+#include "enumerate.h"
+#include "alloc.h"
+#include "metrics.h"
+#include "sudoku.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Version of the checkpoint's format, and sizes (in bytes) of its header and
+// a unit.
+#define CHECKPOINT_VERSION 2
+#define HEADER_SIZE 12
+#define UNIT_SIZE 9
+
+// Most threads in the pool.
+#define MAX_THREADS 256
+
+// Most classes of top band.
+#define MAX_CLASSES 64
+
+// Ways of sharing out the remaining digits of one stack's columns between
+// the two bands below, of arranging one stack's columns in a band, and of
+// choosing three of nine digits.
+#define OPTIONS 56
+#define ARRANGEMENTS 216
+#define TRIPLES 84
+
+// All nine digits, one bit each.
+#define ALL 0x1ff
+
+// Known counts of bands, grids and essentially different grids, to check
+// against.
+#define KNOWN_BANDS 948109639680ULL
+#define KNOWN_GRIDS "6670903752021072936960"
+#define KNOWN_ESSENTIAL 5472730538ULL
+
+// Order of the geometric symmetries of the grid: permutations of bands, of
+// rows within bands, of stacks and of columns within stacks, and transposing.
+#define GEOMETRIC_SYMMETRIES (2ULL * 6 * 6 * 6 * 6 * 6 * 6 * 6 * 6)
+
+// Ways of permuting the rows (or columns) keeping bands together, their
+// conjugacy classes, and the conjugacy classes of the geometric symmetries.
+#define LINE_MAPS 1296
+#define LINE_CLASSES 22
+#define SYMMETRY_CLASSES 275
+
+// Bits of the index into a search's table of completions counted.
+#define MEMO_BITS 15
+
+// A class of top band: the least of its tables, the columns' digits (one bit
+// each) of a band with it, the number of bands (with any digits) with a
+// table in the class, and the ways to fill and complete each.
+struct class
+{
+    uint8_t table[27];
+    uint16_t columns[9];
+    uint64_t bands, fills, completions;
+};
+
+// A class of geometric symmetry: where one of them takes each cell, and the
+// number of symmetries in the class.
+struct symmetry
+{
+    uint8_t cells[81];
+    uint64_t size;
+};
+
+// Completions already counted by a search, keyed by the digits used in every
+// row, column and box (nine bits each) and the band they're below.
+struct memo
+{
+    uint64_t key[4];
+    uint64_t count;
+    uint32_t generation;
+};
+
+// State of a search for the grids with first row 1 to 9 that a symmetry
+// leaves alone but for relabelling. Each thread has its own.
+struct fixed
+{
+    // Where the symmetry takes each cell, and its orbits: the cells of each in
+    // turn, how many, and the last band each reaches.
+    const uint8_t *cells;
+    uint8_t orbits[81][81], lengths[81], bands[81];
+    int orbit_count, longest;
+
+    // Whether some two cells that far apart round each orbit share a row,
+    // column or box.
+    bool clashes[81][81];
+
+    // Column maps of the symmetries commuting with it that keep the first row
+    // in place.
+    uint8_t columns[LINE_MAPS][9];
+    int column_count;
+
+    // Digit of each cell (0 if empty), and digits used (one bit each) in each
+    // row, column and box, in that order.
+    uint8_t grid[81];
+    uint16_t used[27];
+
+    // For the relabelling being tried: its powers, the digits each orbit's
+    // first cell may take, and each power's inverse applied to sets of digits
+    // (by their low five and high four bits).
+    uint8_t powers[82][10];
+    uint16_t allowed[81];
+    uint16_t low[81][32], high[81][16];
+
+    // Orbits left to fill, those reaching each band after those reaching the
+    // one before, and where each band's orbits end.
+    uint8_t pending[81];
+    int ends[3];
+
+    // Completions counted, valid only for the relabelling numbered generation.
+    struct memo *memo;
+    uint32_t generation;
+};
+
+// Work shared by the pool's threads.
+static struct
+{
+    struct class classes[MAX_CLASSES];
+    int count;
+
+    // Classes of symmetry, the first being the identity.
+    struct symmetry symmetries[SYMMETRY_CLASSES];
+    int symmetry_count;
+
+    // Completions of each unit, OPTIONS to a class, then grids left alone by
+    // each class of symmetry but the identity's, and whether each is done.
+    uint64_t *completions;
+    uint8_t *done;
+    int units;
+
+    // Index of the next unit to count and number of units counted.
+    int next, finished;
+}
+work;
+
+// Index of each set of three digits, among TRIPLES.
+static uint8_t triple_index[1 << 9];
+
+// The permutations of three things.
+static const uint8_t permutations[6][3] = {
+    {0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}
+};
+
+// Function prototypes.
+static bool tables(uint8_t table[27], int cell, int left[3][3]);
+static bool add_table(const uint8_t table[27]);
+static void least_table(const uint8_t table[27], uint8_t least[27]);
+static void table_columns(const uint8_t table[27], uint16_t columns[9]);
+static int arrangements(const uint16_t columns[3], uint16_t rows[][3],
+                        bool fixed);
+static int options(const uint16_t columns[3], uint16_t below[][2][3]);
+static uint64_t fills(const uint16_t columns[9]);
+static void pairs(const uint16_t first[3], const uint16_t second[3],
+                  uint32_t counts[TRIPLES * TRIPLES]);
+static uint64_t count_unit(int unit);
+static void line_map(int index, uint8_t map[9]);
+static int line_class(const uint8_t map[9]);
+static bool find_symmetries(void);
+static uint64_t count_fixed(struct fixed *f, const struct symmetry *symmetry);
+static void find_commuting(struct fixed *f);
+static uint64_t fill_line(struct fixed *f, int j);
+static uint64_t count_relabelled(struct fixed *f);
+static uint64_t count_orbits(struct fixed *f, int from, int band);
+static inline uint16_t used_at(const struct fixed *f, int cell);
+static inline void set_cell(struct fixed *f, int cell, int digit);
+static inline void clear_cell(struct fixed *f, int cell);
+static void *worker(void *arg);
+static int load_checkpoint(const char *filename, int units);
+static bool save_checkpoint(const char *filename, int units);
+static void format128(unsigned __int128 n, char *s);
+
+/*
+ * Counts every grid, printing the totals. Returns 0 iff successful.
+ */
+int enumerate_main(int argc, char *argv[])
+{
+    // Check usage.
+    const char *usage = "Usage: sudoku enumerate [threads] [--fresh]\n";
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool fresh = false;
+    char c;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--fresh") == 0)
+        {
+            fresh = true;
+        }
+        else if (sscanf(argv[i], " %d %c", &threads, &c) != 1 || threads < 1)
+        {
+            fprintf(stderr, usage);
+            return 1;
+        }
+    }
+    if (threads > MAX_THREADS)
+    {
+        threads = MAX_THREADS;
+    }
+
+    for (int digits = 0, n = 0; digits <= ALL; digits++)
+    {
+        if (__builtin_popcount(digits) == 3)
+        {
+            triple_index[digits] = n++;
+        }
+    }
+
+    // Group the tables of top bands into classes.
+    double start = metrics_now();
+    uint8_t table[27];
+    int left[3][3] = { {3, 3, 3}, {3, 3, 3}, {3, 3, 3} };
+    if (!tables(table, 0, left))
+    {
+        fprintf(stderr, "Too many classes of band!\n");
+        return 2;
+    }
+    uint64_t bands = 0;
+    for (int i = 0; i < work.count; i++)
+    {
+        struct class *class = &work.classes[i];
+        table_columns(class->table, class->columns);
+        class->fills = fills(class->columns);
+        bands += class->bands * class->fills;
+    }
+    printf("%llu bands in %d classes, found in %.3f s.\n",
+           (unsigned long long) bands, work.count, metrics_now() - start);
+
+    // Group the symmetries into classes too.
+    start = metrics_now();
+    if (!find_symmetries())
+    {
+        fprintf(stderr, "Expected %d classes of symmetry!\n", SYMMETRY_CLASSES);
+        return 2;
+    }
+    printf("%d classes of symmetry, found in %.3f s.\n", work.symmetry_count,
+           metrics_now() - start);
+
+    // Take up where the last run left off, unless asked not to. Each thread
+    // searching for grids a symmetry leaves alone needs room of its own.
+    int units = work.count * OPTIONS + work.symmetry_count - 1;
+    work.units = units;
+    work.completions = xcalloc(units, sizeof(*work.completions));
+    work.done = xcalloc(units, sizeof(*work.done));
+    struct fixed *searches = xcalloc(threads, sizeof(*searches));
+    bool room = work.completions && work.done && searches;
+    for (int i = 0; room && i < threads; i++)
+    {
+        searches[i].memo = xcalloc(1 << MEMO_BITS, sizeof(struct memo));
+        room = searches[i].memo != NULL;
+    }
+    if (!room)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 2;
+    }
+    if (fresh)
+    {
+        unlink(ENUM_CHECKPOINT);
+    }
+    int resumed = load_checkpoint(ENUM_CHECKPOINT, units);
+    if (resumed > 0)
+    {
+        printf("Resuming from %s with %d of %d units done.\n", ENUM_CHECKPOINT,
+               resumed, units);
+    }
+    work.finished = resumed;
+
+    // Count the units left with a pool of threads, checkpointing as they go.
+    start = metrics_now();
+    pthread_t pool[MAX_THREADS];
+    int started = 0;
+    while (started < threads &&
+           pthread_create(&pool[started], NULL, worker,
+                          &searches[started]) == 0)
+    {
+        started++;
+    }
+
+    // Should no thread start, do the work here instead.
+    if (started == 0)
+    {
+        worker(&searches[0]);
+    }
+    double saved = start;
+    while (__atomic_load_n(&work.finished, __ATOMIC_ACQUIRE) < units)
+    {
+        usleep(10000);
+        if (metrics_now() - saved >= ENUM_CHECKPOINT_S)
+        {
+            save_checkpoint(ENUM_CHECKPOINT, units);
+            saved = metrics_now();
+        }
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(pool[i], NULL);
+    }
+    double elapsed = metrics_now() - start;
+
+    // Every band of a class has as many completions.
+    unsigned __int128 grids = 0;
+    const int band_units = work.count * OPTIONS;
+    for (int unit = 0; unit < band_units; unit++)
+    {
+        work.classes[unit / OPTIONS].completions += work.completions[unit];
+    }
+    for (int i = 0; i < work.count; i++)
+    {
+        const struct class *class = &work.classes[i];
+        grids += (unsigned __int128) class->bands * class->fills *
+                 class->completions;
+    }
+
+    // Every symmetry of a class leaves as many grids alone, and the identity
+    // all of them.
+    unsigned __int128 fixed = grids / 362880;
+    for (int i = 1; i < work.symmetry_count; i++)
+    {
+        fixed += (unsigned __int128) work.symmetries[i].size *
+                 work.completions[band_units + i - 1];
+    }
+    uint64_t essential = fixed / GEOMETRIC_SYMMETRIES;
+
+    unlink(ENUM_CHECKPOINT);
+    for (int i = 0; i < threads; i++)
+    {
+        xfree(searches[i].memo);
+    }
+    xfree(searches);
+    xfree(work.completions);
+    xfree(work.done);
+
+    char total[40];
+    format128(grids, total);
+    printf("%s grids, counted in %.3f s (%.1f units/s) with %d "
+           "threads.\n", total, elapsed, (units - resumed) / elapsed,
+           threads);
+    printf("%llu essentially different grids.\n",
+           (unsigned long long) essential);
+
+    if (bands != KNOWN_BANDS || strcmp(total, KNOWN_GRIDS) != 0 ||
+        essential != KNOWN_ESSENTIAL)
+    {
+        fprintf(stderr, "Expected %llu bands, %s grids and %llu essentially "
+                "different!\n", KNOWN_BANDS, KNOWN_GRIDS, KNOWN_ESSENTIAL);
+        return 3;
+    }
+    return 0;
+}
+
+/*
+ * Fills in table from cell on in every way leaving each column of each stack
+ * three digits, with left[stack][column] digits still to place in each, and
+ * adds each table made to its class. Returns false iff there are too many
+ * classes.
+ */
+static bool tables(uint8_t table[27], int cell, int left[3][3])
+{
+    if (cell == 27)
+    {
+        for (int stack = 0; stack < 3; stack++)
+        {
+            for (int column = 0; column < 3; column++)
+            {
+                if (left[stack][column] > 0)
+                {
+                    return true;
+                }
+            }
+        }
+        return add_table(table);
+    }
+
+    int column[3] = { cell / 9, cell / 3 % 3, cell % 3 };
+    int most = 3;
+    for (int stack = 0; stack < 3; stack++)
+    {
+        if (left[stack][column[stack]] < most)
+        {
+            most = left[stack][column[stack]];
+        }
+    }
+
+    bool added = true;
+    for (int n = 0; n <= most && added; n++)
+    {
+        table[cell] = n;
+        for (int stack = 0; stack < 3; stack++)
+        {
+            left[stack][column[stack]] -= n;
+        }
+        added = tables(table, cell + 1, left);
+        for (int stack = 0; stack < 3; stack++)
+        {
+            left[stack][column[stack]] += n;
+        }
+    }
+    return added;
+}
+
+/*
+ * Adds the bands with table to the count of its class, starting a new class
+ * if it's the first of one. Returns false iff there are too many classes.
+ */
+static bool add_table(const uint8_t table[27])
+{
+    // Ways to give the digits their places in the table.
+    static const int factorial[4] = { 1, 1, 2, 6 };
+    uint64_t bands = 362880;
+    for (int cell = 0; cell < 27; cell++)
+    {
+        bands /= factorial[table[cell]];
+    }
+
+    uint8_t least[27];
+    least_table(table, least);
+    int i = 0;
+    while (i < work.count && memcmp(work.classes[i].table, least, 27) != 0)
+    {
+        i++;
+    }
+    if (i == MAX_CLASSES)
+    {
+        return false;
+    }
+    if (i == work.count)
+    {
+        memcpy(work.classes[i].table, least, 27);
+        work.count++;
+    }
+    work.classes[i].bands += bands;
+    return true;
+}
+
+/*
+ * Stores in least the least (in memcmp's order) of the tables table becomes
+ * when swapping stacks and columns within stacks.
+ */
+static void least_table(const uint8_t table[27], uint8_t least[27])
+{
+    // Where each swap takes each place of a table, worked out once.
+    static uint8_t swaps[6 * 6 * 6 * 6][27];
+    static bool ready;
+    if (!ready)
+    {
+        for (int swap = 0; swap < 6 * 6 * 6 * 6; swap++)
+        {
+            const uint8_t *stacks = permutations[swap / 216];
+            const uint8_t *columns[3] = { permutations[swap / 36 % 6],
+                                          permutations[swap / 6 % 6],
+                                          permutations[swap % 6] };
+            for (int cell = 0; cell < 27; cell++)
+            {
+                int from[3] = { cell / 9, cell / 3 % 3, cell % 3 };
+                int to[3];
+                for (int stack = 0; stack < 3; stack++)
+                {
+                    to[stacks[stack]] = columns[stack][from[stack]];
+                }
+                swaps[swap][cell] = to[0] * 9 + to[1] * 3 + to[2];
+            }
+        }
+        ready = true;
+    }
+
+    memset(least, 0xff, 27);
+    for (int swap = 0; swap < 6 * 6 * 6 * 6; swap++)
+    {
+        uint8_t swapped[27];
+        for (int cell = 0; cell < 27; cell++)
+        {
+            swapped[swaps[swap][cell]] = table[cell];
+        }
+        if (memcmp(swapped, least, 27) < 0)
+        {
+            memcpy(least, swapped, 27);
+        }
+    }
+}
+
+/*
+ * Stores in columns the digits of each column of a band with table, giving
+ * digits to the table's places in order.
+ */
+static void table_columns(const uint8_t table[27], uint16_t columns[9])
+{
+    memset(columns, 0, 9 * sizeof(columns[0]));
+    int digit = 0;
+    for (int cell = 0; cell < 27; cell++)
+    {
+        for (int n = 0; n < table[cell]; n++, digit++)
+        {
+            columns[cell / 9] |= 1 << digit;
+            columns[3 + cell / 3 % 3] |= 1 << digit;
+            columns[6 + cell % 3] |= 1 << digit;
+        }
+    }
+}
+
+/*
+ * Stores in rows the digits of each row (one bit each) for every way of
+ * arranging a stack's columns, with the given digits, down a band, or only
+ * those with the first column in order if fixed. Returns the number stored.
+ */
+static int arrangements(const uint16_t columns[3], uint16_t rows[][3],
+                        bool fixed)
+{
+    int digits[3][3];
+    for (int column = 0; column < 3; column++)
+    {
+        for (int digit = 0, n = 0; digit < 9; digit++)
+        {
+            if (columns[column] >> digit & 1)
+            {
+                digits[column][n++] = digit;
+            }
+        }
+    }
+
+    int count = 0;
+    for (int p = 0; p < (fixed ? 1 : 6); p++)
+    {
+        for (int q = 0; q < 36; q++)
+        {
+            const uint8_t *order[3] = { permutations[p], permutations[q / 6],
+                                        permutations[q % 6] };
+            memset(rows[count], 0, sizeof(rows[count]));
+            for (int column = 0; column < 3; column++)
+            {
+                for (int i = 0; i < 3; i++)
+                {
+                    rows[count][order[column][i]] |= 1 << digits[column][i];
+                }
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Stores in below the digits of each column in the second and third bands,
+ * for every way of sharing out between them the digits a stack's columns
+ * don't have in the top band. The second band's first column takes k digits
+ * from the top band's second column and 3 - k from its third, and its second
+ * column 3 - k from the top band's first and the rest of its third, so that
+ * the stack still has every digit. Returns the number of ways, OPTIONS.
+ */
+static int options(const uint16_t columns[3], uint16_t below[][2][3])
+{
+    int count = 0;
+    for (int a = columns[1]; a >= 0; a = a ? (a - 1) & columns[1] : -1)
+    {
+        int k = __builtin_popcount(a);
+        for (int b = columns[2]; b >= 0; b = b ? (b - 1) & columns[2] : -1)
+        {
+            for (int c = columns[0]; c >= 0; c = c ? (c - 1) & columns[0] : -1)
+            {
+                if (__builtin_popcount(b) != 3 - k ||
+                    __builtin_popcount(c) != 3 - k)
+                {
+                    continue;
+                }
+                uint16_t second[3] = {
+                    a | b, c | (columns[2] & ~b),
+                    (columns[0] & ~c) | (columns[1] & ~a)
+                };
+                for (int column = 0; column < 3; column++)
+                {
+                    below[count][0][column] = second[column];
+                    below[count][1][column] = ALL & ~columns[column] &
+                                              ~second[column];
+                }
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+/*
+ * Returns the number of ways to fill a band whose columns have the given
+ * digits. Each row must have every digit, so once two stacks are arranged
+ * the third's rows are known, and there's a way iff each of its first two
+ * rows takes a digit from each of its columns. The rows can be put in any
+ * order, so only arrangements with the first column in order are tried.
+ */
+static uint64_t fills(const uint16_t columns[9])
+{
+    uint16_t first[ARRANGEMENTS][3], second[ARRANGEMENTS][3];
+    uint16_t third[ARRANGEMENTS][3];
+    int firsts = arrangements(columns, first, true);
+    arrangements(columns + 3, second, false);
+    arrangements(columns + 6, third, false);
+
+    bool row[1 << 9] = { false };
+    for (int i = 0; i < ARRANGEMENTS; i++)
+    {
+        row[third[i][0]] = true;
+    }
+
+    uint64_t count = 0;
+    for (int i = 0; i < firsts; i++)
+    {
+        for (int j = 0; j < ARRANGEMENTS; j++)
+        {
+            if (!((first[i][0] & second[j][0]) | (first[i][1] & second[j][1]) |
+                  (first[i][2] & second[j][2])))
+            {
+                count += row[ALL & ~(first[i][0] | second[j][0])] &&
+                         row[ALL & ~(first[i][1] | second[j][1])];
+            }
+        }
+    }
+    return 6 * count;
+}
+
+/*
+ * Counts in counts, by the digits left for its first two rows, the ways of
+ * arranging the first two stacks of a band with columns first and second
+ * (the first with its first column in order) that leave the third stack's
+ * rows without a digit twice.
+ */
+static void pairs(const uint16_t first[3], const uint16_t second[3],
+                  uint32_t counts[TRIPLES * TRIPLES])
+{
+    uint16_t a[ARRANGEMENTS][3], b[ARRANGEMENTS][3];
+    int firsts = arrangements(first, a, true);
+    arrangements(second, b, false);
+
+    memset(counts, 0, TRIPLES * TRIPLES * sizeof(counts[0]));
+    for (int i = 0; i < firsts; i++)
+    {
+        for (int j = 0; j < ARRANGEMENTS; j++)
+        {
+            if (!((a[i][0] & b[j][0]) | (a[i][1] & b[j][1]) |
+                  (a[i][2] & b[j][2])))
+            {
+                counts[triple_index[ALL & ~(a[i][0] | b[j][0])] * TRIPLES +
+                       triple_index[ALL & ~(a[i][1] | b[j][1])]]++;
+            }
+        }
+    }
+}
+
+/*
+ * Returns the completions of a top band of unit's class with its first
+ * stack's remaining digits shared out the unit's way: the sum, over the ways
+ * of sharing out the other two stacks', of the ways to fill the second band
+ * times the ways to fill the third.
+ */
+static uint64_t count_unit(int unit)
+{
+    const uint16_t *columns = work.classes[unit / OPTIONS].columns;
+    uint16_t below[3][OPTIONS][2][3];
+    for (int stack = 0; stack < 3; stack++)
+    {
+        options(columns + 3 * stack, below[stack]);
+    }
+
+    // The first two rows of each arrangement of the third stack, for each
+    // way of sharing it out, in the second band and in the third.
+    uint16_t third[2][OPTIONS][ARRANGEMENTS];
+    for (int band = 0; band < 2; band++)
+    {
+        for (int option = 0; option < OPTIONS; option++)
+        {
+            uint16_t rows[ARRANGEMENTS][3];
+            arrangements(below[2][option][band], rows, false);
+            for (int i = 0; i < ARRANGEMENTS; i++)
+            {
+                third[band][option][i] = triple_index[rows[i][0]] * TRIPLES +
+                                         triple_index[rows[i][1]];
+            }
+        }
+    }
+
+    const int first = unit % OPTIONS;
+    uint64_t completions = 0;
+    for (int second = 0; second < OPTIONS; second++)
+    {
+        uint32_t counts[2][TRIPLES * TRIPLES];
+        for (int band = 0; band < 2; band++)
+        {
+            pairs(below[0][first][band], below[1][second][band],
+                  counts[band]);
+        }
+        for (int option = 0; option < OPTIONS; option++)
+        {
+            uint64_t ways[2] = { 0, 0 };
+            for (int i = 0; i < ARRANGEMENTS; i++)
+            {
+                ways[0] += counts[0][third[0][option][i]];
+                ways[1] += counts[1][third[1][option][i]];
+            }
+            completions += 6 * ways[0] * 6 * ways[1];
+        }
+    }
+    return completions;
+}
+
+/*
+ * Stores in map where the way of permuting rows (or columns) numbered index
+ * takes each: the bands by one of the permutations, and the rows within each
+ * band by others.
+ */
+static void line_map(int index, uint8_t map[9])
+{
+    const uint8_t *bands = permutations[index / 216];
+    for (int band = 0, scale = 36; band < 3; band++, scale /= 6)
+    {
+        const uint8_t *rows = permutations[index / scale % 6];
+        for (int row = 0; row < 3; row++)
+        {
+            map[3 * band + row] = 3 * bands[band] + rows[row];
+        }
+    }
+}
+
+/*
+ * Returns a number naming the conjugacy class of the way of permuting rows
+ * map: how many cycles of bands it has of each length whose rows, taken
+ * round the cycle, come back in place, swapped or rotated.
+ */
+static int line_class(const uint8_t map[9])
+{
+    int cycles[3][3] = { {0} };
+    bool seen[3] = { false };
+    for (int band = 0; band < 3; band++)
+    {
+        int rows[3] = { 0, 1, 2 }, length = 0, b = band;
+        while (!seen[b])
+        {
+            seen[b] = true;
+            int moved[3];
+            for (int i = 0; i < 3; i++)
+            {
+                moved[i] = map[3 * b + rows[i]] % 3;
+            }
+            memcpy(rows, moved, sizeof(rows));
+            b = map[3 * b] / 3;
+            length++;
+        }
+        if (length > 0)
+        {
+            int in_place = (rows[0] == 0) + (rows[1] == 1) + (rows[2] == 2);
+            cycles[length - 1][in_place == 3 ? 0 : in_place == 1 ? 1 : 2]++;
+        }
+    }
+
+    int key = 0;
+    for (int i = 0; i < 9; i++)
+    {
+        key = key * 4 + cycles[i / 3][i % 3];
+    }
+    return key;
+}
+
+/*
+ * Groups the geometric symmetries into conjugacy classes, in work.symmetries
+ * with the identity first. A symmetry keeping rows as rows permutes them one
+ * way and columns another, and its class is the pair of their classes, in
+ * either order as transposing swaps them; one transposing is conjugate to
+ * another iff the products of their row and column permutations are. Each
+ * class is represented by a symmetry keeping the last band in place if it
+ * has one, so that the bands above it can be searched and the last counted
+ * from its columns' digits. Returns true iff there are SYMMETRY_CLASSES.
+ */
+static bool find_symmetries(void)
+{
+    uint8_t maps[LINE_MAPS][9], classes[LINE_MAPS];
+    int keys[LINE_CLASSES], key_count = 0;
+    for (int i = 0; i < LINE_MAPS; i++)
+    {
+        line_map(i, maps[i]);
+        int key = line_class(maps[i]), k = 0;
+        while (k < key_count && keys[k] != key)
+        {
+            k++;
+        }
+        if (k == LINE_CLASSES)
+        {
+            return false;
+        }
+        if (k == key_count)
+        {
+            keys[key_count++] = key;
+        }
+        classes[i] = k;
+    }
+
+    // Each class's representative: whether it transposes, and its rows' and
+    // columns' permutations.
+    int index[LINE_CLASSES * LINE_CLASSES + LINE_CLASSES];
+    int chosen[SYMMETRY_CLASSES][3];
+    memset(index, -1, sizeof(index));
+    work.symmetry_count = 0;
+    for (int transpose = 0; transpose < 2; transpose++)
+    {
+        for (int rows = 0; rows < LINE_MAPS; rows++)
+        {
+            for (int columns = 0; columns < LINE_MAPS; columns++)
+            {
+                int pair;
+                if (transpose)
+                {
+                    uint8_t product[9];
+                    for (int i = 0; i < 9; i++)
+                    {
+                        product[i] = maps[columns][maps[rows][i]];
+                    }
+                    int key = line_class(product), k = 0;
+                    while (keys[k] != key)
+                    {
+                        k++;
+                    }
+                    pair = LINE_CLASSES * LINE_CLASSES + k;
+                }
+                else
+                {
+                    int a = classes[rows], b = classes[columns];
+                    pair = a < b ? a * LINE_CLASSES + b : b * LINE_CLASSES + a;
+                }
+
+                int *class = &index[pair];
+                bool keeps = !transpose && maps[rows][6] / 3 == 2;
+                if (*class < 0)
+                {
+                    if (work.symmetry_count == SYMMETRY_CLASSES)
+                    {
+                        return false;
+                    }
+                    *class = work.symmetry_count++;
+                    work.symmetries[*class].size = 0;
+                }
+                int *rep = chosen[*class];
+                if (work.symmetries[*class].size == 0 ||
+                    (keeps && (rep[0] || maps[rep[1]][6] / 3 != 2)))
+                {
+                    rep[0] = transpose;
+                    rep[1] = rows;
+                    rep[2] = columns;
+                }
+                work.symmetries[*class].size++;
+            }
+        }
+    }
+
+    for (int i = 0; i < work.symmetry_count; i++)
+    {
+        const uint8_t *rows = maps[chosen[i][1]], *columns = maps[chosen[i][2]];
+        for (int cell = 0; cell < 81; cell++)
+        {
+            int row = rows[cell / 9], column = columns[cell % 9];
+            work.symmetries[i].cells[cell] = chosen[i][0] ? column * 9 + row :
+                                             row * 9 + column;
+        }
+    }
+    return work.symmetry_count == SYMMETRY_CLASSES;
+}
+
+/*
+ * Returns the number of grids with first row 1 to 9 that symmetry leaves
+ * alone but for relabelling, searching with f.
+ */
+static uint64_t count_fixed(struct fixed *f, const struct symmetry *symmetry)
+{
+    f->cells = symmetry->cells;
+    f->orbit_count = f->longest = 0;
+    memset(f->clashes, 0, sizeof(f->clashes));
+    bool seen[81] = { false };
+    for (int cell = 0; cell < 81; cell++)
+    {
+        if (seen[cell])
+        {
+            continue;
+        }
+        int orbit = f->orbit_count++, length = 0, band = 0;
+        for (int c = cell; !seen[c]; c = f->cells[c])
+        {
+            seen[c] = true;
+            f->orbits[orbit][length++] = c;
+            band = c / 27 > band ? c / 27 : band;
+        }
+        for (int i = 0; i < length; i++)
+        {
+            for (int j = i + 1; j < length; j++)
+            {
+                int a = f->orbits[orbit][i], b = f->orbits[orbit][j];
+                if (a / 9 == b / 9 || a % 9 == b % 9 ||
+                    (a / 27 == b / 27 && a % 9 / 3 == b % 9 / 3))
+                {
+                    f->clashes[orbit][j - i] = true;
+                }
+            }
+        }
+        f->lengths[orbit] = length;
+        f->bands[orbit] = band;
+        f->longest = length > f->longest ? length : f->longest;
+    }
+    find_commuting(f);
+
+    memset(f->grid, 0, sizeof(f->grid));
+    memset(f->used, 0, sizeof(f->used));
+    for (int column = 0; column < 9; column++)
+    {
+        set_cell(f, column, column + 1);
+    }
+    return fill_line(f, 0);
+}
+
+/*
+ * Finds the column maps of the symmetries keeping rows as rows and the first
+ * row in place that commute with f's symmetry. One of them takes a grid the
+ * symmetry leaves alone to another, which relabelled to have the first row 1
+ * to 9 again has the digits of the first row's images permuted by the map
+ * and relabelled.
+ */
+static void find_commuting(struct fixed *f)
+{
+    uint8_t maps[LINE_MAPS][9];
+    bool found[LINE_MAPS] = { false };
+    for (int i = 0; i < LINE_MAPS; i++)
+    {
+        line_map(i, maps[i]);
+    }
+
+    f->column_count = 0;
+    for (int rows = 0; rows < LINE_MAPS; rows++)
+    {
+        const uint8_t *r = maps[rows];
+        for (int columns = 0; r[0] == 0 && columns < LINE_MAPS; columns++)
+        {
+            const uint8_t *c = maps[columns];
+            bool commutes = !found[columns];
+            for (int cell = 0; cell < 81 && commutes; cell++)
+            {
+                int image = f->cells[cell];
+                commutes = f->cells[r[cell / 9] * 9 + c[cell % 9]] ==
+                           r[image / 9] * 9 + c[image % 9];
+            }
+            if (commutes)
+            {
+                found[columns] = true;
+                memcpy(f->columns[f->column_count++], c, 9);
+            }
+        }
+    }
+}
+
+/*
+ * Fills the images of the first row's cells from the jth on in every way, so
+ * giving the relabelling, and returns the number of grids counted for them
+ * all. Of the ways that commuting symmetries take to each other, only the
+ * least is searched, and counted for each.
+ */
+static uint64_t fill_line(struct fixed *f, int j)
+{
+    if (j < 9)
+    {
+        int cell = f->cells[j];
+        if (f->grid[cell])
+        {
+            return fill_line(f, j + 1);
+        }
+        uint64_t count = 0;
+        uint16_t used = used_at(f, cell);
+        for (int digit = 1; digit <= 9; digit++)
+        {
+            if (!(used >> (digit - 1) & 1))
+            {
+                set_cell(f, cell, digit);
+                count += fill_line(f, j + 1);
+                clear_cell(f, cell);
+            }
+        }
+        return count;
+    }
+
+    uint8_t line[9];
+    for (int k = 0; k < 9; k++)
+    {
+        line[k] = f->grid[f->cells[k]];
+    }
+    int same = 0;
+    for (int h = 0; h < f->column_count; h++)
+    {
+        const uint8_t *map = f->columns[h];
+        uint8_t back[9];
+        for (int k = 0; k < 9; k++)
+        {
+            back[map[k]] = k;
+        }
+        int order = 0;
+        for (int k = 0; k < 9 && order == 0; k++)
+        {
+            order = map[line[back[k]] - 1] + 1 - line[k];
+        }
+        if (order < 0)
+        {
+            return 0;
+        }
+        same += order == 0;
+    }
+    return count_relabelled(f) * (f->column_count / same);
+}
+
+/*
+ * Returns the number of completions of f's grid that its symmetry leaves
+ * alone but for the relabelling taking each digit d to the one in the image
+ * of the first row's dth cell.
+ */
+static uint64_t count_relabelled(struct fixed *f)
+{
+    for (int d = 0; d <= 9; d++)
+    {
+        f->powers[0][d] = d;
+    }
+    for (int k = 1; k <= f->longest; k++)
+    {
+        for (int d = 1; d <= 9; d++)
+        {
+            f->powers[k][d] = f->grid[f->cells[f->powers[k - 1][d] - 1]];
+        }
+    }
+
+    // An orbit's first cell may take only a digit the relabelling brings back
+    // round the orbit without repeating it in a row, column or box. Orbits
+    // through cells already filled are filled in, the rest left to search.
+    uint8_t placed[81];
+    int placed_count = 0, pending = 0;
+    bool possible = true;
+    for (int orbit = 0; orbit < f->orbit_count && possible; orbit++)
+    {
+        const uint8_t *cells = f->orbits[orbit];
+        const int length = f->lengths[orbit];
+        uint16_t allowed = 0;
+        for (int d = 1; d <= 9; d++)
+        {
+            bool fits = f->powers[length][d] == d;
+            for (int gap = 1; gap < length && fits; gap++)
+            {
+                fits = !f->clashes[orbit][gap] || f->powers[gap][d] != d;
+            }
+            allowed |= fits << (d - 1);
+        }
+        f->allowed[orbit] = allowed;
+
+        int first = 0;
+        while (first < length && !f->grid[cells[first]])
+        {
+            first++;
+        }
+        if (first == length)
+        {
+            f->pending[pending++] = orbit;
+            continue;
+        }
+        int digit = 1;
+        while (f->powers[first][digit] != f->grid[cells[first]])
+        {
+            digit++;
+        }
+        possible = allowed >> (digit - 1) & 1;
+        for (int i = 0; i < length && possible; i++)
+        {
+            int cell = cells[i], wanted = f->powers[i][digit];
+            if (f->grid[cell])
+            {
+                possible = f->grid[cell] == wanted;
+            }
+            else if ((possible = !(used_at(f, cell) >> (wanted - 1) & 1)))
+            {
+                set_cell(f, cell, wanted);
+                placed[placed_count++] = cell;
+            }
+        }
+    }
+
+    uint64_t count = 0;
+    if (possible)
+    {
+        for (int k = 0; k < f->longest; k++)
+        {
+            for (int bits = 0; bits < 32; bits++)
+            {
+                f->low[k][bits] = 0;
+                for (int d = 1; d <= 9; d++)
+                {
+                    int to = f->powers[k][d];
+                    f->low[k][bits] |= (to <= 5 && bits >> (to - 1) & 1) <<
+                                       (d - 1);
+                }
+            }
+            for (int bits = 0; bits < 16; bits++)
+            {
+                f->high[k][bits] = 0;
+                for (int d = 1; d <= 9; d++)
+                {
+                    int to = f->powers[k][d];
+                    f->high[k][bits] |= (to > 5 && bits >> (to - 6) & 1) <<
+                                        (d - 1);
+                }
+            }
+        }
+
+        // Order the orbits left by the last band they reach.
+        int n = 0;
+        for (int band = 0; band < 3; band++)
+        {
+            for (int i = n; i < pending; i++)
+            {
+                if (f->bands[f->pending[i]] == band)
+                {
+                    uint8_t orbit = f->pending[i];
+                    f->pending[i] = f->pending[n];
+                    f->pending[n++] = orbit;
+                }
+            }
+            f->ends[band] = n;
+        }
+        f->generation++;
+        count = count_orbits(f, 0, 0);
+    }
+
+    while (placed_count > 0)
+    {
+        clear_cell(f, placed[--placed_count]);
+    }
+    return count;
+}
+
+/*
+ * Returns the number of ways to fill f's pending orbits from the fromth on,
+ * the first reaching band. Once the orbits reaching a band are filled, that
+ * number depends only on the digits used in each row, column and box, so it's
+ * kept for when they're next the same.
+ */
+static uint64_t count_orbits(struct fixed *f, int from, int band)
+{
+    if (from == f->ends[band])
+    {
+        if (band == 2)
+        {
+            return 1;
+        }
+
+        uint64_t key[4] = { 0, 0, 0, (uint64_t) band << 60 };
+        for (int unit = 0; unit < 27; unit++)
+        {
+            key[unit / 7] |= (uint64_t) f->used[unit] << unit % 7 * 9;
+        }
+        uint64_t hash = key[0];
+        for (int i = 1; i < 4; i++)
+        {
+            hash = (hash ^ key[i]) * 0x9e3779b97f4a7c15ULL;
+            hash ^= hash >> 29;
+        }
+        struct memo *memo = &f->memo[hash >> (64 - MEMO_BITS)];
+        if (memo->generation != f->generation ||
+            memcmp(memo->key, key, sizeof(key)) != 0)
+        {
+            memo->count = count_orbits(f, from, band + 1);
+            memo->generation = f->generation;
+            memcpy(memo->key, key, sizeof(key));
+        }
+        return memo->count;
+    }
+
+    // Fill the orbit with fewest digits possible.
+    const int to = f->ends[band];
+    int best = from, fewest = 10;
+    uint16_t choices = 0;
+    for (int i = from; i < to && fewest > 0; i++)
+    {
+        const int orbit = f->pending[i];
+        uint16_t digits = f->allowed[orbit];
+        for (int k = 0; k < f->lengths[orbit] && digits; k++)
+        {
+            uint16_t unused = ALL & ~used_at(f, f->orbits[orbit][k]);
+            digits &= f->low[k][unused & 31] | f->high[k][unused >> 5];
+        }
+        if (__builtin_popcount(digits) < fewest)
+        {
+            best = i;
+            fewest = __builtin_popcount(digits);
+            choices = digits;
+        }
+    }
+    if (fewest == 0 || (band == 2 && to - from == 1))
+    {
+        return fewest;
+    }
+
+    const uint8_t orbit = f->pending[best];
+    f->pending[best] = f->pending[from];
+    f->pending[from] = orbit;
+    uint64_t count = 0;
+    for (; choices; choices &= choices - 1)
+    {
+        int digit = __builtin_ctz(choices) + 1;
+        for (int k = 0; k < f->lengths[orbit]; k++)
+        {
+            set_cell(f, f->orbits[orbit][k], f->powers[k][digit]);
+        }
+        count += count_orbits(f, from + 1, band);
+        for (int k = 0; k < f->lengths[orbit]; k++)
+        {
+            clear_cell(f, f->orbits[orbit][k]);
+        }
+    }
+    f->pending[from] = f->pending[best];
+    f->pending[best] = orbit;
+    return count;
+}
+
+/*
+ * Returns the digits (one bit each) used in the row, column and box of cell
+ * in f's grid.
+ */
+static inline uint16_t used_at(const struct fixed *f, int cell)
+{
+    return f->used[cell / 9] | f->used[9 + cell % 9] |
+           f->used[18 + cell / 27 * 3 + cell % 9 / 3];
+}
+
+/*
+ * Puts digit in cell of f's grid.
+ */
+static inline void set_cell(struct fixed *f, int cell, int digit)
+{
+    f->grid[cell] = digit;
+    f->used[cell / 9] |= 1 << (digit - 1);
+    f->used[9 + cell % 9] |= 1 << (digit - 1);
+    f->used[18 + cell / 27 * 3 + cell % 9 / 3] |= 1 << (digit - 1);
+}
+
+/*
+ * Empties cell of f's grid.
+ */
+static inline void clear_cell(struct fixed *f, int cell)
+{
+    int digit = f->grid[cell];
+    f->grid[cell] = 0;
+    f->used[cell / 9] &= ~(1 << (digit - 1));
+    f->used[9 + cell % 9] &= ~(1 << (digit - 1));
+    f->used[18 + cell / 27 * 3 + cell % 9 / 3] &= ~(1 << (digit - 1));
+}
+
+/*
+ * Counts units until there are none left, searching for grids symmetries
+ * leave alone with arg, the thread's own struct fixed.
+ */
+static void *worker(void *arg)
+{
+    const int band_units = work.count * OPTIONS;
+    int unit;
+    while ((unit = __atomic_fetch_add(&work.next, 1, __ATOMIC_RELAXED)) <
+           work.units)
+    {
+        if (work.done[unit])
+        {
+            continue;
+        }
+        work.completions[unit] = unit < band_units ? count_unit(unit) :
+            count_fixed(arg, &work.symmetries[unit - band_units + 1]);
+        __atomic_store_n(&work.done[unit], 1, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&work.finished, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * Marks the units done in the checkpoint filename, if it has as many units,
+ * as done with the completions it holds. Returns the number of units done.
+ */
+static int load_checkpoint(const char *filename, int units)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return 0;
+
+    uint8_t header[HEADER_SIZE];
+    uint8_t unit[UNIT_SIZE];
+    int done = 0;
+    if (fread(header, HEADER_SIZE, 1, fp) == 1 &&
+        memcmp(header, "SENU", 4) == 0 &&
+        header[4] == CHECKPOINT_VERSION &&
+        (header[8] | header[9] << 8 | header[10] << 16) == units)
+    {
+        for (int i = 0; i < units && fread(unit, UNIT_SIZE, 1, fp) == 1; i++)
+        {
+            if (unit[0])
+            {
+                uint64_t n = 0;
+                for (int b = 0; b < 8; b++)
+                {
+                    n |= (uint64_t) unit[1 + b] << 8 * b;
+                }
+                work.completions[i] = n;
+                work.done[i] = 1;
+                done++;
+            }
+        }
+    }
+    fclose(fp);
+    return done;
+}
+
+/*
+ * Writes the units done so far to the checkpoint filename, under a temporary
+ * name then renamed. Returns true iff successful.
+ */
+static bool save_checkpoint(const char *filename, int units)
+{
+    char tmp[strlen(filename) + 5];
+    sprintf(tmp, "%s.tmp", filename);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL)
+        return false;
+
+    uint8_t header[HEADER_SIZE] = { 'S', 'E', 'N', 'U', CHECKPOINT_VERSION, 0,
+                                    0, 0, units, units >> 8, units >> 16, 0 };
+    bool written = fwrite(header, HEADER_SIZE, 1, fp) == 1;
+    for (int i = 0; i < units && written; i++)
+    {
+        uint8_t unit[UNIT_SIZE] = {
+            __atomic_load_n(&work.done[i], __ATOMIC_ACQUIRE)
+        };
+        for (int b = 0; unit[0] && b < 8; b++)
+        {
+            unit[1 + b] = work.completions[i] >> 8 * b;
+        }
+        written = fwrite(unit, UNIT_SIZE, 1, fp) == 1;
+    }
+    if (fclose(fp) != 0 || !written || rename(tmp, filename) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Writes n in decimal to s, which must have room for 40 characters.
+ */
+static void format128(unsigned __int128 n, char *s)
+{
+    char digits[40];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + n % 10;
+        n /= 10;
+    }
+    while (n > 0);
+    for (int i = 0; i < count; i++)
+    {
+        s[i] = digits[count - 1 - i];
+    }
+    s[count] = '\0';
+}
@@ -0,0 +1,14 @@
+/**
+ * enumerate.h
+ *
+ * Counting of every completed grid by splitting them into bands, as a stress
+ * test and benchmark.
+ */
+
+#ifndef ENUMERATE_H
+#define ENUMERATE_H
+
+// Entry point for "sudoku enumerate ...".
+int enumerate_main(int argc, char *argv[]);
+
+#endif
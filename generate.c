@@ -0,0 +1,352 @@
+/**
+ * generate.c
+ *
+ * Implements puzzle generation. A puzzle is made by filling a random grid and
+ * removing clues in a random order, keeping each removal only if the solution
+ * stays unique. Everything is derived from the seed so that a given seed gives
+ * the same puzzle for everyone.
+ *
+ * A background thread keeps a small queue of the puzzles for the next seeds,
+ * so that a new game is normally ready at once. A puzzle that isn't is waited
+ * for if the thread is making it and finishes within GEN_WAIT_MS, and is
+ * otherwise made on the spot; either way it's the same puzzle, as nothing
+ * about making it depends on time.
+ */
+
+#include "generate.h"
+#include "solver.h"
+#include "sudoku.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// A generated puzzle with its solution.
+struct generated
+{
+    uint32_t seed;
+    uint8_t puzzle[81];
+    uint8_t solution[81];
+};
+
+// Wrapper for the generator's globals.
+static struct
+{
+    // Guards everything below, signalled when the queue changes.
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    // The background thread and whether it is running or should stop.
+    pthread_t thread;
+    bool running, stopping;
+
+    // Target number of clues, and the transposition table to use, if any.
+    int clues;
+    struct table *table;
+
+    // Circular queue of puzzles for consecutive seeds.
+    struct generated queue[GEN_QUEUE_SIZE];
+    int head, count;
+
+    // Next seed the thread will generate, and the seed it is working on.
+    uint32_t next_seed;
+    bool busy;
+    uint32_t busy_seed;
+
+    // The puzzle most recently taken, so a restart doesn't regenerate it.
+    bool have_current;
+    struct generated current;
+}
+gen = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// Transposition table shared by the background thread and generator_take.
+// l33t searches outgrow it and run slower with it than without, so only
+// n00b puzzles use it.
+static struct table_entry entries[1 << GEN_TABLE_BITS];
+static struct table shared = { entries, (1 << GEN_TABLE_BITS) - 1 };
+
+// Function prototypes.
+static double now_ms(void);
+static void *worker(void *arg);
+
+/*
+ * Generates the puzzle for seed, removing clues in the seed's order down to
+ * at most clues givens, looking up and recording counts in table unless it's
+ * NULL.
+ */
+void generate_puzzle(uint32_t seed, int clues, struct table *table,
+                     uint8_t puzzle[81], uint8_t solution[81])
+{
+    uint32_t rng = seed_random(seed);
+
+    // Start from a random complete grid, every cell given.
+    random_grid(&rng, solution);
+    for (int i = 0; i < 81; i++)
+    {
+        puzzle[i] = solution[i] | CELL_GIVEN;
+    }
+
+    // Choose a random order in which to try removing cells.
+    int order[81];
+    for (int i = 0; i < 81; i++)
+    {
+        int j = next_random(&rng) % (i + 1);
+        order[i] = order[j];
+        order[j] = i;
+    }
+
+    // Remove clues while the solution stays unique.
+    int remaining = 81;
+    for (int i = 0; i < 81 && remaining > clues; i++)
+    {
+        int n = puzzle[order[i]];
+        puzzle[order[i]] = 0;
+        struct solve_stats stats;
+        if ((table ? count_solutions_table(puzzle, 2, table, &stats) :
+                     count_solutions(puzzle, 2, NULL)) != 1)
+        {
+            puzzle[order[i]] = n;
+        }
+        else
+        {
+            remaining--;
+        }
+    }
+}
+
+/*
+ * Makes one attempt at a puzzle whose givens are the cells of mask, drawing
+ * random numbers from *rng. The givens start as a random grid's, then while
+ * the puzzle has more than one solution a random given is changed to another
+ * digit that could go there, keeping the change unless it leaves no solution
+ * or more than before. Counts stop at PATTERN_LIMIT, and fill in hidden
+ * singles as they go, which rules out a puzzle with no solution at once.
+ * Returns true iff the puzzle has a unique solution within PATTERN_STEPS
+ * changes; if not, the caller starts again.
+ */
+bool generate_pattern(uint32_t *rng, const bool mask[81], uint8_t puzzle[81],
+                      uint8_t solution[81])
+{
+    static const struct solver_config config = { BRANCH_FEWEST, 2,
+                                                 ENGINE_SEARCH };
+    struct solve_stats stats;
+
+    int givens[81], count = 0;
+    random_grid(rng, solution);
+    for (int i = 0; i < 81; i++)
+    {
+        puzzle[i] = mask[i] ? solution[i] | CELL_GIVEN : 0;
+        if (mask[i])
+        {
+            givens[count++] = i;
+        }
+    }
+    if (count == 0)
+    {
+        return false;
+    }
+
+    int solutions = count_solutions_config(puzzle, PATTERN_LIMIT, NULL,
+                                           &config, NULL, &stats);
+    for (int step = 0; step < PATTERN_STEPS && solutions > 1; step++)
+    {
+        int cell = givens[next_random(rng) % count];
+        int n = puzzle[cell];
+        int candidates = board_candidates(puzzle, cell) & ~(1 << DIGIT(n));
+        if (!candidates)
+        {
+            continue;
+        }
+
+        // Take one of the candidates at random.
+        int digits[9], options = 0;
+        for (int digit = 1; digit <= 9; digit++)
+        {
+            if (candidates >> digit & 1)
+            {
+                digits[options++] = digit;
+            }
+        }
+        puzzle[cell] = digits[next_random(rng) % options] | CELL_GIVEN;
+        int changed = count_solutions_config(puzzle, PATTERN_LIMIT, NULL,
+                                             &config, NULL, &stats);
+        if (changed == 0 || changed > solutions)
+        {
+            puzzle[cell] = n;
+        }
+        else
+        {
+            solutions = changed;
+        }
+    }
+    return solutions == 1 &&
+           count_solutions_config(puzzle, 2, solution, &config, NULL,
+                                  &stats) == 1;
+}
+
+/*
+ * Starts the background thread generating puzzles with at most clues givens
+ * for the seeds following first_seed. Returns true iff successful.
+ */
+bool generator_start(int clues, uint32_t first_seed)
+{
+    pthread_mutex_lock(&gen.lock);
+    gen.clues = clues;
+    gen.table = clues == GEN_CLUES_L33T ? NULL : &shared;
+    gen.next_seed = first_seed + 1;
+    gen.stopping = false;
+    gen.running = pthread_create(&gen.thread, NULL, worker, NULL) == 0;
+    pthread_mutex_unlock(&gen.lock);
+    return gen.running;
+}
+
+/*
+ * Copies the puzzle for seed and its solution. Uses the queue if the puzzle is
+ * ready, waits up to GEN_WAIT_MS if it is being generated, and otherwise
+ * generates it here.
+ */
+void generator_take(uint32_t seed, uint8_t puzzle[81], uint8_t solution[81])
+{
+    double deadline = now_ms() + GEN_WAIT_MS;
+    bool found = false;
+
+    pthread_mutex_lock(&gen.lock);
+
+    // Restarting the same puzzle needs no work.
+    if (gen.have_current && gen.current.seed == seed)
+    {
+        found = true;
+    }
+
+    // Wait for the thread if it's making this very puzzle, but not too long.
+    while (!found && gen.busy && gen.busy_seed == seed && now_ms() < deadline)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&gen.changed, &gen.lock, &ts);
+    }
+
+    // Drop puzzles for earlier seeds and take this one if it's queued.
+    while (!found && gen.count > 0 &&
+           gen.queue[gen.head].seed <= seed)
+    {
+        if (gen.queue[gen.head].seed == seed)
+        {
+            gen.current = gen.queue[gen.head];
+            found = true;
+        }
+        gen.head = (gen.head + 1) % GEN_QUEUE_SIZE;
+        gen.count--;
+    }
+
+    // The thread should carry on from after this seed. It already does if
+    // the next puzzle it has queued or is making is for the seed after, so
+    // that's kept, but not after a jump ahead or back.
+    uint32_t upcoming = gen.count > 0 ? gen.queue[gen.head].seed :
+                        gen.busy ? gen.busy_seed : gen.next_seed;
+    if (gen.next_seed <= seed || upcoming > seed + 1)
+    {
+        gen.next_seed = seed + 1;
+        gen.head = gen.count = 0;
+    }
+    int clues = gen.clues;
+    struct table *table = gen.table;
+    pthread_cond_broadcast(&gen.changed);
+    pthread_mutex_unlock(&gen.lock);
+
+    // Generate it ourselves, in full so it's the seed's puzzle however long
+    // that takes.
+    if (!found)
+    {
+        struct generated made;
+        made.seed = seed;
+        generate_puzzle(seed, clues, table, made.puzzle, made.solution);
+
+        pthread_mutex_lock(&gen.lock);
+        gen.current = made;
+        pthread_mutex_unlock(&gen.lock);
+    }
+
+    pthread_mutex_lock(&gen.lock);
+    gen.have_current = true;
+    memcpy(puzzle, gen.current.puzzle, sizeof(gen.current.puzzle));
+    memcpy(solution, gen.current.solution, sizeof(gen.current.solution));
+    pthread_mutex_unlock(&gen.lock);
+}
+
+/*
+ * Stops the background thread and waits for it to finish.
+ */
+void generator_stop(void)
+{
+    pthread_mutex_lock(&gen.lock);
+    bool running = gen.running;
+    gen.stopping = true;
+    gen.running = false;
+    pthread_cond_broadcast(&gen.changed);
+    pthread_mutex_unlock(&gen.lock);
+
+    if (running)
+    {
+        pthread_join(gen.thread, NULL);
+    }
+}
+
+/*
+ * Returns the current monotonic time in milliseconds.
+ */
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Background thread keeping the queue full of upcoming puzzles.
+ */
+static void *worker(void *arg)
+{
+    pthread_mutex_lock(&gen.lock);
+    while (!gen.stopping)
+    {
+        // Sleep while the queue is full.
+        if (gen.count == GEN_QUEUE_SIZE)
+        {
+            pthread_cond_wait(&gen.changed, &gen.lock);
+            continue;
+        }
+
+        // Generate the next puzzle without holding the lock.
+        struct generated made;
+        made.seed = gen.next_seed++;
+        int clues = gen.clues;
+        struct table *table = gen.table;
+        gen.busy = true;
+        gen.busy_seed = made.seed;
+        pthread_mutex_unlock(&gen.lock);
+
+        generate_puzzle(made.seed, clues, table, made.puzzle, made.solution);
+
+        pthread_mutex_lock(&gen.lock);
+        gen.busy = false;
+
+        // Only queue it if it still follows on from the queue's contents.
+        uint32_t expected = gen.count == 0 ? gen.next_seed - 1 :
+            gen.queue[(gen.head + gen.count - 1) % GEN_QUEUE_SIZE].seed + 1;
+        if (made.seed == expected && gen.next_seed == made.seed + 1)
+        {
+            gen.queue[(gen.head + gen.count) % GEN_QUEUE_SIZE] = made;
+            gen.count++;
+        }
+        pthread_cond_broadcast(&gen.changed);
+    }
+    pthread_mutex_unlock(&gen.lock);
+    return NULL;
+}
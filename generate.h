@@ -0,0 +1,37 @@
+/**
+ * generate.h
+ *
+ * Generates new puzzles with a unique solution, either on demand or ahead of
+ * time on a background thread, the same puzzle for a seed either way.
+ */
+
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include "board.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Generates the puzzle for seed, removing clues down to at most clues while
+// the solution stays unique, checking uniqueness with the help of table
+// (which may be NULL). The result depends on nothing but seed and clues.
+void generate_puzzle(uint32_t seed, int clues, struct table *table,
+                     uint8_t puzzle[81], uint8_t solution[81]);
+
+// Makes one attempt, from *rng, at a puzzle whose givens are exactly the
+// cells of mask. Returns true iff the puzzle made has a unique solution.
+bool generate_pattern(uint32_t *rng, const bool mask[81], uint8_t puzzle[81],
+                      uint8_t solution[81]);
+
+// Starts a background thread keeping puzzles for seeds after first_seed ready.
+bool generator_start(int clues, uint32_t first_seed);
+
+// Gets the puzzle for seed, from the queue if ready, else by making it.
+void generator_take(uint32_t seed, uint8_t puzzle[81], uint8_t solution[81]);
+
+// Stops the background thread.
+void generator_stop(void);
+
+#endif
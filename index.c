@@ -0,0 +1,277 @@
+/**
+ * index.c
+ *
+ * Implements pack indexes. An index starts with a header, then the offset of
+ * each board's record (and of the end of the last), then the records. Each
+ * record holds a hash of the board it was made for, so a stale index is never
+ * trusted, then the board's plan. The header also holds the solver settings
+ * found best for the pack by autotune. Numbers are little-endian.
+ *
+ *   header:  "SIDX", version (4 bytes), number of boards (4 bytes), solver
+ *            branching, propagation and engine (1 byte each), padding (1 byte)
+ *   offsets: one per board plus one (4 bytes each)
+ *   record:  board hash (4 bytes), steps (1 byte), steps (2 bytes each)
+ *
+ * Reading a plan takes three small reads at known offsets.
+ */
+
+#include "index.h"
+#include "alloc.h"
+#include "logic.h"
+#include "metrics.h"
+#include "pack.h"
+#include "solver.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Version of the format, and sizes (in bytes) of the header and a record.
+#define INDEX_VERSION 2
+#define HEADER_SIZE 16
+#define RECORD_SIZE(steps) (5 + 2 * (steps))
+
+// Function prototypes.
+static bool read_header(int fd, uint8_t header[HEADER_SIZE]);
+static uint32_t hash_board(const uint8_t board[81]);
+static void put32(uint8_t *p, uint32_t n);
+static uint32_t get32(const uint8_t *p);
+
+/*
+ * Reads the plan for board number (counting from 1) of filename into plan,
+ * provided it was made for board. Returns the number of steps, or -1 if the
+ * index can't be read or doesn't match.
+ */
+int index_read(const char *filename, int number, const uint8_t board[81],
+               uint16_t plan[81])
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    // Check the header, then find the record from its offset.
+    uint8_t header[HEADER_SIZE], offset[4];
+    uint8_t record[RECORD_SIZE(81)];
+    ssize_t length = -1;
+    if (read_header(fd, header) &&
+        number >= 1 && number <= get32(header + 8) &&
+        pread(fd, offset, sizeof(offset), HEADER_SIZE + 4 * (number - 1)) ==
+            sizeof(offset))
+    {
+        length = pread(fd, record, sizeof(record), get32(offset));
+    }
+    close(fd);
+
+    int steps = -1;
+    if (length >= RECORD_SIZE(0) && record[4] <= 81 &&
+        length >= RECORD_SIZE(record[4]) && get32(record) == hash_board(board))
+    {
+        steps = record[4];
+        for (int i = 0; i < steps; i++)
+        {
+            plan[i] = record[5 + 2 * i] | record[6 + 2 * i] << 8;
+        }
+    }
+    return steps;
+}
+
+/*
+ * Reads the solver settings stored in the index filename into config, leaving
+ * it unchanged if there are none. Returns true iff they were read.
+ */
+bool index_config(const char *filename, struct solver_config *config)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    uint8_t header[HEADER_SIZE];
+    bool read = read_header(fd, header);
+    close(fd);
+    if (!read)
+    {
+        return false;
+    }
+
+    struct solver_config stored = { header[12], header[13], header[14] };
+    if (!solver_config_valid(&stored))
+    {
+        return false;
+    }
+    *config = stored;
+    return true;
+}
+
+/*
+ * Stores config as the solver settings in the index filename, in place.
+ * Returns true iff successful.
+ */
+bool index_tune(const char *filename, const struct solver_config *config)
+{
+    int fd = open(filename, O_RDWR);
+    if (fd < 0)
+    {
+        return false;
+    }
+    uint8_t header[HEADER_SIZE];
+    uint8_t settings[3] = { config->branching, config->propagation,
+                            config->engine };
+    bool written = read_header(fd, header) &&
+                   pwrite(fd, settings, sizeof(settings), 12) ==
+                       sizeof(settings);
+    if (close(fd) != 0)
+    {
+        written = false;
+    }
+    return written;
+}
+
+/*
+ * Builds the index for a level's pack. Returns 0 iff successful.
+ */
+int index_main(int argc, char *argv[])
+{
+    // Check usage.
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: sudoku index n00b|l33t\n");
+        return 1;
+    }
+
+    char filename[strlen(argv[1]) + 5];
+    sprintf(filename, "%s.bin", argv[1]);
+    uint8_t (*boards)[81];
+    int count = pack_load(filename, &boards);
+    if (count < 0)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", filename);
+        return 2;
+    }
+
+    // Lay out the offsets, then the records, in memory.
+    size_t size = HEADER_SIZE + 4 * (count + 1) + count * RECORD_SIZE(81);
+    uint8_t *index = xcalloc(size, 1);
+    if (index == NULL)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 3;
+    }
+    // Keep any solver settings already tuned for the pack.
+    char path[strlen(argv[1]) + 5], tmp[strlen(argv[1]) + 9];
+    sprintf(path, "%s.idx", argv[1]);
+    sprintf(tmp, "%s.idx.tmp", argv[1]);
+    struct solver_config config = solver_defaults;
+    index_config(path, &config);
+
+    memcpy(index, "SIDX", 4);
+    put32(index + 4, INDEX_VERSION);
+    put32(index + 8, count);
+    index[12] = config.branching;
+    index[13] = config.propagation;
+    index[14] = config.engine;
+
+    double start = metrics_now();
+    int used[GUESS + 1] = {0};
+    size_t end = HEADER_SIZE + 4 * (count + 1);
+    for (int i = 0; i < count; i++)
+    {
+        put32(index + HEADER_SIZE + 4 * i, end);
+
+        // Boards without a unique solution get an empty plan.
+        uint8_t solution[81];
+        uint16_t plan[81];
+        int steps = 0;
+        if (count_solutions(boards[i], 2, solution) == 1)
+        {
+            steps = logic_plan(boards[i], solution, plan);
+        }
+
+        uint8_t *record = index + end;
+        put32(record, hash_board(boards[i]));
+        record[4] = steps;
+        for (int j = 0; j < steps; j++)
+        {
+            record[5 + 2 * j] = plan[j];
+            record[6 + 2 * j] = plan[j] >> 8;
+            used[STEP_TECHNIQUE(plan[j])]++;
+        }
+        end += RECORD_SIZE(steps);
+    }
+    put32(index + HEADER_SIZE + 4 * count, end);
+    double elapsed = metrics_now() - start;
+
+    // Write it under a temporary name then rename, so the game never reads a
+    // half-written index.
+    FILE *fp = fopen(tmp, "wb");
+    bool written = fp && fwrite(index, end, 1, fp) == 1;
+    if (fp && fclose(fp) != 0)
+    {
+        written = false;
+    }
+    if (!written || rename(tmp, path) != 0)
+    {
+        remove(tmp);
+        fprintf(stderr, "Could not write %s!\n", path);
+        xfree(index);
+        xfree(boards);
+        return 4;
+    }
+
+    printf("Indexed %d boards in %.3f s, %zu bytes.\n", count, elapsed, end);
+    for (int t = 0; t <= GUESS; t++)
+    {
+        printf("%6d steps %s\n", used[t], technique_names[t]);
+    }
+
+    xfree(index);
+    xfree(boards);
+    return 0;
+}
+
+/*
+ * Reads the header of the index open as fd into header. Returns true iff it's
+ * an index of this version.
+ */
+static bool read_header(int fd, uint8_t header[HEADER_SIZE])
+{
+    return pread(fd, header, HEADER_SIZE, 0) == HEADER_SIZE &&
+           memcmp(header, "SIDX", 4) == 0 &&
+           get32(header + 4) == INDEX_VERSION;
+}
+
+/*
+ * Returns the FNV-1a hash of the digits of board.
+ */
+static uint32_t hash_board(const uint8_t board[81])
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 81; i++)
+    {
+        h = (h ^ DIGIT(board[i])) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Stores n at p, little-endian.
+ */
+static void put32(uint8_t *p, uint32_t n)
+{
+    p[0] = n;
+    p[1] = n >> 8;
+    p[2] = n >> 16;
+    p[3] = n >> 24;
+}
+
+/*
+ * Returns the little-endian number at p.
+ */
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
@@ -0,0 +1,34 @@
+/**
+ * index.h
+ *
+ * Pack indexes, i.e. the *.idx files, holding a logical solve plan for every
+ * board of a pack so that hints need no solving in game, and the solver
+ * settings that suit the pack best.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "board.h"
+#include "solver.h"
+
+#include <stdbool.h>
+
+// Reads the plan for board number (from 1) of the index filename, checking it
+// was made for board. Returns the number of steps, or -1 if there's no such
+// plan.
+int index_read(const char *filename, int number, const uint8_t board[81],
+               uint16_t plan[81]);
+
+// Reads the solver settings stored in the index filename into config, if there
+// are any. Returns true iff there were.
+bool index_config(const char *filename, struct solver_config *config);
+
+// Stores config as the solver settings in the index filename. Returns true iff
+// successful.
+bool index_tune(const char *filename, const struct solver_config *config);
+
+// Entry point for "sudoku index ...".
+int index_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,719 @@
+/**
+ * ingest.c
+ *
+ * Implements ingestion of a directory of packs: every pack is read, its
+ * boards validated, and the valid ones optionally written out as one pack in
+ * file-name order.
+ *
+ * Reads go through io_uring where the kernel has it: up to QUEUE_DEPTH reads
+ * are kept in flight, each into its own slot of one block of buffers
+ * registered with the kernel, and each slot is decoded straight into its
+ * place in the array of boards as its read completes. Elsewhere, if the ring
+ * can't be set up or the kernel lacks the operations used, or if the ring
+ * fails part way, a pool of threads reads with pread instead.
+ */
+
+#include "ingest.h"
+#include "alloc.h"
+#include "metrics.h"
+#include "pack.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Reads in flight at once, and boards read by each.
+#define QUEUE_DEPTH 64
+#define SLOT_BOARDS 200
+#define SLOT_SIZE (SLOT_BOARDS * BOARDSIZE)
+
+// Most threads reading when io_uring isn't available.
+#define MAX_THREADS 64
+
+// A pack to read: its name and size, where its boards go, and while it's
+// being read its descriptor and the reads of it still in flight.
+struct file
+{
+    char *name;
+    off_t size;
+    int first;
+    int fd, pending;
+    bool failed;
+};
+
+// Wrapper for ingestion's globals.
+static struct
+{
+    const char *dir;
+    struct file *files;
+    int file_count;
+
+    // Every board, in file-name order, whether each has cells out of range,
+    // and the number.
+    uint8_t (*boards)[81];
+    bool *invalid;
+    int count;
+
+    // Counts of files that couldn't be read and cells out of range, updated
+    // by every reader.
+    int failed, invalid_cells;
+
+    // Next file for the thread pool.
+    int next;
+}
+in;
+
+// Function prototypes.
+static bool list_files(void);
+static int compare_files(const void *a, const void *b);
+static int open_file(struct file *f);
+static int decode(const uint8_t *raw, int count, int first);
+static void reset_reads(void);
+static bool consistent(const uint8_t board[81]);
+static void *reader(void *arg);
+static void read_with_threads(int threads);
+#ifdef HAVE_IO_URING
+static bool read_with_ring(void);
+#endif
+
+/*
+ * Ingests a directory of packs, printing a summary. Returns 0 iff successful.
+ */
+int ingest_main(int argc, char *argv[])
+{
+    // Check usage, allowing --threads to force the thread pool.
+    const char *usage = "Usage: sudoku ingest directory [output.bin] "
+                        "[--threads]\n";
+    bool threads_only = false;
+    if (argc > 2 && strcmp(argv[argc - 1], "--threads") == 0)
+    {
+        threads_only = true;
+        argc--;
+    }
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, usage);
+        return 1;
+    }
+    in.dir = argv[1];
+
+    double start = metrics_now();
+    if (!list_files())
+    {
+        fprintf(stderr, "Could not list %s!\n", in.dir);
+        return 2;
+    }
+
+    in.boards = xmalloc((in.count ? in.count : 1) * sizeof(*in.boards));
+    in.invalid = xcalloc(in.count ? in.count : 1, sizeof(*in.invalid));
+    if (!in.boards || !in.invalid)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 3;
+    }
+
+    // Read everything, by ring if possible.
+    const char *engine = "threads";
+#ifdef HAVE_IO_URING
+    if (!threads_only && read_with_ring())
+    {
+        engine = "io_uring";
+    }
+    else
+#endif
+    {
+        reset_reads();
+        read_with_threads(sysconf(_SC_NPROCESSORS_ONLN));
+    }
+    double elapsed = metrics_now() - start;
+
+    // Keep the boards of files read that are consistent.
+    int kept = 0;
+    off_t bytes = 0;
+    for (int i = 0; i < in.file_count; i++)
+    {
+        struct file *f = &in.files[i];
+        int boards = f->size / BOARDSIZE;
+        if (f->failed)
+        {
+            continue;
+        }
+        bytes += f->size;
+        for (int b = f->first; b < f->first + boards; b++)
+        {
+            if (!in.invalid[b] && consistent(in.boards[b]))
+            {
+                memmove(in.boards[kept++], in.boards[b], 81);
+            }
+        }
+    }
+
+    printf("Read %d files (%.1f MB) in %.3f s (%.0f MB/s) using %s.\n",
+           in.file_count - in.failed, bytes / 1e6, elapsed,
+           bytes / 1e6 / elapsed, engine);
+    printf("%d boards valid, %d not (%d cells out of range); %d files not "
+           "packs or unreadable.\n", kept, in.count - kept, in.invalid_cells,
+           in.failed);
+
+    int status = 0;
+    if (argc == 3 &&
+        !pack_write(argv[2], (const uint8_t (*)[81]) in.boards, kept))
+    {
+        fprintf(stderr, "Could not write %s!\n", argv[2]);
+        status = 4;
+    }
+
+    for (int i = 0; i < in.file_count; i++)
+    {
+        xfree(in.files[i].name);
+    }
+    xfree(in.files);
+    xfree(in.boards);
+    xfree(in.invalid);
+    return status;
+}
+
+/*
+ * Lists the regular files of the directory in name order, noting their sizes
+ * and where their boards go. Files that aren't a whole number of boards are
+ * noted as failed. Returns true iff successful.
+ */
+static bool list_files(void)
+{
+    DIR *dir = opendir(in.dir);
+    if (dir == NULL)
+    {
+        return false;
+    }
+
+    // Count the entries, then note them.
+    int capacity = 0;
+    while (readdir(dir))
+    {
+        capacity++;
+    }
+    rewinddir(dir);
+    in.files = xcalloc(capacity ? capacity : 1, sizeof(struct file));
+    if (!in.files)
+    {
+        closedir(dir);
+        return false;
+    }
+
+    struct dirent *e;
+    while ((e = readdir(dir)) && in.file_count < capacity)
+    {
+        struct stat st;
+        if (fstatat(dirfd(dir), e->d_name, &st, 0) != 0 ||
+            !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        struct file *f = &in.files[in.file_count];
+        f->name = xmalloc(strlen(e->d_name) + 1);
+        if (!f->name)
+        {
+            break;
+        }
+        strcpy(f->name, e->d_name);
+        f->size = st.st_size;
+        f->fd = -1;
+        in.file_count++;
+    }
+    closedir(dir);
+
+    qsort(in.files, in.file_count, sizeof(struct file), compare_files);
+    for (int i = 0; i < in.file_count; i++)
+    {
+        struct file *f = &in.files[i];
+        if (f->size == 0 || f->size % BOARDSIZE != 0)
+        {
+            f->failed = true;
+            in.failed++;
+            continue;
+        }
+        f->first = in.count;
+        in.count += f->size / BOARDSIZE;
+    }
+    return true;
+}
+
+/*
+ * Orders files by name, for qsort.
+ */
+static int compare_files(const void *a, const void *b)
+{
+    return strcmp(((const struct file *) a)->name,
+                  ((const struct file *) b)->name);
+}
+
+/*
+ * Opens file f of the directory, returning its descriptor or -1.
+ */
+static int open_file(struct file *f)
+{
+    char path[strlen(in.dir) + strlen(f->name) + 2];
+    sprintf(path, "%s/%s", in.dir, f->name);
+    return open(path, O_RDONLY);
+}
+
+/*
+ * Decodes count boards from raw into place from board first on, noting those
+ * with cells out of range as invalid. Returns the number of such cells.
+ */
+static int decode(const uint8_t *raw, int count, int first)
+{
+    int invalid = 0;
+    for (int b = 0; b < count; b++)
+    {
+        int cells = pack_decode(raw + b * BOARDSIZE, 1, in.boards + first + b);
+        in.invalid[first + b] = cells > 0;
+        invalid += cells;
+    }
+    return invalid;
+}
+
+/*
+ * Undoes any reading done so far, closing files left open, so that it can
+ * all be done again.
+ */
+static void reset_reads(void)
+{
+    in.failed = in.invalid_cells = in.next = 0;
+    for (int i = 0; i < in.file_count; i++)
+    {
+        struct file *f = &in.files[i];
+        if (f->fd >= 0)
+        {
+            close(f->fd);
+        }
+        f->fd = -1;
+        f->pending = 0;
+        f->failed = f->size == 0 || f->size % BOARDSIZE != 0;
+        in.failed += f->failed;
+    }
+}
+
+/*
+ * Returns true iff board holds only digits 0-9 and repeats none in any unit.
+ */
+static bool consistent(const uint8_t board[81])
+{
+    uint16_t used[27] = {0};
+    for (int i = 0; i < 81; i++)
+    {
+        int n = DIGIT(board[i]);
+        if (n == 0)
+        {
+            continue;
+        }
+        if (n > 9)
+        {
+            return false;
+        }
+        uint16_t bit = 1 << (n - 1);
+        int units[3] = { ROW_UNIT(cell_row[i]), COL_UNIT(cell_col[i]),
+                         BOX_UNIT(cell_box[i]) };
+        for (int u = 0; u < 3; u++)
+        {
+            if (used[units[u]] & bit)
+            {
+                return false;
+            }
+            used[units[u]] |= bit;
+        }
+    }
+    return true;
+}
+
+/*
+ * Reads files with a pool of threads, each taking the next file in turn.
+ */
+static void read_with_threads(int threads)
+{
+    if (threads > MAX_THREADS)
+    {
+        threads = MAX_THREADS;
+    }
+    pthread_t pool[MAX_THREADS];
+    int started = 0;
+    while (started < threads &&
+           pthread_create(&pool[started], NULL, reader, NULL) == 0)
+    {
+        started++;
+    }
+
+    // Should no thread start, do the work here instead.
+    if (started == 0)
+    {
+        reader(NULL);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(pool[i], NULL);
+    }
+}
+
+/*
+ * A thread of the pool, reading files until there are none left.
+ */
+static void *reader(void *arg)
+{
+    static __thread uint8_t buffer[SLOT_SIZE];
+    int i;
+    while ((i = __atomic_fetch_add(&in.next, 1, __ATOMIC_RELAXED)) <
+           in.file_count)
+    {
+        struct file *f = &in.files[i];
+        if (f->failed)
+        {
+            continue;
+        }
+
+        int fd = open_file(f);
+        bool ok = fd >= 0;
+        for (off_t offset = 0; ok && offset < f->size; offset += SLOT_SIZE)
+        {
+            size_t length = f->size - offset < SLOT_SIZE ? f->size - offset :
+                                                           SLOT_SIZE;
+            ok = pread(fd, buffer, length, offset) == length;
+            if (ok)
+            {
+                int cells = decode(buffer, length / BOARDSIZE,
+                                   f->first + offset / BOARDSIZE);
+                __atomic_fetch_add(&in.invalid_cells, cells, __ATOMIC_RELAXED);
+            }
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        if (!ok)
+        {
+            f->failed = true;
+            __atomic_fetch_add(&in.failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+#ifdef HAVE_IO_URING
+
+// An io_uring: its descriptor and the rings shared with the kernel.
+struct ring
+{
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+};
+
+// What each slot is being read for.
+struct slot
+{
+    struct file *file;
+    off_t offset;
+    size_t length;
+};
+
+/*
+ * Sets up ring r with room for entries requests. Returns true iff successful.
+ */
+static bool ring_setup(struct ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+    {
+        return false;
+    }
+
+    // Map the rings, which newer kernels share one mapping between.
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && r->cq_size > r->sq_size)
+    {
+        r->sq_size = r->cq_size;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ptr = single ? r->sq_ptr :
+                mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED ||
+        r->sqes == MAP_FAILED)
+    {
+        close(r->fd);
+        return false;
+    }
+
+    uint8_t *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *) (sq + p.sq_off.array);
+    r->cq_head = (unsigned *) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return true;
+}
+
+/*
+ * Returns true iff ring r's kernel supports every operation used on it.
+ */
+static bool ring_supported(const struct ring *r)
+{
+    static const uint8_t needed[] = { IORING_OP_OPENAT, IORING_OP_READ,
+                                      IORING_OP_READ_FIXED };
+    union
+    {
+        struct io_uring_probe probe;
+        uint8_t space[sizeof(struct io_uring_probe) +
+                      256 * sizeof(struct io_uring_probe_op)];
+    }
+    u;
+    memset(&u, 0, sizeof(u));
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, &u.probe,
+                256) != 0)
+    {
+        return false;
+    }
+    for (int i = 0; i < sizeof(needed); i++)
+    {
+        if (needed[i] > u.probe.last_op ||
+            !(u.probe.ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Unmaps and closes ring r.
+ */
+static void ring_destroy(struct ring *r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr != r->sq_ptr)
+    {
+        munmap(r->cq_ptr, r->cq_size);
+    }
+    munmap(r->sq_ptr, r->sq_size);
+    close(r->fd);
+}
+
+/*
+ * Reads files through an io_uring, opening them through it too. Opens run
+ * ahead of reads by up to QUEUE_DEPTH files; reads are queued in file order
+ * as their files open. Returns false iff the ring couldn't be set up, doesn't
+ * support the operations used or failed part way; the reading must then all
+ * be done again.
+ */
+static bool read_with_ring(void)
+{
+    struct ring r;
+    int dirfd = open(in.dir, O_RDONLY | O_DIRECTORY);
+    if (dirfd < 0 || !ring_setup(&r, QUEUE_DEPTH))
+    {
+        if (dirfd >= 0)
+            close(dirfd);
+        return false;
+    }
+    if (!ring_supported(&r))
+    {
+        ring_destroy(&r);
+        close(dirfd);
+        return false;
+    }
+
+    // Register the slots' buffers, so the kernel needn't map them for every
+    // read; plain reads into them do if that's not allowed.
+    uint8_t *buffers = xmalloc(QUEUE_DEPTH * SLOT_SIZE);
+    if (!buffers)
+    {
+        ring_destroy(&r);
+        close(dirfd);
+        return false;
+    }
+    struct iovec iov[QUEUE_DEPTH];
+    for (int i = 0; i < QUEUE_DEPTH; i++)
+    {
+        iov[i].iov_base = buffers + i * SLOT_SIZE;
+        iov[i].iov_len = SLOT_SIZE;
+    }
+    bool fixed = syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_BUFFERS,
+                         iov, QUEUE_DEPTH) == 0;
+
+    struct slot slots[QUEUE_DEPTH];
+    int free_slots[QUEUE_DEPTH], free_count = QUEUE_DEPTH;
+    for (int i = 0; i < QUEUE_DEPTH; i++)
+    {
+        free_slots[i] = QUEUE_DEPTH - 1 - i;
+    }
+
+    // The next file to open, and the next read to queue: file and offset.
+    int next_open = 0, next_read = 0;
+    off_t next_offset = 0;
+    int in_flight = 0;
+
+    for (;;)
+    {
+        unsigned tail = *r.sq_tail, queued = 0;
+        while (free_count > 0)
+        {
+            // Skip files that failed, and move on from those fully queued.
+            struct file *f = next_read < in.file_count ?
+                             &in.files[next_read] : NULL;
+            if (f && (f->failed || next_offset >= f->size))
+            {
+                if (f->fd >= 0 && f->pending == 0)
+                {
+                    close(f->fd);
+                    f->fd = -1;
+                }
+                next_read++;
+                next_offset = 0;
+                continue;
+            }
+
+            struct io_uring_sqe *sqe = &r.sqes[tail & *r.sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            int s;
+
+            // Queue the next read if its file is open, else the next open.
+            if (f && f->fd >= 0)
+            {
+                s = free_slots[--free_count];
+                slots[s].file = f;
+                slots[s].offset = next_offset;
+                slots[s].length = f->size - next_offset < SLOT_SIZE ?
+                                  f->size - next_offset : SLOT_SIZE;
+                next_offset += slots[s].length;
+
+                sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+                sqe->fd = f->fd;
+                sqe->addr = (uintptr_t) iov[s].iov_base;
+                sqe->len = slots[s].length;
+                sqe->off = slots[s].offset;
+                sqe->buf_index = fixed ? s : 0;
+            }
+            else if (next_open < in.file_count &&
+                     next_open < next_read + QUEUE_DEPTH)
+            {
+                struct file *o = &in.files[next_open++];
+                if (o->failed)
+                {
+                    continue;
+                }
+                s = free_slots[--free_count];
+                slots[s].file = o;
+                slots[s].length = 0;
+
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = dirfd;
+                sqe->addr = (uintptr_t) o->name;
+                sqe->open_flags = O_RDONLY;
+            }
+            else
+            {
+                break;
+            }
+
+            slots[s].file->pending++;
+            sqe->user_data = s;
+            r.sq_array[tail & *r.sq_mask] = tail & *r.sq_mask;
+            tail++;
+            queued++;
+        }
+        __atomic_store_n(r.sq_tail, tail, __ATOMIC_RELEASE);
+        in_flight += queued;
+
+        if (in_flight == 0)
+        {
+            break;
+        }
+
+        // Submit them, waiting for at least one to complete. Should that
+        // fail, reads may still be under way into the buffers, which are
+        // then left to the kernel rather than freed.
+        if (syscall(__NR_io_uring_enter, r.fd, queued, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+        {
+            ring_destroy(&r);
+            close(dirfd);
+            return false;
+        }
+
+        // Note opened files, and decode every completed read into place.
+        unsigned head = *r.cq_head;
+        while (head != __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask];
+            struct slot *slot = &slots[cqe->user_data];
+            struct file *f = slot->file;
+            if (slot->length == 0 && cqe->res >= 0)
+            {
+                f->fd = cqe->res;
+            }
+            else if (slot->length > 0 && cqe->res == slot->length)
+            {
+                in.invalid_cells +=
+                    decode(iov[cqe->user_data].iov_base,
+                           slot->length / BOARDSIZE,
+                           f->first + slot->offset / BOARDSIZE);
+            }
+            else if (!f->failed)
+            {
+                f->failed = true;
+                in.failed++;
+            }
+
+            // Close the file once it's all read.
+            f->pending--;
+            if (f->fd >= 0 && f->pending == 0 &&
+                (f->failed || f < &in.files[next_read]))
+            {
+                close(f->fd);
+                f->fd = -1;
+            }
+
+            free_slots[free_count++] = cqe->user_data;
+            in_flight--;
+            head++;
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    ring_destroy(&r);
+    xfree(buffers);
+    close(dirfd);
+    return true;
+}
+
+#endif
@@ -0,0 +1,13 @@
+/**
+ * ingest.h
+ *
+ * Ingestion of a directory of packs: reading, validating and combining them.
+ */
+
+#ifndef INGEST_H
+#define INGEST_H
+
+// Entry point for "sudoku ingest ...".
+int ingest_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,229 @@
+/**
+ * loadtest.c
+ *
+ * Implements a load-testing client for the solver daemon. Each connection
+ * keeps a window of requests in flight, drawn in turn from a pack, topping it
+ * up after every read of responses, and checks that every response answers
+ * the request it should with a solution.
+ */
+
+#include "serve.h"
+#include "alloc.h"
+#include "metrics.h"
+#include "pack.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Requests each connection keeps in flight.
+#define WINDOW 256
+
+// Most threads, i.e. connections.
+#define MAX_CONNECTIONS 256
+
+// Latency buckets, one per power of two nanoseconds.
+#define BUCKETS 64
+
+// Work shared by the connections' threads.
+static struct
+{
+    const char *path;
+    uint8_t (*boards)[81];
+    int count;
+    long requests;
+}
+work;
+
+// Results for each connection.
+static struct
+{
+    long answered, errors;
+    uint64_t latency[BUCKETS];
+}
+results[MAX_CONNECTIONS];
+
+// Function prototypes.
+static void *client(void *arg);
+static double percentile(const uint64_t *latency, double p);
+
+/*
+ * Runs the load test, printing a summary. Returns 0 iff every request was
+ * answered correctly.
+ */
+int loadtest_main(int argc, char *argv[])
+{
+    // Check usage.
+    const char *usage = "Usage: sudoku loadtest socket n00b|l33t "
+                        "[connections] [requests]\n";
+    int connections = 4;
+    long requests = 1000000;
+    char c;
+    if (argc < 3 || argc > 5 ||
+        (argc > 3 && (sscanf(argv[3], " %d %c", &connections, &c) != 1 ||
+                      connections < 1 || connections > MAX_CONNECTIONS)) ||
+        (argc > 4 && (sscanf(argv[4], " %ld %c", &requests, &c) != 1 ||
+                      requests < 1)))
+    {
+        fprintf(stderr, usage);
+        return 1;
+    }
+
+    char filename[strlen(argv[2]) + 5];
+    sprintf(filename, "%s.bin", argv[2]);
+    work.count = pack_load(filename, &work.boards);
+    if (work.count < 0)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", filename);
+        return 2;
+    }
+    work.path = argv[1];
+    work.requests = requests / connections;
+
+    // Run the connections.
+    double start = metrics_now();
+    pthread_t threads[MAX_CONNECTIONS];
+    for (intptr_t i = 0; i < connections; i++)
+    {
+        if (pthread_create(&threads[i], NULL, client, (void *) i) != 0)
+        {
+            fprintf(stderr, "Could not start thread!\n");
+            return 3;
+        }
+    }
+    for (int i = 0; i < connections; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = metrics_now() - start;
+
+    // Merge the results.
+    long answered = 0, errors = 0;
+    uint64_t latency[BUCKETS] = {0};
+    for (int i = 0; i < connections; i++)
+    {
+        answered += results[i].answered;
+        errors += results[i].errors;
+        for (int b = 0; b < BUCKETS; b++)
+        {
+            latency[b] += results[i].latency[b];
+        }
+    }
+
+    printf("%ld requests answered in %.3f s over %d connections: %.0f "
+           "requests/s\n", answered, elapsed, connections, answered / elapsed);
+    printf("latency p50 < %.0f us, p99 < %.0f us, %ld errors\n",
+           percentile(latency, 50) * 1e6, percentile(latency, 99) * 1e6,
+           errors);
+
+    xfree(work.boards);
+    return errors || answered < work.requests * connections ? 4 : 0;
+}
+
+/*
+ * A connection's thread. The argument is the connection's index.
+ */
+static void *client(void *arg)
+{
+    int index = (intptr_t) arg;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, work.path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        perror("Could not connect");
+        results[index].errors = work.requests;
+        return NULL;
+    }
+
+    // Times at which the requests in flight were sent, by id modulo WINDOW.
+    double sent_at[WINDOW];
+    uint8_t out[WINDOW * REQUEST_SIZE];
+    uint8_t in[WINDOW * RESPONSE_SIZE];
+    int in_length = 0;
+    long sent = 0, answered = 0;
+
+    while (answered < work.requests)
+    {
+        // Top the window up with requests for consecutive boards.
+        int batch = 0;
+        double now = metrics_now();
+        while (sent < work.requests && sent - answered < WINDOW)
+        {
+            uint32_t id = sent++;
+            uint8_t *request = out + batch++ * REQUEST_SIZE;
+            for (int b = 0; b < 4; b++)
+            {
+                request[b] = id >> 8 * b;
+            }
+            board_pack(work.boards[(index + id) % work.count], request + 4);
+            sent_at[id % WINDOW] = now;
+        }
+        if (batch && write(fd, out, batch * REQUEST_SIZE) !=
+                     batch * REQUEST_SIZE)
+        {
+            break;
+        }
+
+        // Read whatever responses have arrived.
+        ssize_t n = read(fd, in + in_length, sizeof(in) - in_length);
+        if (n <= 0)
+        {
+            break;
+        }
+        in_length += n;
+
+        now = metrics_now();
+        int count = in_length / RESPONSE_SIZE;
+        for (int i = 0; i < count; i++)
+        {
+            const uint8_t *response = in + i * RESPONSE_SIZE;
+            uint32_t id = response[0] | response[1] << 8 | response[2] << 16 |
+                          (uint32_t) response[3] << 24;
+
+            // Responses must come in order, each with a solution.
+            if (id != (uint32_t) answered || response[4] == SOLVE_NONE)
+            {
+                results[index].errors++;
+            }
+
+            uint64_t ns = (now - sent_at[id % WINDOW]) * 1e9;
+            results[index].latency[ns ? 63 - __builtin_clzll(ns) : 0]++;
+            answered++;
+        }
+        in_length -= count * RESPONSE_SIZE;
+        memmove(in, in + count * RESPONSE_SIZE, in_length);
+    }
+
+    results[index].answered = answered;
+    results[index].errors += work.requests - answered;
+    close(fd);
+    return NULL;
+}
+
+/*
+ * Returns the upper bound (in seconds) of the bucket holding the p'th
+ * percentile of latency.
+ */
+static double percentile(const uint64_t *latency, double p)
+{
+    uint64_t total = 0, seen = 0;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        total += latency[b];
+    }
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        seen += latency[b];
+        if (seen > total * p / 100)
+        {
+            return (2.0 * (1ull << b)) / 1e9;
+        }
+    }
+    return 0;
+}
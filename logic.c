@@ -0,0 +1,145 @@
+/**
+ * logic.c
+ *
+ * Implements logical solving. Each step looks for a hidden single, box first
+ * as they're easiest to spot, then a naked single, and only guesses (from the
+ * solution) when neither is left. Candidates are worked out from the digits
+ * placed alone, so a step stays valid however many more correct digits are
+ * placed before it; a plan can be followed in any order a player fills cells.
+ */
+
+#include "logic.h"
+
+#include <stdbool.h>
+
+// Mask of all nine digits, bit (d - 1) standing for digit d.
+#define ALL_DIGITS 0x1ff
+
+const char *technique_names[] = {
+    "hidden single in its box",
+    "hidden single in its row",
+    "hidden single in its column",
+    "naked single",
+    "from the solution",
+};
+
+// Function prototypes.
+static uint16_t next_step(const uint8_t cells[81], const uint8_t solution[81]);
+
+/*
+ * Fills plan with the steps taking board to solution, returning the number of
+ * steps.
+ */
+int logic_plan(const uint8_t board[81], const uint8_t solution[81],
+               uint16_t plan[81])
+{
+    uint8_t cells[81];
+    int steps = 0;
+    for (int i = 0; i < 81; i++)
+    {
+        cells[i] = DIGIT(board[i]);
+    }
+
+    for (;;)
+    {
+        uint16_t step = next_step(cells, solution);
+        if (step == 0)
+        {
+            return steps;
+        }
+        plan[steps++] = step;
+        cells[STEP_CELL(step)] = STEP_DIGIT(step);
+    }
+}
+
+/*
+ * Returns the next step for cells, or 0 if the board is full.
+ */
+static uint16_t next_step(const uint8_t cells[81], const uint8_t solution[81])
+{
+    // Note the digits used in each unit.
+    uint16_t used[27] = {0};
+    bool full = true;
+    for (int i = 0; i < 81; i++)
+    {
+        if (cells[i])
+        {
+            uint16_t bit = 1 << (cells[i] - 1);
+            used[ROW_UNIT(cell_row[i])] |= bit;
+            used[COL_UNIT(cell_col[i])] |= bit;
+            used[BOX_UNIT(cell_box[i])] |= bit;
+        }
+        else
+        {
+            full = false;
+        }
+    }
+    if (full)
+    {
+        return 0;
+    }
+
+    // Look for a digit with only one place in a box, row or column.
+    static const struct { int first; enum technique technique; } kinds[] = {
+        { BOX_UNIT(0), HIDDEN_BOX },
+        { ROW_UNIT(0), HIDDEN_ROW },
+        { COL_UNIT(0), HIDDEN_COL },
+    };
+    for (int k = 0; k < 3; k++)
+    {
+        for (int u = kinds[k].first; u < kinds[k].first + 9; u++)
+        {
+            for (int d = 1; d <= 9; d++)
+            {
+                if (used[u] & 1 << (d - 1))
+                {
+                    continue;
+                }
+
+                int places = 0, place = 0;
+                for (int j = 0; j < 9 && places < 2; j++)
+                {
+                    int i = unit_cells[u][j];
+                    uint16_t taken = used[ROW_UNIT(cell_row[i])] |
+                                     used[COL_UNIT(cell_col[i])] |
+                                     used[BOX_UNIT(cell_box[i])];
+                    if (!cells[i] && !(taken & 1 << (d - 1)))
+                    {
+                        places++;
+                        place = i;
+                    }
+                }
+                if (places == 1)
+                {
+                    return STEP(place, d, kinds[k].technique);
+                }
+            }
+        }
+    }
+
+    // Look for a cell with only one digit left, else guess at the cell with
+    // the fewest.
+    int best = -1, best_count = 10;
+    for (int i = 0; i < 81; i++)
+    {
+        if (cells[i])
+        {
+            continue;
+        }
+
+        uint16_t mask = ALL_DIGITS & ~(used[ROW_UNIT(cell_row[i])] |
+                                       used[COL_UNIT(cell_col[i])] |
+                                       used[BOX_UNIT(cell_box[i])]);
+        int count = __builtin_popcount(mask);
+        if (count == 1)
+        {
+            return STEP(i, __builtin_ctz(mask) + 1, NAKED_SINGLE);
+        }
+        if (count < best_count)
+        {
+            best = i;
+            best_count = count;
+        }
+    }
+    return STEP(best, solution[best], GUESS);
+}
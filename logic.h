@@ -0,0 +1,35 @@
+/**
+ * logic.h
+ *
+ * Logical solving, the way a person would: a plan of steps, each placing one
+ * digit by a named technique, taking a board to its solution.
+ */
+
+#ifndef LOGIC_H
+#define LOGIC_H
+
+#include "board.h"
+
+// Techniques by which a step can place a digit. A hidden single is the only
+// place for its digit in the step cell's row, column or box; a naked single
+// the only digit left for its cell; failing those, a digit is taken from the
+// solution.
+enum technique { HIDDEN_BOX, HIDDEN_ROW, HIDDEN_COL, NAKED_SINGLE, GUESS };
+
+// A step is packed in 16 bits: cell (7 bits), digit (4 bits) and technique
+// (3 bits).
+#define STEP(cell, digit, technique) \
+    ((uint16_t) ((cell) | (digit) << 7 | (technique) << 11))
+#define STEP_CELL(s) ((s) & 0x7f)
+#define STEP_DIGIT(s) ((s) >> 7 & 0x0f)
+#define STEP_TECHNIQUE(s) ((s) >> 11 & 0x07)
+
+// Fills plan with the steps solving board, whose solution is given, returning
+// their number (one per empty cell).
+int logic_plan(const uint8_t board[81], const uint8_t solution[81],
+               uint16_t plan[81]);
+
+// Name of each technique, for display.
+extern const char *technique_names[];
+
+#endif
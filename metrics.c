@@ -0,0 +1,142 @@
+/**
+ * metrics.c
+ *
+ * Implements the metrics surface. Updates are single relaxed atomic adds so
+ * that they cost next to nothing on the hot path; only metrics_write, called
+ * periodically, does any formatting or I/O.
+ */
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// Upper bounds (in seconds) of the histogram buckets, besides +Inf.
+static const double bounds[] = { 1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1 };
+#define NUM_BOUNDS (sizeof(bounds) / sizeof(bounds[0]))
+
+// Names and help text for the counters and histograms.
+static const char *counter_names[NUM_COUNTERS][2] = {
+    { "sudoku_games_started_total", "Games started or restarted." },
+    { "sudoku_games_won_total", "Games won." },
+    { "sudoku_hints_total", "Hints requested." },
+    { "sudoku_checks_total", "Checks requested." },
+    { "sudoku_allocations_total", "Heap allocations made." },
+    { "sudoku_allocated_bytes_total", "Bytes allocated on the heap." },
+    { "sudoku_batch_puzzles_total", "Puzzles solved in batch mode." },
+    { "sudoku_requests_total", "Requests answered by the solver service." },
+};
+static const char *histogram_names[NUM_HISTOGRAMS][2] = {
+    { "sudoku_solve_seconds", "Time taken to solve a puzzle." },
+    { "sudoku_render_seconds", "Time taken to draw the board." },
+};
+
+// The values themselves.
+static uint64_t counters[NUM_COUNTERS];
+static struct
+{
+    // Observations in each bucket (not cumulative), the last being +Inf.
+    uint64_t buckets[NUM_BOUNDS + 1];
+    uint64_t count;
+    uint64_t sum_ns;
+}
+histograms[NUM_HISTOGRAMS];
+
+/*
+ * Adds n to counter c.
+ */
+void metrics_add(enum counter c, uint64_t n)
+{
+    __atomic_fetch_add(&counters[c], n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Records an observation of seconds in histogram h.
+ */
+void metrics_observe(enum histogram h, double seconds)
+{
+    int i = 0;
+    while (i < NUM_BOUNDS && seconds > bounds[i])
+    {
+        i++;
+    }
+    __atomic_fetch_add(&histograms[h].buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histograms[h].count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histograms[h].sum_ns, (uint64_t) (seconds * 1e9),
+                       __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns the monotonic time in seconds.
+ */
+double metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Writes every metric to path in the Prometheus text exposition format. The
+ * file is written under a temporary name then renamed, so a scraper never sees
+ * it half written. Returns true iff successful.
+ */
+bool metrics_write(const char *path)
+{
+    char tmp[FILENAME_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp))
+    {
+        return false;
+    }
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    for (int c = 0; c < NUM_COUNTERS; c++)
+    {
+        const char *name = counter_names[c][0];
+        fprintf(fp, "# HELP %s %s\n", name, counter_names[c][1]);
+        fprintf(fp, "# TYPE %s counter\n", name);
+        fprintf(fp, "%s %llu\n", name, (unsigned long long)
+                __atomic_load_n(&counters[c], __ATOMIC_RELAXED));
+    }
+
+    for (int h = 0; h < NUM_HISTOGRAMS; h++)
+    {
+        const char *name = histogram_names[h][0];
+        fprintf(fp, "# HELP %s %s\n", name, histogram_names[h][1]);
+        fprintf(fp, "# TYPE %s histogram\n", name);
+
+        // Buckets are cumulative in the exposition format.
+        uint64_t total = 0;
+        for (int i = 0; i <= NUM_BOUNDS; i++)
+        {
+            total += __atomic_load_n(&histograms[h].buckets[i],
+                                     __ATOMIC_RELAXED);
+            if (i < NUM_BOUNDS)
+            {
+                fprintf(fp, "%s_bucket{le=\"%g\"} %llu\n", name, bounds[i],
+                        (unsigned long long) total);
+            }
+            else
+            {
+                fprintf(fp, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+                        (unsigned long long) total);
+            }
+        }
+        fprintf(fp, "%s_sum %.9f\n", name,
+                __atomic_load_n(&histograms[h].sum_ns, __ATOMIC_RELAXED) / 1e9);
+        fprintf(fp, "%s_count %llu\n", name, (unsigned long long)
+                __atomic_load_n(&histograms[h].count, __ATOMIC_RELAXED));
+    }
+
+    if (fclose(fp) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+    return rename(tmp, path) == 0;
+}
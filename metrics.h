@@ -0,0 +1,33 @@
+/**
+ * metrics.h
+ *
+ * Counters and latency histograms exported in the Prometheus text format.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Counters, all updated with relaxed atomics.
+enum counter { M_GAMES_STARTED, M_GAMES_WON, M_HINTS, M_CHECKS, M_ALLOCS,
+               M_ALLOC_BYTES, M_BATCH_PUZZLES, M_REQUESTS, NUM_COUNTERS };
+
+// Latency histograms.
+enum histogram { H_SOLVE, H_RENDER, NUM_HISTOGRAMS };
+
+// Adds n to a counter.
+void metrics_add(enum counter c, uint64_t n);
+
+// Records a latency, in seconds.
+void metrics_observe(enum histogram h, double seconds);
+
+// Returns the monotonic time in seconds.
+double metrics_now(void);
+
+// Writes all metrics to path, atomically replacing it. Returns true iff
+// successful.
+bool metrics_write(const char *path);
+
+#endif
@@ -0,0 +1,339 @@
+/**
+ * pack.c
+ *
+ * Implements reading of packs. A pack is a sequence of boards, each being 81
+ * little-endian ints of INTSIZE bytes, row by row, with 0 for an empty cell.
+ * Boards are decoded into the compact representation of board.h.
+ *
+ * A pack that has been reordered has a map beside it (n00b.map for n00b.bin)
+ * so boards keep the numbers they had before: entry i of the map is where
+ * board i + 1 is now. Boards beyond the map, such as those appended since,
+ * are where their numbers say. Numbers are little-endian.
+ *
+ *   map: "SMAP", version (4 bytes), entries (4 bytes), entries (4 bytes
+ *        each)
+ */
+
+#include "pack.h"
+#include "alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Version of the map format, and size (in bytes) of its header.
+#define MAP_VERSION 1
+#define MAP_HEADER 12
+
+// Function prototypes.
+static long pack_size(FILE *fp);
+static void encode(const uint8_t board[81], uint8_t raw[BOARDSIZE]);
+static void map_name(const char *filename, char *name);
+static void put32(uint8_t *p, uint32_t n);
+static uint32_t get32(const uint8_t *p);
+
+/*
+ * Reads board number (counting from 1) of filename into board. Returns true
+ * iff successful.
+ */
+bool pack_read(const char *filename, int number, uint8_t board[81])
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return false;
+
+    // Ensure file is of expected size and has such a board.
+    long size = pack_size(fp);
+    if (size < 0 || number < 1 || number > size / BOARDSIZE)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    // Seek to specified board and read it.
+    uint8_t raw[BOARDSIZE];
+    fseek(fp, (long) (number - 1) * BOARDSIZE, SEEK_SET);
+    if (fread(raw, BOARDSIZE, 1, fp) != 1)
+    {
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+
+    pack_decode(raw, 1, (uint8_t (*)[81]) board);
+    return true;
+}
+
+/*
+ * Loads every board in filename into *boards, which the caller must free with
+ * xfree.
+ * Returns the number of boards, or -1 if the file can't be read or isn't a
+ * whole number of boards.
+ */
+int pack_load(const char *filename, uint8_t (**boards)[81])
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return -1;
+
+    long size = pack_size(fp);
+    if (size <= 0)
+    {
+        fclose(fp);
+        return -1;
+    }
+    int count = size / BOARDSIZE;
+
+    // Read the raw bytes then decode them.
+    uint8_t *raw = xmalloc(size);
+    *boards = xmalloc(count * sizeof(**boards));
+    if (!raw || !*boards || fread(raw, size, 1, fp) != 1)
+    {
+        xfree(raw);
+        xfree(*boards);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    pack_decode(raw, count, *boards);
+    xfree(raw);
+    return count;
+}
+
+/*
+ * Returns the size of the pack fp, rewound to its start, or -1 if it isn't a
+ * whole number of boards.
+ */
+static long pack_size(FILE *fp)
+{
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    return (size < 0 || size % BOARDSIZE != 0) ? -1 : size;
+}
+
+/*
+ * Decodes count boards from raw, whatever the host's byte order. Non-zero
+ * cells are flagged as given. Returns the number of cells holding something
+ * other than 0-9.
+ */
+int pack_decode(const uint8_t *raw, int count, uint8_t (*boards)[81])
+{
+    int invalid = 0;
+    for (int i = 0; i < count * 81; i++)
+    {
+        const uint8_t *p = raw + i * INTSIZE;
+        uint32_t n = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+        boards[i / 81][i % 81] = n ? (n & CELL_DIGIT) | CELL_GIVEN : 0;
+        invalid += n > 9;
+    }
+    return invalid;
+}
+
+/*
+ * Writes count boards to filename as a pack, under a temporary name then
+ * renamed. Returns true iff successful.
+ */
+bool pack_write(const char *filename, const uint8_t (*boards)[81], int count)
+{
+    char tmp[strlen(filename) + 5];
+    sprintf(tmp, "%s.tmp", filename);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL)
+        return false;
+
+    bool written = true;
+    for (int i = 0; i < count && written; i++)
+    {
+        uint8_t raw[BOARDSIZE];
+        encode(boards[i], raw);
+        written = fwrite(raw, BOARDSIZE, 1, fp) == 1;
+    }
+    if (fclose(fp) != 0 || !written || rename(tmp, filename) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Appends board to the end of filename, which is created if it doesn't exist.
+ * Returns the board's number (counting from 1), or -1 if the file isn't a
+ * whole number of boards or can't be written.
+ */
+int pack_append(const char *filename, const uint8_t board[81])
+{
+    FILE *fp = fopen(filename, "ab");
+    if (fp == NULL)
+        return -1;
+
+    long size = pack_size(fp);
+    uint8_t raw[BOARDSIZE];
+    encode(board, raw);
+    if (size < 0 || fwrite(raw, BOARDSIZE, 1, fp) != 1)
+    {
+        fclose(fp);
+        return -1;
+    }
+    return fclose(fp) == 0 ? size / BOARDSIZE + 1 : -1;
+}
+
+/*
+ * Returns the number of boards in filename, or -1 if the file can't be read
+ * or isn't a whole number of boards.
+ */
+int pack_count(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return -1;
+
+    long size = pack_size(fp);
+    fclose(fp);
+    return size < 0 ? -1 : size / BOARDSIZE;
+}
+
+/*
+ * Writes map (of count entries) as the map of the pack filename, under a
+ * temporary name then renamed. Returns true iff successful.
+ */
+bool pack_write_map(const char *filename, const int *map, int count)
+{
+    char name[strlen(filename) + 5], tmp[strlen(filename) + 9];
+    map_name(filename, name);
+    sprintf(tmp, "%s.tmp", name);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL)
+        return false;
+
+    uint8_t header[MAP_HEADER];
+    memcpy(header, "SMAP", 4);
+    put32(header + 4, MAP_VERSION);
+    put32(header + 8, count);
+    bool written = fwrite(header, MAP_HEADER, 1, fp) == 1;
+    for (int i = 0; i < count && written; i++)
+    {
+        uint8_t entry[4];
+        put32(entry, map[i]);
+        written = fwrite(entry, 4, 1, fp) == 1;
+    }
+    if (fclose(fp) != 0 || !written || rename(tmp, name) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Loads the map of the pack filename into *map, which the caller must free
+ * with xfree. Returns the number of entries, 0 if there's no map (leaving
+ * *map NULL), or -1 if it can't be read.
+ */
+int pack_load_map(const char *filename, int **map)
+{
+    *map = NULL;
+    char name[strlen(filename) + 5];
+    map_name(filename, name);
+    FILE *fp = fopen(name, "rb");
+    if (fp == NULL)
+        return 0;
+
+    uint8_t header[MAP_HEADER];
+    if (fread(header, MAP_HEADER, 1, fp) != 1 ||
+        memcmp(header, "SMAP", 4) != 0 || get32(header + 4) != MAP_VERSION)
+    {
+        fclose(fp);
+        return -1;
+    }
+    int count = get32(header + 8);
+    *map = xmalloc(count * sizeof(**map) + 1);
+    for (int i = 0; *map && i < count; i++)
+    {
+        uint8_t entry[4];
+        if (fread(entry, 4, 1, fp) != 1)
+        {
+            xfree(*map);
+            *map = NULL;
+        }
+        else
+        {
+            (*map)[i] = get32(entry);
+        }
+    }
+    fclose(fp);
+    return *map ? count : -1;
+}
+
+/*
+ * Returns where board number (counting from 1) is in the pack filename: its
+ * entry in the pack's map if there is one, else number itself.
+ */
+int pack_resolve(const char *filename, int number)
+{
+    char name[strlen(filename) + 5];
+    map_name(filename, name);
+    FILE *fp = fopen(name, "rb");
+    if (fp == NULL)
+        return number;
+
+    // Only look up numbers the map has an entry for.
+    uint8_t header[MAP_HEADER], entry[4];
+    if (fread(header, MAP_HEADER, 1, fp) == 1 &&
+        memcmp(header, "SMAP", 4) == 0 && get32(header + 4) == MAP_VERSION &&
+        number >= 1 && number <= get32(header + 8) &&
+        fseek(fp, MAP_HEADER + 4L * (number - 1), SEEK_SET) == 0 &&
+        fread(entry, 4, 1, fp) == 1)
+    {
+        number = get32(entry);
+    }
+    fclose(fp);
+    return number;
+}
+
+/*
+ * Encodes board into raw as little-endian ints, whatever the host's byte
+ * order.
+ */
+static void encode(const uint8_t board[81], uint8_t raw[BOARDSIZE])
+{
+    memset(raw, 0, BOARDSIZE);
+    for (int j = 0; j < 81; j++)
+    {
+        raw[j * INTSIZE] = DIGIT(board[j]);
+    }
+}
+
+/*
+ * Writes into name the name of the map of the pack filename: its name with
+ * .map for .bin, or .map appended. name must have room for 5 more bytes.
+ */
+static void map_name(const char *filename, char *name)
+{
+    int length = strlen(filename);
+    if (length > 4 && strcmp(filename + length - 4, ".bin") == 0)
+    {
+        length -= 4;
+    }
+    sprintf(name, "%.*s.map", length, filename);
+}
+
+/*
+ * Stores n at p, little-endian.
+ */
+static void put32(uint8_t *p, uint32_t n)
+{
+    p[0] = n;
+    p[1] = n >> 8;
+    p[2] = n >> 16;
+    p[3] = n >> 24;
+}
+
+/*
+ * Returns the little-endian number at p.
+ */
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
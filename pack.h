@@ -0,0 +1,54 @@
+/**
+ * pack.h
+ *
+ * Reading of packs of boards, i.e. the *.bin files, and of the maps that keep
+ * boards' numbers once a pack has been reordered, i.e. the *.map files.
+ */
+
+#ifndef PACK_H
+#define PACK_H
+
+#include "board.h"
+
+#include <stdbool.h>
+
+// Size of each int (in bytes) in *.bin files.
+#define INTSIZE 4
+
+// Size of each board (in bytes) in *.bin files.
+#define BOARDSIZE (81 * INTSIZE)
+
+// Reads board number (from 1) of filename, returning true iff successful.
+bool pack_read(const char *filename, int number, uint8_t board[81]);
+
+// Loads every board in filename into a newly allocated array, returning the
+// number of boards or -1 on error.
+int pack_load(const char *filename, uint8_t (**boards)[81]);
+
+// Decodes count boards of raw pack data, returning the number of cells out of
+// range (which are read as their low four bits).
+int pack_decode(const uint8_t *raw, int count, uint8_t (*boards)[81]);
+
+// Writes count boards to filename as a pack, returning true iff successful.
+bool pack_write(const char *filename, const uint8_t (*boards)[81], int count);
+
+// Appends board to filename (creating it if need be), returning its number
+// (from 1) or -1 on error.
+int pack_append(const char *filename, const uint8_t board[81]);
+
+// Returns the number of boards in filename, or -1 on error.
+int pack_count(const char *filename);
+
+// Writes map as the map of the pack filename, entry i being where board
+// number i + 1 now is (from 1). Returns true iff successful.
+bool pack_write_map(const char *filename, const int *map, int count);
+
+// Loads the map of the pack filename into a newly allocated array, returning
+// its number of entries, 0 if the pack has no map or -1 on error.
+int pack_load_map(const char *filename, int **map);
+
+// Returns where board number (from 1) is in the pack filename, following its
+// map if it has one.
+int pack_resolve(const char *filename, int number);
+
+#endif
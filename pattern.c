@@ -0,0 +1,243 @@
+/**
+ * pattern.c
+ *
+ * Implements generating puzzles whose givens make a chosen pattern (a letter,
+ * a heart, a symmetric motif), read from a file of 81 cells row by row, '.'
+ * or '0' for a cell left empty and anything else for a given; whitespace is
+ * ignored. A pool of threads makes attempts from random starting points until
+ * enough distinct puzzles with a unique solution are found, which are written
+ * as a pack.
+ */
+
+#include "pattern.h"
+#include "alloc.h"
+#include "generate.h"
+#include "metrics.h"
+#include "pack.h"
+#include "solver.h"
+#include "sudoku.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Most threads in the pool.
+#define MAX_THREADS 256
+
+// Work shared by the pool's threads.
+static struct
+{
+    bool mask[81];
+    uint32_t seed;
+    double deadline;
+
+    // Guards the puzzles found so far.
+    pthread_mutex_t lock;
+    uint8_t (*puzzles)[81];
+    int wanted, found;
+
+    // Attempts made.
+    uint64_t attempts;
+}
+work = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Function prototypes.
+static int read_mask(const char *filename, bool mask[81]);
+static const char *impossible(const bool mask[81]);
+static void *worker(void *arg);
+
+/*
+ * Generates puzzles with the pattern given, writing them to a pack. Returns
+ * 0 iff successful.
+ */
+int pattern_main(int argc, char *argv[])
+{
+    // Check usage.
+    const char *usage = "Usage: sudoku pattern mask [puzzles] [output.bin] "
+                        "[threads]\n";
+    int wanted = 1;
+    const char *output = "pattern.bin";
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    char c;
+    if (argc < 2 || argc > 5 ||
+        (argc > 2 && (sscanf(argv[2], " %d %c", &wanted, &c) != 1 ||
+                      wanted < 1)) ||
+        (argc > 4 && (sscanf(argv[4], " %d %c", &threads, &c) != 1 ||
+                      threads < 1)))
+    {
+        fprintf(stderr, usage);
+        return 1;
+    }
+    if (argc > 3)
+    {
+        output = argv[3];
+    }
+    if (threads > MAX_THREADS)
+    {
+        threads = MAX_THREADS;
+    }
+
+    int givens = read_mask(argv[1], work.mask);
+    if (givens < 0)
+    {
+        fprintf(stderr, "Could not read a pattern of 81 cells from %s!\n",
+                argv[1]);
+        return 2;
+    }
+    const char *reason = impossible(work.mask);
+    if (reason)
+    {
+        fprintf(stderr, "No puzzle with that pattern has a unique solution: "
+                        "%s.\n", reason);
+        return 3;
+    }
+
+    work.puzzles = xmalloc(wanted * sizeof(*work.puzzles));
+    if (!work.puzzles)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 2;
+    }
+    work.wanted = wanted;
+    work.seed = time(NULL);
+
+    // Search with the pool until enough are found or time runs out.
+    double start = metrics_now();
+    work.deadline = start + PATTERN_TIMEOUT;
+    pthread_t pool[MAX_THREADS];
+    int started = 0;
+    while (started < threads &&
+           pthread_create(&pool[started], NULL, worker,
+                          (void *) (intptr_t) started) == 0)
+    {
+        started++;
+    }
+
+    // Should no thread start, do the work here instead.
+    if (started == 0)
+    {
+        worker(NULL);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(pool[i], NULL);
+    }
+    double elapsed = metrics_now() - start;
+
+    printf("Made %d of %d puzzles with %d givens in %.3f s, from %llu "
+           "attempts with %d threads.\n", work.found, wanted, givens,
+           elapsed, (unsigned long long) work.attempts, started ? started : 1);
+    int status = 0;
+    if (work.found > 0 && !pack_write(output, (const uint8_t (*)[81])
+                                      work.puzzles, work.found))
+    {
+        fprintf(stderr, "Could not write %s!\n", output);
+        status = 2;
+    }
+    else if (work.found < wanted)
+    {
+        fprintf(stderr, "Gave up after %d s.\n", PATTERN_TIMEOUT);
+        status = 4;
+    }
+    xfree(work.puzzles);
+    return status;
+}
+
+/*
+ * Reads the pattern in filename into mask. Returns the number of givens, or
+ * -1 if the file can't be read or has fewer than 81 cells.
+ */
+static int read_mask(const char *filename, bool mask[81])
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+        return -1;
+
+    int cells = 0, givens = 0, ch;
+    while (cells < 81 && (ch = fgetc(fp)) != EOF)
+    {
+        if (!isspace(ch))
+        {
+            mask[cells] = ch != '.' && ch != '0';
+            givens += mask[cells++];
+        }
+    }
+    fclose(fp);
+    return cells == 81 ? givens : -1;
+}
+
+/*
+ * Returns why no puzzle with the pattern mask can have a unique solution, if
+ * it's plain: too few givens, or two rows of a band (or columns of a stack)
+ * without any, which could be swapped in any solution to make another.
+ * Returns NULL otherwise, though there may still be none.
+ */
+static const char *impossible(const bool mask[81])
+{
+    int givens = 0;
+    bool row[9] = { false }, column[9] = { false };
+    for (int i = 0; i < 81; i++)
+    {
+        givens += mask[i];
+        row[cell_row[i]] |= mask[i];
+        column[cell_col[i]] |= mask[i];
+    }
+    if (givens < 17)
+    {
+        return "it has fewer than 17 givens";
+    }
+
+    for (int i = 0; i < 9; i++)
+    {
+        for (int j = i + 1; j < 9 && j / 3 == i / 3; j++)
+        {
+            if (!row[i] && !row[j])
+            {
+                return "two rows of a band are empty";
+            }
+            if (!column[i] && !column[j])
+            {
+                return "two columns of a stack are empty";
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Makes attempts at puzzles, each thread from its own random starting point,
+ * until enough have been found or time runs out. Puzzles already found are
+ * dropped.
+ */
+static void *worker(void *arg)
+{
+    uint32_t rng = seed_random(work.seed + (intptr_t) arg);
+    while (__atomic_load_n(&work.found, __ATOMIC_RELAXED) < work.wanted &&
+           metrics_now() < work.deadline)
+    {
+        uint8_t puzzle[81], solution[81];
+        bool made = generate_pattern(&rng, work.mask, puzzle, solution);
+        __atomic_fetch_add(&work.attempts, 1, __ATOMIC_RELAXED);
+        if (!made)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&work.lock);
+        bool seen = false;
+        for (int i = 0; i < work.found && !seen; i++)
+        {
+            seen = memcmp(work.puzzles[i], puzzle, 81) == 0;
+        }
+        if (!seen && work.found < work.wanted)
+        {
+            memcpy(work.puzzles[work.found], puzzle, 81);
+            __atomic_store_n(&work.found, work.found + 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&work.lock);
+    }
+    return NULL;
+}
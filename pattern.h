@@ -0,0 +1,13 @@
+/**
+ * pattern.h
+ *
+ * Generation of puzzles whose givens make a chosen pattern.
+ */
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+// Entry point for "sudoku pattern ...".
+int pattern_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,451 @@
+/**
+ * reorder.c
+ *
+ * Implements rewriting a pack sorted by chosen keys: difficulty (the hardest
+ * technique a person needs, then how often), canonical form (digits
+ * relabelled in order of first appearance, so boards differing only in
+ * labels sit together) and number of clues. Ties keep the pack's order. A map
+ * is written beside the new pack so every board keeps its number.
+ *
+ * Boards are grouped into bands by the hardest technique they need, and the
+ * effect of the new order is measured on scanning each band: the pages
+ * holding its boards, the pages actually in the page cache after reading
+ * them from cold (read-ahead included) and the time taken, before and after,
+ * along with the size of each pack compressed by gzip.
+ */
+
+#include "reorder.h"
+#include "alloc.h"
+#include "logic.h"
+#include "metrics.h"
+#include "pack.h"
+#include "solver.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Size (in bytes) of a page.
+#define PAGE_SIZE 4096
+
+// Most keys to sort by.
+#define MAX_KEYS 3
+
+// Times each pack's bands are scanned, the fastest being reported.
+#define SCAN_ROUNDS 10
+
+// Band of boards without a unique solution, after every technique's.
+#define UNRATED (GUESS + 1)
+
+// Keys to sort by.
+enum key { KEY_DIFFICULTY, KEY_CANONICAL, KEY_CLUES };
+
+// A board with its keys and where it was in the pack (from 0).
+struct record
+{
+    int position;
+    uint8_t band, rating, clues;
+    uint8_t canon[81];
+};
+
+// Effect of a pack's order on scanning its bands.
+struct scan
+{
+    // Pages holding boards of each band, and pages cached after reading
+    // each band from cold, summed over bands.
+    long pages, resident;
+
+    // Time (in seconds) taken reading every band from cold.
+    double elapsed;
+
+    // Size (in bytes) of the pack compressed, or -1 if it couldn't be.
+    long compressed;
+};
+
+// Keys to sort by, in order.
+static struct
+{
+    enum key keys[MAX_KEYS];
+    int count;
+}
+sort;
+
+// Function prototypes.
+static bool parse_keys(const char *list);
+static void rate(const uint8_t board[81], struct record *r);
+static int compare(const void *a, const void *b);
+static bool measure(const char *filename, const struct record *records,
+                    int count, const int *positions, struct scan *scan);
+static long band_pages(const int *positions, int count);
+static long gzip_size(const char *filename);
+
+/*
+ * Rewrites a pack sorted by keys, with a map keeping its boards' numbers, and
+ * reports the effect. Returns 0 iff successful.
+ */
+int reorder_main(int argc, char *argv[])
+{
+    // Check usage.
+    if (argc < 3 || argc > 4 ||
+        !parse_keys(argc > 3 ? argv[3] : "difficulty,clues"))
+    {
+        fprintf(stderr, "Usage: sudoku reorder input.bin output.bin "
+                        "[difficulty|canonical|clues[,...]]\n");
+        return 1;
+    }
+    const char *input = argv[1], *output = argv[2];
+
+    uint8_t (*boards)[81];
+    int count = pack_load(input, &boards);
+    if (count < 0)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", input);
+        return 2;
+    }
+    int *map;
+    int mapped = pack_load_map(input, &map);
+    struct record *records = xmalloc(count * sizeof(*records));
+    int *before = xmalloc(count * sizeof(*before));
+    int *after = xmalloc(count * sizeof(*after));
+    int *numbers = xmalloc(count * sizeof(*numbers));
+    uint8_t (*laid)[81] = xmalloc(count * sizeof(*laid));
+    if (mapped < 0 || !records || !before || !after || !numbers || !laid)
+    {
+        fprintf(stderr, "Could not read %s's map or out of memory!\n", input);
+        xfree(boards);
+        xfree(map);
+        xfree(records);
+        xfree(before);
+        xfree(after);
+        xfree(numbers);
+        xfree(laid);
+        return 2;
+    }
+
+    // Rate every board, then sort.
+    double start = metrics_now();
+    for (int i = 0; i < count; i++)
+    {
+        records[i].position = i;
+        rate(boards[i], &records[i]);
+    }
+    qsort(records, count, sizeof(*records), compare);
+    double elapsed = metrics_now() - start;
+
+    // Note where each board was and is now, and lay the boards out anew.
+    for (int i = 0; i < count; i++)
+    {
+        before[i] = records[i].position;
+        after[records[i].position] = i;
+        memcpy(laid[i], boards[records[i].position], 81);
+    }
+
+    // Measure the old order before it's perhaps overwritten.
+    struct scan old, new;
+    bool measured = measure(input, records, count, before, &old);
+
+    // Each board's number leads, through the old map if any, to where it
+    // was, and from there to where it is now.
+    for (int i = 0; i < count; i++)
+    {
+        int was = i < mapped && map[i] >= 1 && map[i] <= count ? map[i] :
+                                                                 i + 1;
+        numbers[i] = after[was - 1] + 1;
+    }
+    bool written = pack_write(output, (const uint8_t (*)[81]) laid, count) &&
+                   pack_write_map(output, numbers, count);
+    if (!written)
+    {
+        fprintf(stderr, "Could not write %s and its map!\n", output);
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+        {
+            after[i] = i;
+        }
+        measured = measure(output, records, count, after, &new) && measured;
+
+        printf("Sorted %d boards in %.3f s and wrote them to %s, with a map "
+               "keeping their numbers.\n", count, elapsed, output);
+        printf("                         before      after\n");
+        printf("pages holding each band %7ld    %7ld\n", old.pages, new.pages);
+        if (measured)
+        {
+            printf("pages cached scanning   %7ld    %7ld\n", old.resident,
+                   new.resident);
+            printf("time scanning (ms)      %7.2f    %7.2f\n",
+                   old.elapsed * 1e3, new.elapsed * 1e3);
+        }
+        if (old.compressed >= 0 && new.compressed >= 0)
+        {
+            printf("gzip -9 size (bytes)    %7ld    %7ld\n", old.compressed,
+                   new.compressed);
+        }
+    }
+
+    xfree(boards);
+    xfree(map);
+    xfree(records);
+    xfree(before);
+    xfree(after);
+    xfree(numbers);
+    xfree(laid);
+    return written ? 0 : 2;
+}
+
+/*
+ * Reads a comma separated list of keys to sort by. Returns true iff each is
+ * known, and there's at least one.
+ */
+static bool parse_keys(const char *list)
+{
+    static const char *names[] = { "difficulty", "canonical", "clues" };
+    sort.count = 0;
+    while (*list)
+    {
+        int length = strcspn(list, ",");
+        int key = 0;
+        while (key < 3 && (strlen(names[key]) != length ||
+                           strncmp(list, names[key], length) != 0))
+        {
+            key++;
+        }
+        if (key == 3 || sort.count == MAX_KEYS)
+        {
+            return false;
+        }
+        sort.keys[sort.count++] = key;
+        list += length + (list[length] == ',');
+    }
+    return sort.count > 0;
+}
+
+/*
+ * Works out board's keys into r: its band (the hardest technique needed) and
+ * rating (how many steps need it), clues and canonical form.
+ */
+static void rate(const uint8_t board[81], struct record *r)
+{
+    uint8_t labels[10], solution[81];
+    uint16_t plan[81];
+    board_canonical(board, r->canon, labels);
+    r->clues = 0;
+    for (int i = 0; i < 81; i++)
+    {
+        r->clues += DIGIT(board[i]) != 0;
+    }
+
+    r->band = UNRATED;
+    r->rating = 0;
+    if (count_solutions(board, 2, solution) != 1)
+    {
+        return;
+    }
+    r->band = HIDDEN_BOX;
+    int steps = logic_plan(board, solution, plan);
+    for (int i = 0; i < steps; i++)
+    {
+        int technique = STEP_TECHNIQUE(plan[i]);
+        if (technique > r->band)
+        {
+            r->band = technique;
+            r->rating = 0;
+        }
+        r->rating += technique == r->band;
+    }
+}
+
+/*
+ * Compares records by the keys chosen, then by where they were, for qsort.
+ */
+static int compare(const void *a, const void *b)
+{
+    const struct record *x = a, *y = b;
+    for (int i = 0; i < sort.count; i++)
+    {
+        int order = 0;
+        switch (sort.keys[i])
+        {
+            case KEY_DIFFICULTY:
+                order = x->band != y->band ? x->band - y->band :
+                                             x->rating - y->rating;
+                break;
+
+            case KEY_CANONICAL:
+                order = memcmp(x->canon, y->canon, 81);
+                break;
+
+            case KEY_CLUES:
+                order = x->clues - y->clues;
+                break;
+        }
+        if (order != 0)
+        {
+            return order;
+        }
+    }
+    return x->position - y->position;
+}
+
+/*
+ * Measures scanning each band of the pack filename, in which records[i] is
+ * at positions[i] (from 0), into scan. Returns false if the page cache
+ * couldn't be measured, leaving only the pages holding each band and the
+ * compressed size.
+ */
+static bool measure(const char *filename, const struct record *records,
+                    int count, const int *positions, struct scan *scan)
+{
+    memset(scan, 0, sizeof(*scan));
+    scan->compressed = gzip_size(filename);
+
+    // Gather each band's boards in the order they're stored.
+    int *order = xmalloc(count * sizeof(*order));
+    int starts[UNRATED + 2] = {0};
+    if (!order)
+    {
+        return false;
+    }
+    for (int b = HIDDEN_BOX, n = 0; b <= UNRATED; b++)
+    {
+        starts[b] = n;
+        for (int i = 0; i < count; i++)
+        {
+            if (records[i].band == b)
+            {
+                int j = n++;
+                for (; j > starts[b] && order[j - 1] > positions[i]; j--)
+                {
+                    order[j] = order[j - 1];
+                }
+                order[j] = positions[i];
+            }
+        }
+        starts[b + 1] = n;
+        scan->pages += band_pages(order + starts[b], n - starts[b]);
+    }
+
+    int fd = open(filename, O_RDONLY);
+    size_t size = (size_t) count * BOARDSIZE;
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    void *map = fd < 0 ? MAP_FAILED :
+                mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    unsigned char *cached = xmalloc(pages);
+
+    // Dropping pages from the cache skips dirty ones, so flush a pack just
+    // written first.
+    bool measured = map != MAP_FAILED && cached && fsync(fd) == 0;
+
+    // Read each band from cold, one board at a time, then see how much of
+    // the pack that brought into the page cache. Times vary, so the fastest
+    // of a few rounds is kept.
+    for (int round = 0; measured && round < SCAN_ROUNDS; round++)
+    {
+        double elapsed = 0;
+        scan->resident = 0;
+        for (int b = HIDDEN_BOX; measured && b <= UNRATED; b++)
+        {
+            if (starts[b] == starts[b + 1])
+            {
+                continue;
+            }
+            if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+            {
+                measured = false;
+                break;
+            }
+            double start = metrics_now();
+            for (int i = starts[b]; i < starts[b + 1]; i++)
+            {
+                uint8_t raw[BOARDSIZE];
+                measured &= pread(fd, raw, BOARDSIZE,
+                                  (off_t) order[i] * BOARDSIZE) == BOARDSIZE;
+            }
+            elapsed += metrics_now() - start;
+            measured &= mincore(map, size, cached) == 0;
+            for (size_t i = 0; measured && i < pages; i++)
+            {
+                scan->resident += cached[i] & 1;
+            }
+        }
+        if (round == 0 || elapsed < scan->elapsed)
+        {
+            scan->elapsed = elapsed;
+        }
+    }
+
+    if (map != MAP_FAILED)
+    {
+        munmap(map, size);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    xfree(cached);
+    xfree(order);
+    return measured;
+}
+
+/*
+ * Returns the number of pages holding the boards at positions (from 0, in
+ * ascending order).
+ */
+static long band_pages(const int *positions, int count)
+{
+    long pages = 0, last = -1;
+    for (int i = 0; i < count; i++)
+    {
+        long first = (long) positions[i] * BOARDSIZE / PAGE_SIZE;
+        long end = ((long) positions[i] * BOARDSIZE + BOARDSIZE - 1) /
+                   PAGE_SIZE;
+        pages += end - (first > last ? first : last + 1) + 1;
+        last = end > last ? end : last;
+    }
+    return pages;
+}
+
+/*
+ * Returns the size of filename compressed with gzip -9, or -1 if gzip can't
+ * be run.
+ */
+static long gzip_size(const char *filename)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execlp("gzip", "gzip", "-9", "-c", "--", filename, (char *) NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    long size = 0;
+    ssize_t n;
+    char buffer[PAGE_SIZE];
+    while (pid > 0 && (n = read(fds[0], buffer, sizeof(buffer))) > 0)
+    {
+        size += n;
+    }
+    close(fds[0]);
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0)
+    {
+        return -1;
+    }
+    return size;
+}
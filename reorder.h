@@ -0,0 +1,14 @@
+/**
+ * reorder.h
+ *
+ * Rewriting of a pack sorted by chosen keys, so boards that are read
+ * together are stored together, keeping their numbers through a map.
+ */
+
+#ifndef REORDER_H
+#define REORDER_H
+
+// Entry point for "sudoku reorder ...".
+int reorder_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,306 @@
+/**
+ * serve.c
+ *
+ * Implements the solver daemon. The main thread accepts connections and adds
+ * them to an epoll set shared by a pool of solver threads. Each time one of
+ * them finds a connection readable it reads everything available, solves that
+ * micro-batch of requests and answers them all in a single write. Connections
+ * are armed one-shot, so only one thread serves a connection at a time and
+ * responses keep the order of requests.
+ *
+ * Responses a client isn't reading yet stay queued on its connection, which
+ * is then armed for writing instead of reading until they've all gone, so a
+ * slow client holds back only its own requests and never a solver thread.
+ */
+
+#include "serve.h"
+#include "alloc.h"
+#include "cache.h"
+#include "metrics.h"
+#include "solver.h"
+#include "sudoku.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Most requests read from a connection at once.
+#define BATCH 1024
+
+// State of one connection: its socket, any partial request read so far and
+// responses not yet sent.
+struct connection
+{
+    int fd;
+    int length;
+    uint8_t in[BATCH * REQUEST_SIZE];
+    int sent, unsent;
+    uint8_t out[BATCH * RESPONSE_SIZE];
+};
+
+// The epoll set of connections waiting for requests.
+static int epfd;
+
+// Set by signal handler to stop accepting connections.
+static volatile sig_atomic_t stopping;
+
+// Function prototypes.
+static void *solver(void *arg);
+static uint32_t serve(struct connection *c);
+static bool flush(struct connection *c);
+static void handle_stop(int signum);
+
+/*
+ * Runs the daemon until interrupted. Returns 0 iff successful.
+ */
+int serve_main(int argc, char *argv[])
+{
+    // Check usage.
+    const char *usage = "Usage: sudoku serve socket [threads]\n";
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, usage);
+        return 1;
+    }
+
+    // Default to one thread per processor.
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc == 3)
+    {
+        char c;
+        if (sscanf(argv[2], " %d %c", &threads, &c) != 1 || threads < 1)
+        {
+            fprintf(stderr, usage);
+            return 1;
+        }
+    }
+
+    // Answer from the solution cache where possible.
+    cache_open(CACHE_FILE);
+
+    // Listen on the socket, replacing any left over from before.
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(argv[1]) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path too long!\n");
+        return 2;
+    }
+    strcpy(addr.sun_path, argv[1]);
+    unlink(argv[1]);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(listener, SOMAXCONN) != 0)
+    {
+        perror("Could not listen on socket");
+        return 2;
+    }
+
+    epfd = epoll_create1(0);
+    if (epfd < 0)
+    {
+        perror("Could not create epoll set");
+        return 3;
+    }
+
+    // Start the pool.
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, solver, NULL) != 0)
+        {
+            fprintf(stderr, "Could not start thread!\n");
+            return 4;
+        }
+        pthread_detach(thread);
+    }
+
+    // Stop cleanly on ctrl-C or kill; a client going away isn't an error.
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "Serving on %s with %d threads.\n", argv[1], threads);
+
+    // Accept connections, exporting metrics now and then.
+    const char *metrics = getenv(METRICS_ENV);
+    while (!stopping)
+    {
+        struct pollfd fd = { listener, POLLIN, 0 };
+        if (poll(&fd, 1, METRICS_INTERVAL * 1000) > 0)
+        {
+            int client = accept(listener, NULL, NULL);
+            struct connection *c = client < 0 ? NULL :
+                                   xmalloc(sizeof(struct connection));
+            if (c == NULL)
+            {
+                if (client >= 0)
+                    close(client);
+                continue;
+            }
+
+            c->fd = client;
+            c->length = c->sent = c->unsent = 0;
+            fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+
+            struct epoll_event ev = { EPOLLIN | EPOLLONESHOT, { .ptr = c } };
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, client, &ev) != 0)
+            {
+                close(client);
+                xfree(c);
+            }
+        }
+        if (metrics)
+        {
+            metrics_write(metrics);
+        }
+    }
+
+    close(listener);
+    unlink(argv[1]);
+    return 0;
+}
+
+/*
+ * A solver thread, serving whichever connection has requests waiting.
+ */
+static void *solver(void *arg)
+{
+    for (;;)
+    {
+        struct epoll_event ev;
+        if (epoll_wait(epfd, &ev, 1, -1) != 1)
+        {
+            continue;
+        }
+
+        struct connection *c = ev.data.ptr;
+        uint32_t events = serve(c);
+        if (events)
+        {
+            // Wait for its next requests, or for room to send what's queued.
+            ev.events = events | EPOLLONESHOT;
+            if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0)
+            {
+                continue;
+            }
+        }
+
+        // Otherwise the connection is finished with.
+        close(c->fd);
+        xfree(c);
+    }
+    return NULL;
+}
+
+/*
+ * Sends what responses are queued on connection c, then reads what requests
+ * are waiting and answers them, queueing what can't be sent yet. Returns the
+ * events to wait for next on the connection, or 0 iff it should be closed.
+ */
+static uint32_t serve(struct connection *c)
+{
+    // Read no more until the client takes the responses it has.
+    if (!flush(c))
+    {
+        return 0;
+    }
+    if (c->unsent > 0)
+    {
+        return EPOLLOUT;
+    }
+
+    ssize_t n = read(c->fd, c->in + c->length, sizeof(c->in) - c->length);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+    {
+        return 0;
+    }
+    c->length += n > 0 ? n : 0;
+
+    // Solve every complete request.
+    int count = c->length / REQUEST_SIZE;
+    for (int i = 0; i < count; i++)
+    {
+        const uint8_t *request = c->in + i * REQUEST_SIZE;
+        uint8_t *response = c->out + i * RESPONSE_SIZE;
+
+        uint8_t board[81], solution[81] = {0};
+        board_unpack(request + 4, board);
+
+        struct solve_stats stats;
+        double start = metrics_now();
+        int solutions = cache_solve(board, 2, solution, &solver_defaults,
+                                    NULL, &stats);
+        uint32_t ns = (metrics_now() - start) * 1e9;
+        metrics_observe(H_SOLVE, ns / 1e9);
+
+        uint32_t nodes = stats.nodes > UINT32_MAX ? UINT32_MAX : stats.nodes;
+        memcpy(response, request, 4);
+        response[4] = solutions == 0 ? SOLVE_NONE :
+                      solutions == 1 ? SOLVE_UNIQUE : SOLVE_MULTIPLE;
+        board_pack(solution, response + 5);
+        for (int b = 0; b < 4; b++)
+        {
+            response[5 + PACKED_SIZE + b] = nodes >> 8 * b;
+            response[9 + PACKED_SIZE + b] = ns >> 8 * b;
+        }
+    }
+    metrics_add(M_REQUESTS, count);
+
+    // Keep any partial request for next time.
+    c->length -= count * REQUEST_SIZE;
+    memmove(c->in, c->in + count * REQUEST_SIZE, c->length);
+
+    c->sent = 0;
+    c->unsent = count * RESPONSE_SIZE;
+    if (!flush(c))
+    {
+        return 0;
+    }
+    return c->unsent > 0 ? EPOLLOUT : EPOLLIN;
+}
+
+/*
+ * Writes as much of connection c's queued responses as its socket takes
+ * without waiting. Returns false iff the connection has failed.
+ */
+static bool flush(struct connection *c)
+{
+    while (c->unsent > 0)
+    {
+        ssize_t n = write(c->fd, c->out + c->sent, c->unsent);
+        if (n > 0)
+        {
+            c->sent += n;
+            c->unsent -= n;
+        }
+        else if (n < 0 && errno == EAGAIN)
+        {
+            break;
+        }
+        else if (n < 0 && errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Handles SIGINT and SIGTERM by stopping the daemon.
+ */
+static void handle_stop(int signum)
+{
+    stopping = 1;
+}
@@ -0,0 +1,33 @@
+/**
+ * serve.h
+ *
+ * The solver service: a daemon answering puzzles sent over a Unix domain
+ * socket, and a client for load testing it.
+ *
+ * Requests and responses are fixed-size records, with boards packed by
+ * board_pack and numbers little-endian. A client may send any number of
+ * requests without waiting; the responses on a connection come back in the
+ * order of its requests.
+ *
+ *   request:  id (4 bytes), board (PACKED_SIZE bytes)
+ *   response: id (4 bytes), status (1 byte), solution (PACKED_SIZE bytes),
+ *             nodes searched (4 bytes), time to solve in ns (4 bytes)
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "board.h"
+
+// Sizes (in bytes) of requests and responses.
+#define REQUEST_SIZE (4 + PACKED_SIZE)
+#define RESPONSE_SIZE (4 + 1 + PACKED_SIZE + 4 + 4)
+
+// Status of a response: whether the board had no, one or many solutions.
+enum { SOLVE_NONE, SOLVE_UNIQUE, SOLVE_MULTIPLE };
+
+// Entry points for "sudoku serve ..." and "sudoku loadtest ...".
+int serve_main(int argc, char *argv[]);
+int loadtest_main(int argc, char *argv[]);
+
+#endif
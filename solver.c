@@ -0,0 +1,631 @@
+/**
+ * solver.c
+ *
+ * Implements a fast, reentrant bitmask solver. Each row, column and box keeps
+ * a mask of the digits already used in it, and the search always branches on
+ * the empty cell with the fewest candidates.
+ *
+ * When only counting, the search can also keep the Zobrist hash of the board
+ * and look up partial boards with enough empty cells in a transposition table,
+ * since removing clues in different orders reaches the same boards again and
+ * again.
+ *
+ * How it branches, how much it deduces at each node before branching and
+ * whether it uses a table can all be configured, the best settings depending
+ * on the puzzles (see autotune.c).
+ *
+ * The search tree can also be recorded, one fixed-size node at a time into a
+ * buffer set aside beforehand, for profiling (see trace.c).
+ */
+
+#include "solver.h"
+#include "sudoku.h"
+
+#include <string.h>
+#include <time.h>
+
+// Mask of all nine digits, bit (d - 1) standing for digit d.
+#define ALL_DIGITS 0x1ff
+
+// State of a search in progress.
+struct search
+{
+    // The digits of the board, 0 for empty.
+    uint8_t cells[81];
+
+    // Digits used in each row, column and box.
+    uint16_t row[9], col[9], box[9];
+
+    // Number of solutions found so far and the limit at which to stop.
+    int count, limit;
+
+    // Where to store the first solution found, or NULL.
+    uint8_t *solution;
+
+    // Random state for shuffling candidates, or NULL for digit order.
+    uint32_t *rng;
+
+    // Transposition table of counts, or NULL, and the board's hash and
+    // number of empty cells.
+    struct table *table;
+    uint64_t hash;
+    int empty;
+
+    // Number of nodes visited, and answered from the table.
+    uint64_t nodes, hits;
+
+    // How to search.
+    struct solver_config config;
+
+    // Tree being recorded, or NULL, the depth of the search and the move
+    // leading to the node being entered.
+    struct trace *trace;
+    int depth;
+    uint8_t cell, digit;
+};
+
+// Settings matching the solver before it could be configured.
+const struct solver_config solver_defaults = { BRANCH_FEWEST, 0, ENGINE_SEARCH };
+
+// Names of the settings, for display.
+const char *branching_names[] = { "first", "fewest", "units" };
+const char *engine_names[] = { "search", "table" };
+
+// Function prototypes.
+static bool setup(struct search *s, const uint8_t board[81]);
+static void search(struct search *s);
+static bool propagate(struct search *s, uint8_t forced[81], int *filled);
+static int unit_places(const struct search *s, uint8_t cells[9], int *digit);
+static inline void place(struct search *s, int i, int d);
+static inline void unplace(struct search *s, int i, int d);
+static int trace_enter(struct search *s);
+static void trace_exit(struct search *s, int node, int outcome);
+static uint64_t now_ns(void);
+
+/*
+ * Returns the number of solutions of board, stopping once limit is reached.
+ * If solution is not NULL the first solution found is copied into it. The
+ * board itself is left unchanged.
+ */
+int count_solutions(const uint8_t board[81], int limit, uint8_t solution[81])
+{
+    struct solve_stats stats;
+    return count_solutions_stats(board, limit, solution, &stats);
+}
+
+/*
+ * As count_solutions, also noting in stats how much searching it took.
+ */
+int count_solutions_stats(const uint8_t board[81], int limit,
+                          uint8_t solution[81], struct solve_stats *stats)
+{
+    struct search s;
+    if (!setup(&s, board))
+    {
+        stats->nodes = 0;
+        return 0;
+    }
+    s.limit = limit;
+    s.solution = solution;
+    s.rng = NULL;
+
+    search(&s);
+    stats->nodes = s.nodes;
+    stats->hits = 0;
+    return s.count;
+}
+
+/*
+ * As count_solutions_stats, without finding a solution, using table to skip
+ * boards that have been counted before.
+ */
+int count_solutions_table(const uint8_t board[81], int limit,
+                          struct table *table, struct solve_stats *stats)
+{
+    struct search s;
+    if (!setup(&s, board))
+    {
+        stats->nodes = stats->hits = 0;
+        return 0;
+    }
+    s.limit = limit;
+    s.table = table;
+
+    search(&s);
+    stats->nodes = s.nodes;
+    stats->hits = s.hits;
+    return s.count;
+}
+
+/*
+ * As count_solutions_stats, searching as config says. The table, which may be
+ * NULL, is only used by ENGINE_TABLE, and only once a solution is found, so
+ * that the first solution is always found by search.
+ */
+int count_solutions_config(const uint8_t board[81], int limit,
+                           uint8_t solution[81],
+                           const struct solver_config *config,
+                           struct table *table, struct solve_stats *stats)
+{
+    struct search s;
+    if (!setup(&s, board))
+    {
+        stats->nodes = stats->hits = 0;
+        return 0;
+    }
+    s.limit = limit;
+    s.solution = solution;
+    s.config = *config;
+    s.table = config->engine == ENGINE_TABLE ? table : NULL;
+
+    search(&s);
+    stats->nodes = s.nodes;
+    stats->hits = s.hits;
+    return s.count;
+}
+
+/*
+ * As count_solutions_config, also recording the search tree in trace, whose
+ * buffer must be set aside beforehand. Nodes beyond its size are counted as
+ * dropped, their time still counting towards their recorded ancestors'.
+ * Boards answered from the table are recorded as cached.
+ */
+int count_solutions_trace(const uint8_t board[81], int limit,
+                          uint8_t solution[81],
+                          const struct solver_config *config,
+                          struct table *table, struct trace *trace,
+                          struct solve_stats *stats)
+{
+    struct search s;
+    trace->count = 0;
+    trace->dropped = 0;
+    if (!setup(&s, board))
+    {
+        stats->nodes = stats->hits = 0;
+        return 0;
+    }
+    s.limit = limit;
+    s.solution = solution;
+    s.config = *config;
+    s.table = config->engine == ENGINE_TABLE ? table : NULL;
+    s.trace = trace;
+    s.cell = TRACE_ROOT;
+
+    search(&s);
+    stats->nodes = s.nodes;
+    stats->hits = s.hits;
+    return s.count;
+}
+
+/*
+ * Returns true iff config holds settings the solver knows.
+ */
+bool solver_config_valid(const struct solver_config *config)
+{
+    return config->branching <= BRANCH_UNITS &&
+           config->propagation <= PROPAGATE_MAX &&
+           config->engine <= ENGINE_TABLE;
+}
+
+/*
+ * Fills grid with a complete, valid sudoku chosen using the random state rng.
+ */
+void random_grid(uint32_t *rng, uint8_t grid[81])
+{
+    uint8_t empty[81] = {0};
+
+    struct search s;
+    setup(&s, empty);
+    s.limit = 1;
+    s.solution = grid;
+    s.rng = rng;
+
+    search(&s);
+}
+
+/*
+ * Returns the next number from a xorshift generator with state *rng.
+ */
+uint32_t next_random(uint32_t *rng)
+{
+    uint32_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *rng = x;
+    return x;
+}
+
+/*
+ * Returns a non-zero xorshift state scrambled from seed.
+ */
+uint32_t seed_random(uint32_t seed)
+{
+    uint32_t x = seed * 2654435761u ^ 0x9e3779b9u;
+    return x ? x : 1;
+}
+
+/*
+ * Prepares the masks of s from board, ignoring any flags. Returns false iff
+ * the board already contains a repeated digit.
+ */
+static bool setup(struct search *s, const uint8_t board[81])
+{
+    memset(s, 0, sizeof(*s));
+    s->config = solver_defaults;
+    for (int i = 0; i < 81; i++)
+    {
+        int n = DIGIT(board[i]);
+        if (n == 0)
+        {
+            s->empty++;
+            continue;
+        }
+
+        int row = cell_row[i], col = cell_col[i], box = cell_box[i];
+        uint16_t bit = 1 << (n - 1);
+        if ((s->row[row] | s->col[col] | s->box[box]) & bit)
+        {
+            return false;
+        }
+        s->row[row] |= bit;
+        s->col[col] |= bit;
+        s->box[box] |= bit;
+        s->cells[i] = n;
+        s->hash ^= zobrist(i, n);
+    }
+    return true;
+}
+
+/*
+ * Recursively searches for solutions until s->limit of them have been found.
+ */
+static void search(struct search *s)
+{
+    s->nodes++;
+    int node = s->trace ? trace_enter(s) : -1;
+    int outcome = NODE_DEAD;
+
+    // Fill in what can be deduced first, if propagating, undoing it after.
+    uint8_t forced[81];
+    int filled = 0;
+    if (s->config.propagation && !propagate(s, forced, &filled))
+    {
+        goto undo;
+    }
+
+    // Find the empty cell with the fewest candidates, or just the first.
+    int best = -1;
+    int best_count = 10;
+    uint16_t best_mask = 0;
+    for (int i = 0; i < 81; i++)
+    {
+        if (s->cells[i])
+        {
+            continue;
+        }
+
+        int row = cell_row[i], col = cell_col[i], box = cell_box[i];
+        uint16_t mask = ALL_DIGITS & ~(s->row[row] | s->col[col] | s->box[box]);
+        int count = __builtin_popcount(mask);
+        if (count < best_count)
+        {
+            best = i;
+            best_count = count;
+            best_mask = mask;
+
+            // A dead end, or a forced move, can't be bettered.
+            if (count <= 1 || s->config.branching == BRANCH_FIRST)
+            {
+                break;
+            }
+        }
+    }
+
+    // No empty cells, so the board is solved.
+    if (best < 0)
+    {
+        if (s->count++ == 0 && s->solution)
+        {
+            memcpy(s->solution, s->cells, sizeof(s->cells));
+        }
+        outcome = NODE_SOLVED;
+        goto undo;
+    }
+
+    // Reuse the count for this board if it's known and covers what's wanted.
+    // Only boards with a real choice to make are kept, forced moves being
+    // cheaper to follow than to look up.
+    bool cached = s->table && s->empty >= TABLE_MIN_EMPTY &&
+                  (s->count > 0 || !s->solution);
+    int before = s->count;
+    if (cached)
+    {
+        int count;
+        bool exact;
+        if (table_probe(s->table, s->hash, &count, &exact) &&
+            (exact || count >= s->limit - s->count))
+        {
+            int wanted = s->limit - s->count;
+            s->count += count < wanted ? count : wanted;
+            s->hits++;
+            outcome = NODE_CACHED;
+            goto undo;
+        }
+    }
+
+    // Failing a forced move, a digit with fewer places left in some unit than
+    // the cell has candidates may be placed instead.
+    uint8_t places[9];
+    int digit, choices = 0;
+    if (s->config.branching == BRANCH_UNITS && best_count > 2 &&
+        (choices = unit_places(s, places, &digit)) < best_count)
+    {
+        for (int k = 0; k < choices && s->count < s->limit; k++)
+        {
+            place(s, places[k], digit);
+            s->cell = places[k];
+            s->digit = digit;
+            outcome = NODE_BRANCH;
+            search(s);
+            unplace(s, places[k], digit);
+        }
+    }
+    else
+    {
+        // Start from a random digit if shuffling, otherwise from 1.
+        int first = s->rng ? next_random(s->rng) % 9 : 0;
+
+        for (int k = 0; k < 9 && s->count < s->limit; k++)
+        {
+            int d = (first + k) % 9;
+            if (!(best_mask & 1 << d))
+            {
+                continue;
+            }
+
+            place(s, best, d + 1);
+            s->cell = best;
+            s->digit = d + 1;
+            outcome = NODE_BRANCH;
+            search(s);
+            unplace(s, best, d + 1);
+        }
+    }
+
+    // Remember the count, which is only exact if the limit wasn't reached.
+    if (cached)
+    {
+        table_store(s->table, s->hash, s->count - before, s->count < s->limit);
+    }
+
+undo:
+    while (filled > 0)
+    {
+        int i = forced[--filled];
+        unplace(s, i, s->cells[i]);
+    }
+    if (node >= 0)
+    {
+        trace_exit(s, node, outcome);
+    }
+    else if (s->trace)
+    {
+        s->depth--;
+    }
+}
+
+/*
+ * Places every naked single of s, and every hidden single too if propagating
+ * further, until there are no more, noting the cells filled in forced and
+ * their number in *filled. Returns false iff a contradiction is found.
+ */
+static bool propagate(struct search *s, uint8_t forced[81], int *filled)
+{
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+
+        // A cell with one candidate must take it.
+        for (int i = 0; i < 81; i++)
+        {
+            if (s->cells[i])
+            {
+                continue;
+            }
+            uint16_t mask = ALL_DIGITS & ~(s->row[cell_row[i]] |
+                                           s->col[cell_col[i]] |
+                                           s->box[cell_box[i]]);
+            if (mask == 0)
+            {
+                return false;
+            }
+            if ((mask & (mask - 1)) == 0)
+            {
+                place(s, i, __builtin_ctz(mask) + 1);
+                forced[(*filled)++] = i;
+                progress = true;
+            }
+        }
+        if (progress || s->config.propagation < 2)
+        {
+            continue;
+        }
+
+        // A digit with one place left in a unit must go there.
+        for (int u = 0; u < 27; u++)
+        {
+            const uint8_t *unit = unit_cells[u];
+            uint16_t used = 0, once = 0, twice = 0;
+            for (int j = 0; j < 9; j++)
+            {
+                int i = unit[j];
+                uint16_t mask = s->cells[i] ? 0 :
+                                ALL_DIGITS & ~(s->row[cell_row[i]] |
+                                               s->col[cell_col[i]] |
+                                               s->box[cell_box[i]]);
+                used |= s->cells[i] ? 1 << (s->cells[i] - 1) : 0;
+                twice |= once & mask;
+                once |= mask;
+            }
+            if ((used | once) != ALL_DIGITS)
+            {
+                return false;
+            }
+            uint16_t single = once & ~twice;
+            for (int j = 0; j < 9 && single; j++)
+            {
+                int i = unit[j];
+                if (s->cells[i])
+                {
+                    continue;
+                }
+                uint16_t mask = single & ~(s->row[cell_row[i]] |
+                                           s->col[cell_col[i]] |
+                                           s->box[cell_box[i]]);
+                if (mask)
+                {
+                    // Two digits needing the same cell is a contradiction.
+                    if (mask & (mask - 1))
+                    {
+                        return false;
+                    }
+                    place(s, i, __builtin_ctz(mask) + 1);
+                    forced[(*filled)++] = i;
+                    single &= ~mask;
+                    progress = true;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Finds the digit with the fewest places left in any unit of s, storing it in
+ * *digit and its places in cells. Returns the number of places.
+ */
+static int unit_places(const struct search *s, uint8_t cells[9], int *digit)
+{
+    int best = 10, best_unit = 0;
+    for (int u = 0; u < 27; u++)
+    {
+        // Count each digit's places in the unit.
+        int count[9] = {0};
+        for (int j = 0; j < 9; j++)
+        {
+            int i = unit_cells[u][j];
+            if (s->cells[i])
+            {
+                continue;
+            }
+            uint16_t mask = ALL_DIGITS & ~(s->row[cell_row[i]] |
+                                           s->col[cell_col[i]] |
+                                           s->box[cell_box[i]]);
+            for (; mask; mask &= mask - 1)
+            {
+                count[__builtin_ctz(mask)]++;
+            }
+        }
+        for (int d = 0; d < 9; d++)
+        {
+            if (count[d] && count[d] < best)
+            {
+                best = count[d];
+                best_unit = u;
+                *digit = d + 1;
+            }
+        }
+    }
+    if (best == 10)
+    {
+        return best;
+    }
+
+    int n = 0;
+    uint16_t bit = 1 << (*digit - 1);
+    for (int j = 0; j < 9; j++)
+    {
+        int i = unit_cells[best_unit][j];
+        if (!s->cells[i] && !((s->row[cell_row[i]] | s->col[cell_col[i]] |
+                               s->box[cell_box[i]]) & bit))
+        {
+            cells[n++] = i;
+        }
+    }
+    return n;
+}
+
+/*
+ * Puts digit d in empty cell i of s.
+ */
+static inline void place(struct search *s, int i, int d)
+{
+    uint16_t bit = 1 << (d - 1);
+    s->cells[i] = d;
+    s->row[cell_row[i]] |= bit;
+    s->col[cell_col[i]] |= bit;
+    s->box[cell_box[i]] |= bit;
+    s->hash ^= zobrist(i, d);
+    s->empty--;
+}
+
+/*
+ * Takes digit d back out of cell i of s.
+ */
+static inline void unplace(struct search *s, int i, int d)
+{
+    uint16_t bit = 1 << (d - 1);
+    s->cells[i] = 0;
+    s->row[cell_row[i]] &= ~bit;
+    s->col[cell_col[i]] &= ~bit;
+    s->box[cell_box[i]] &= ~bit;
+    s->hash ^= zobrist(i, d);
+    s->empty++;
+}
+
+/*
+ * Records entering a node of s's search, returning its index in the trace, or
+ * -1 if the trace is full.
+ */
+static int trace_enter(struct search *s)
+{
+    struct trace *t = s->trace;
+    int depth = s->depth++;
+    if (t->count == t->size)
+    {
+        t->dropped++;
+        return -1;
+    }
+
+    struct trace_node *n = &t->nodes[t->count];
+    n->depth = depth < 255 ? depth : 255;
+    n->cell = s->cell;
+    n->digit = s->digit;
+    n->outcome = NODE_DEAD;
+    n->ns = now_ns();
+    return t->count++;
+}
+
+/*
+ * Records leaving node of s's search with outcome, the node's time then being
+ * that spent in it and all below it.
+ */
+static void trace_exit(struct search *s, int node, int outcome)
+{
+    struct trace_node *n = &s->trace->nodes[node];
+    n->outcome = outcome;
+    n->ns = now_ns() - n->ns;
+    s->depth--;
+}
+
+/*
+ * Returns the time in nanoseconds from an arbitrary start.
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
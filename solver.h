@@ -0,0 +1,113 @@
+/**
+ * solver.h
+ *
+ * A fast, reentrant bitmask solver used for counting solutions and for
+ * generating new puzzles.
+ */
+
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "board.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Statistics about a search.
+struct solve_stats
+{
+    // Number of nodes (boards) visited.
+    uint64_t nodes;
+
+    // Number of those answered from a transposition table.
+    uint64_t hits;
+};
+
+// How the search picks where to branch: the first empty cell, the empty cell
+// with fewest candidates, or that or the digit with fewest places in a unit.
+enum branching { BRANCH_FIRST, BRANCH_FEWEST, BRANCH_UNITS };
+
+// Whether the search uses a transposition table as well.
+enum engine { ENGINE_SEARCH, ENGINE_TABLE };
+
+// Most propagation: 1 fills naked singles before branching, 2 hidden singles
+// too.
+#define PROPAGATE_MAX 2
+
+// Settings for the search, one byte each.
+struct solver_config
+{
+    uint8_t branching, propagation, engine;
+};
+
+// Settings used unless others are given.
+extern const struct solver_config solver_defaults;
+
+// Names of each branching and engine, for display.
+extern const char *branching_names[];
+extern const char *engine_names[];
+
+// How a node of a search ended: solved, at a dead end, answered from a
+// table, or having branched.
+enum outcome { NODE_SOLVED, NODE_DEAD, NODE_CACHED, NODE_BRANCH };
+
+// Cell given as the move into the root of a search tree.
+#define TRACE_ROOT 255
+
+// A node of a recorded search tree: its depth, the move leading to it, how it
+// ended and the time (in nanoseconds) spent in it and below it. While the
+// node is open, ns holds the time it was entered.
+struct trace_node
+{
+    uint8_t depth, cell, digit, outcome;
+    uint64_t ns;
+};
+
+// A recorded search tree, its nodes in the order visited: the buffer and its
+// size (in nodes), the nodes recorded, and the nodes not for lack of space.
+struct trace
+{
+    struct trace_node *nodes;
+    int size, count;
+    uint64_t dropped;
+};
+
+// Counts solutions of board up to limit, storing the first one found in
+// solution (which may be NULL).
+int count_solutions(const uint8_t board[81], int limit, uint8_t solution[81]);
+
+// As count_solutions, also filling in stats.
+int count_solutions_stats(const uint8_t board[81], int limit,
+                          uint8_t solution[81], struct solve_stats *stats);
+
+// As count_solutions_stats without finding a solution, reusing and adding to
+// the counts of partial boards in table (which may be shared by threads).
+int count_solutions_table(const uint8_t board[81], int limit,
+                          struct table *table, struct solve_stats *stats);
+
+// As count_solutions_stats, searching as config says, with table (which may be
+// NULL) for ENGINE_TABLE.
+int count_solutions_config(const uint8_t board[81], int limit,
+                           uint8_t solution[81],
+                           const struct solver_config *config,
+                           struct table *table, struct solve_stats *stats);
+
+// As count_solutions_config, also recording the search tree in trace.
+int count_solutions_trace(const uint8_t board[81], int limit,
+                          uint8_t solution[81],
+                          const struct solver_config *config,
+                          struct table *table, struct trace *trace,
+                          struct solve_stats *stats);
+
+// Returns true iff config holds settings the solver knows.
+bool solver_config_valid(const struct solver_config *config);
+
+// Fills grid with a random complete solution derived from *rng.
+void random_grid(uint32_t *rng, uint8_t grid[81]);
+
+// Small deterministic PRNG so that seeded results match on every platform.
+uint32_t next_random(uint32_t *rng);
+uint32_t seed_random(uint32_t seed);
+
+#endif
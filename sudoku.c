@@ -13,15 +13,41 @@
  */
 
 #include "sudoku.h"
-
+#include "alloc.h"
+#include "autotune.h"
+#include "batch.h"
+#include "bench.h"
+#include "board.h"
+#include "cache.h"
+#include "distribute.h"
+#include "enumerate.h"
+#include "generate.h"
+#include "index.h"
+#include "ingest.h"
+#include "logic.h"
+#include "metrics.h"
+#include "pack.h"
+#include "pattern.h"
+#include "reorder.h"
+#include "serve.h"
+#include "solver.h"
+#include "tournament.h"
+#include "trace.h"
+#include "verify.h"
+
+#include <assert.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <ncurses.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 // Macro for processing control characters.
 #define CTRL(x) ((x) & ~0140)
@@ -29,16 +55,19 @@
 // Alternative backspace.
 #define ALT_KEY_BACKSPACE 127
 
-// Size of each int (in bytes) in *.bin files.
-#define INTSIZE 4
+// Time (in ms) to wait for the rest of an escape sequence.
+#define ESCAPE_MS 25
+
+// Boards whose completion (or lack of one) is kept for hints.
+#define COMPLETIONS 64
 
 // Stack for undo/redo feature.
 typedef struct stack
 {
     // The board location.
-    int y, x;
+    uint8_t cell;
     // The number replaced.
-    int replaced;
+    uint8_t replaced;
     // Pointer to next node in stack.
     struct stack *next;
 }
@@ -46,7 +75,58 @@ stack;
 
 // Various states that the board might be in, used to display messages.
 enum state { BOARD_OK, INVALID_PLACEMENT, INVALID_BOARD, WON, CHECK, BAD_CHECK,
-             HINT, FIX_HINT };
+             HINT, FIX_HINT, SWITCHED, EDIT_UNIQUE, EDIT_MANY, EDIT_NONE,
+             EDIT_REPEAT, EDIT_STUCK, SAVED, SAVE_FAILED, SWAP_FAILED };
+
+// State of a single game, kept within a few cache lines.
+struct session
+{
+    // The game's current board, with the starting numbers flagged as given,
+    // and the board as loaded.
+    uint8_t cells[81];
+    uint8_t puzzle[81];
+
+    // The board's solution, valid iff solved.
+    uint8_t solution[81];
+    bool solved;
+
+    // Steps solving the board logically, used for hints, and the technique
+    // of the last hint given.
+    uint16_t plan[81];
+    uint8_t steps;
+    enum technique hint;
+
+    // The cursor's current location between (0,0) and (8,8).
+    uint8_t y, x;
+
+    // Switch for showing timer.
+    bool timer_showing;
+
+    // Whether the board is being edited, and whether it was made in the
+    // editor (and so is numbered within the custom level).
+    bool editing, custom;
+
+    // Solutions of the board being edited, counted as far as two.
+    uint8_t solutions;
+
+    // The current state of the board used to display a message.
+    enum state board_state;
+
+    // The board's number, or seed if the level is generated.
+    int number;
+
+    // Times for start and end of game, and when it was last left for another.
+    time_t start, end, paused;
+
+    // Stacks for undo/redo feature.
+    stack *undo, *redo;
+
+    // Arena holding the nodes of the stacks, and popped nodes free for reuse,
+    // both emptied when the game restarts.
+    struct arena history;
+    stack *spare;
+}
+__attribute__((aligned(64)));
 
 // Wrapper for game's globals.
 struct
@@ -54,46 +134,131 @@ struct
     // The current level.
     char *level;
 
-    // The board's number.
-    int number;
+    // Whether boards are generated rather than loaded and, if so, the most
+    // givens to leave.
+    bool generated;
+    int clues;
 
     // The board's top-left coordinates.
     int top, left;
 
-    // The cursor's current location between (0,0) and (8,8).
-    int y, x;
+    // The current game, and the games kept in memory (the current one first,
+    // the rest most recently played first).
+    struct session *s;
+    struct session *open[SESSIONS];
+    int games;
+
+    // Games spilled to the journal, by their records' offsets, most recently
+    // played first, and the journal's file descriptor (-1 if there's none)
+    // and size.
+    off_t cold[COLD_GAMES];
+    int cold_games;
+    int journal;
+    off_t journal_size;
+
+    // File to export metrics to, or NULL.
+    const char *metrics;
+
+    // Tournament joined, or NULL, the number of the board it's playing, when
+    // that game was first started (restarting it doesn't reset the clock) and
+    // wrong numbers entered in it.
+    const char *tournament;
+    int tournament_number;
+    time_t tournament_start;
+    int mistakes;
+
+    // Number of full redraws asked for with ctrl-L.
+    int redraws;
+}
+g;
 
-    // The game's current board.
-    int board[9][9];
+// Storage for the games kept in memory.
+static struct session sessions[SESSIONS];
 
-    // The game's starting board.
-    int start_board[9][9];
+// Settings for counting solutions while editing, and for completing the
+// player's board for a hint. Filling in hidden singles finds a board with no
+// solution at once where plain search can take seconds.
+static const struct solver_config edit_config = { BRANCH_FEWEST, 2,
+                                                  ENGINE_SEARCH };
 
-    // A flag for solving the puzzle and a board for storing the solution.
-    bool solved;
-    int solved_board[9][9];
+// Completions of the player's boards found for hints, each in the slot its
+// hash picks, so asking again from the same board doesn't search. Only this
+// game's boards go here, never the solution cache shared with other players.
+static struct
+{
+    uint64_t keys[COMPLETIONS];
+    uint8_t boards[COMPLETIONS][81], solutions[COMPLETIONS][81];
+    bool solvable[COMPLETIONS];
+}
+completions;
 
-    // Stacks for undo/redo feature.
-    stack *undo, *redo;
+// Everything the render thread needs to draw a frame.
+struct snapshot
+{
+    // A copy of the current game.
+    struct session s;
 
-    // Times for start and end of game.
-    time_t start, end;
+    // Units (one bit per unit) in which a number is repeated.
+    uint32_t invalid;
 
-    // Switch for showing timer.
-    bool timer_showing;
+    // Empty cells left without a candidate, shown while editing.
+    bool dead[81];
 
-    // The current state of the board used to display a message.
-    enum state board_state;
+    // Number of full redraws requested, e.g. with ctrl-L.
+    int redraws;
+
+    // Number of games open.
+    int games;
+};
+
+// Wrapper for the render thread's globals. The input thread publishes
+// snapshots into pending; the render thread copies the latest into frame and
+// draws only from that, so only the render thread ever touches the screen.
+static struct
+{
+    // Guards pending, dirty and stopping, signalled when they change.
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    pthread_t thread;
+    struct snapshot pending;
+    bool dirty, stopping;
+
+    // The snapshot being drawn, and number of full redraws done.
+    struct snapshot frame;
+    int redraws;
 }
-g;
+r = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// Set by the SIGWINCH handler, cleared by the render thread on redrawing.
+static volatile sig_atomic_t resized;
+
+// Stages of starting up, in the order they end.
+enum stage { STAGE_ARGUMENTS, STAGE_GENERATOR, STAGE_MEMORY, STAGE_NCURSES,
+             STAGE_BOARD, STAGE_FIRST_FRAME, STAGE_RENDER, STAGE_FILES,
+             STAGE_SOLVED, STAGE_PLANNED, STAGES };
+
+// Names of the stages, for --startup-report.
+static const char *stage_names[STAGES] = {
+    "arguments", "generator", "histories", "ncurses", "board loaded",
+    "first frame", "render thread", "journal and cache", "puzzle solved",
+    "hints planned"
+};
+
+// Whether to report how long starting up took, when main started and when
+// each stage ended (0 until it has).
+static struct
+{
+    bool report;
+    double start, ended[STAGES];
+}
+boot;
 
 // Function prototypes.
 
 // Functions for determining whether the board is in a valid state or solved.
-bool valid_placement(int y, int x);
-bool valid_row(int row);
-bool valid_column(int column);
-bool valid_box(int box);
+bool valid_placement(int cell);
+bool valid_unit(int unit);
 bool valid_board(void);
 bool is_won(void);
 
@@ -101,13 +266,25 @@ bool is_won(void);
 // functions for hint and check features.
 void backtracking(void);
 bool check(void);
+bool complete_board(void);
 bool get_hint(void);
 
+// Functions for reading keys, publishing the game's state and drawing it on
+// a separate thread at most once per frame.
+int read_key(int timeout);
+int read_byte(int timeout);
+void publish(void);
+bool render_start(void);
+void render_stop(void);
+void *render(void *arg);
+void draw_frame(void);
+
 // Functions for drawing permanent features in the window.
 void draw_borders(void);
 void draw_logo(void);
 void draw_grid(void);
 void draw_numbers(void);
+void draw_cell(int cell);
 void show_cursor(void);
 void redraw_all(void);
 
@@ -120,62 +297,181 @@ void hide_timer(void);
 
 // Functions for stack operations, used for undo/redo feature.
 void pop(stack **ptr);
-void push(stack **ptr, int y, int x, int replaced);
+void push(stack **ptr, int cell, int replaced);
 void clear_stack(stack **ptr);
 
 // Functions for starting/ending ncurses, loading and (re)starting games and
 // changing window size.
 bool startup(void);
 bool load_board(void);
-bool restart_game(void);
+bool new_game(void);
+void prepare_game(void);
+void restart_game(void);
 void handle_signal(int signum);
 
+// Functions for showing the first frame as soon as possible and timing how
+// long that took.
+void show_first_frame(void);
+void mark(enum stage stage);
+void startup_report(void);
+
+// Functions for the editor: starting it, counting the solutions of the board
+// as it's edited and saving it to play.
+void start_editor(void);
+void edit_count(int cell, int replaced);
+bool save_edit(void);
+
+// Functions for keeping several games open and switching between them.
+void open_game(void);
+void switch_game(void);
+void leave_game(void);
+void enter_game(void);
+bool spill(struct session *s);
+bool unspill(off_t offset, struct session *s);
+void reclaim(void);
+
+// Functions for taking part in a tournament: whether its game is the one
+// being played, publishing progress in it and showing the standings.
+bool competing(void);
+void report_progress(void);
+void draw_scoreboard(void);
+
 
 int main(int argc, char *argv[])
 {
+    boot.start = metrics_now();
+
+    // Tools other than the game have their own usage.
+    static const struct
+    {
+        const char *name;
+        int (*main)(int argc, char *argv[]);
+    }
+    tools[] = {
+        { "autotune", autotune_main },
+        { "batch", batch_main },
+        { "bench", bench_main },
+        { "cache", cache_main },
+        { "distribute", distribute_main },
+        { "enumerate", enumerate_main },
+        { "worker", worker_main },
+        { "index", index_main },
+        { "ingest", ingest_main },
+        { "pattern", pattern_main },
+        { "reorder", reorder_main },
+        { "serve", serve_main },
+        { "loadtest", loadtest_main },
+        { "tournament", tournament_main },
+        { "trace", trace_main },
+        { "verify", verify_main },
+    };
+    for (int i = 0; argc >= 2 && i < sizeof(tools) / sizeof(tools[0]); i++)
+    {
+        if (strcmp(argv[1], tools[i].name) == 0)
+        {
+            return tools[i].main(argc - 1, argv + 1);
+        }
+    }
+
+    // Take out --startup-report, wherever it is.
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--startup-report") == 0)
+        {
+            boot.report = true;
+            memmove(&argv[i], &argv[i + 1], (argc - i) * sizeof(*argv));
+            argc--;
+            i--;
+        }
+    }
+
     // Check usage.
-    const char *usage = "Usage: sudoku n00b|l33t [#]\n";
-    if (argc != 2 && argc != 3)
+    const char *usage = "Usage: sudoku n00b|l33t|custom [#] "
+                        "[--startup-report]\n"
+                        "       sudoku gen [n00b|l33t] [#] "
+                        "[--startup-report]\n";
+    if (argc < 2 || argc > 4)
     {
         fprintf(stderr, usage);
         return 1;
     }
 
     // Ensure that level is valid.
+    g.s = g.open[0] = &sessions[0];
+    g.games = 1;
+    int arg = 2;
     if (strcmp(argv[1], "debug") == 0)
         g.level = "debug";
     else if (strcmp(argv[1], "n00b") == 0)
         g.level = "n00b";
     else if (strcmp(argv[1], "l33t") == 0)
         g.level = "l33t";
+    else if (strcmp(argv[1], CUSTOM_LEVEL) == 0)
+        g.level = CUSTOM_LEVEL;
+    else if (strcmp(argv[1], "gen") == 0)
+    {
+        // Generated boards default to n00b difficulty.
+        g.level = "gen";
+        g.generated = true;
+        g.clues = GEN_CLUES_N00B;
+        if (argc > 2 && strcmp(argv[2], "n00b") == 0)
+            arg++;
+        else if (argc > 2 && strcmp(argv[2], "l33t") == 0)
+        {
+            g.clues = GEN_CLUES_L33T;
+            arg++;
+        }
+    }
     else
     {
         fprintf(stderr, usage);
         return 2;
     }
 
-    // n00b and l33t levels have 1024 boards; debug level has 9.
-    int max = (strcmp(g.level, "debug") == 0) ? 9 : 1024;
+    // Only generated levels take a difficulty.
+    if (argc > arg + 1)
+    {
+        fprintf(stderr, usage);
+        return 1;
+    }
+
+    // n00b and l33t levels have 1024 boards; debug level has 9; the custom
+    // level as many as have been made in the editor; generated boards are
+    // numbered by their seed.
+    int max = g.generated ? RAND_MAX :
+              (strcmp(g.level, "debug") == 0) ? 9 : 1024;
+    if (strcmp(g.level, CUSTOM_LEVEL) == 0)
+    {
+        char filename[strlen(CUSTOM_LEVEL) + 5];
+        sprintf(filename, "%s.bin", CUSTOM_LEVEL);
+        max = pack_count(filename);
+        if (max < 1)
+        {
+            fprintf(stderr, "No custom boards yet! Press 'e' in a game to "
+                            "make one.\n");
+            return 4;
+        }
+    }
 
-    if (argc == 3)
+    if (argc > arg)
     {
         // Ensure n is integral.
         char c;
-        if (sscanf(argv[2], " %d %c", &g.number, &c) != 1)
+        if (sscanf(argv[arg], " %d %c", &g.s->number, &c) != 1)
         {
             fprintf(stderr, usage);
             return 3;
         }
 
         // Ensure n is in [1, max].
-        if (g.number < 1 || g.number > max)
+        if (g.s->number < 1 || g.s->number > max)
         {
             fprintf(stderr, "That board # does not exist!\n");
             return 4;
         }
 
         // Seed PRNG with # so that we get same sequence of boards.
-        srand(g.number);
+        srand(g.s->number);
     }
     else
     {
@@ -183,8 +479,70 @@ int main(int argc, char *argv[])
         srand(time(NULL));
 
         // Choose a random n in [1, max].
-        g.number = rand() % max + 1;
+        g.s->number = rand() % max + 1;
+    }
+
+    // Join a tournament if asked to, where everyone plays this board.
+    g.tournament = getenv(TOURNAMENT_ENV);
+    if (g.tournament)
+    {
+        char puzzle[TOURNAMENT_PUZZLE], playing[TOURNAMENT_PUZZLE];
+        snprintf(puzzle, sizeof(puzzle), "%s%s #%d", g.level, !g.generated ?
+                 "" : g.clues == GEN_CLUES_L33T ? " l33t" : " n00b",
+                 g.s->number);
+        const char *player = getenv(PLAYER_ENV);
+        if (!player)
+            player = getenv("USER");
+        if (!player)
+            player = "player";
+
+        g.tournament_number = g.s->number;
+        switch (tournament_join(g.tournament, player, puzzle, playing))
+        {
+            case 0:
+                break;
+
+            case 1:
+                fprintf(stderr, "Tournament names are letters, digits, '-' "
+                                "and '_'!\n");
+                return 8;
+
+            case 3:
+                fprintf(stderr, "Tournament %s is playing %s!\n",
+                        g.tournament, playing);
+                return 8;
+
+            case 4:
+                fprintf(stderr, "Tournament %s is full!\n", g.tournament);
+                return 8;
+
+            default:
+                fprintf(stderr, "Could not join tournament %s!\n",
+                        g.tournament);
+                return 8;
+        }
+    }
+
+    mark(STAGE_ARGUMENTS);
+
+    // Keep the following generated boards ready in the background.
+    if (g.generated && !generator_start(g.clues, g.s->number))
+    {
+        fprintf(stderr, "Error starting puzzle generator!\n");
+        return 5;
+    }
+    mark(STAGE_GENERATOR);
+
+    // Set aside the memory for the games' histories.
+    for (int i = 0; i < SESSIONS; i++)
+    {
+        if (!arena_init(&sessions[i].history, HISTORY_MOVES * sizeof(stack)))
+        {
+            fprintf(stderr, "Out of memory!\n");
+            return 5;
+        }
     }
+    mark(STAGE_MEMORY);
 
     // Start up ncurses.
     if (!startup())
@@ -192,73 +550,139 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Error starting up ncurses!\n");
         return 5;
     }
+    mark(STAGE_NCURSES);
 
     // Register handler for SIGWINCH (SIGnal WINdow CHanged).
     signal(SIGWINCH, (void (*)(int)) handle_signal);
 
-    // Start the first game.
-    if (!restart_game())
+    // Export metrics if asked to.
+    g.metrics = getenv(METRICS_ENV);
+
+    // Start the first game, showing its puzzle at once.
+    if (!new_game())
     {
         endwin();
         fprintf(stderr, "Could not load board from disk!\n");
         return 6;
     }
-    redraw_all();
+    mark(STAGE_BOARD);
+    publish();
+    show_first_frame();
+    mark(STAGE_FIRST_FRAME);
+
+    // Hand the screen over to the render thread.
+    if (!render_start())
+    {
+        endwin();
+        fprintf(stderr, "Could not start render thread!\n");
+        return 7;
+    }
+    mark(STAGE_RENDER);
+
+    // Games that don't fit in memory go to the journal, or are dropped if it
+    // can't be opened. It's this process's alone, unnamed so no other can
+    // open it and gone once closed.
+    g.journal = open(JOURNAL_DIR, O_RDWR | O_TMPFILE, 0600);
+    if (g.journal < 0)
+    {
+        char name[] = JOURNAL_DIR "/.sudoku.journal.XXXXXX";
+        g.journal = mkstemp(name);
+        if (g.journal >= 0)
+        {
+            unlink(name);
+        }
+    }
+
+    // Solutions are cached across runs, or always solved if that can't be.
+    cache_open(CACHE_FILE);
+    mark(STAGE_FILES);
+
+    // Only then solve the puzzle and plan its hints.
+    prepare_game();
+    publish();
+    report_progress();
+
+    // Nothing is allocated from here on.
+    uint64_t allocations = alloc_stats().calls;
 
     // Game loop.
     int ch;
     do
     {
-        // Refresh the screen.
-        refresh();
-
         // Get user's input and capitalise.
-        ch = getch();
+        ch = read_key(-1);
         ch = toupper(ch);
 
         switch (ch)
         {
-            // Start a new game.
+            // Start a new game, keeping the current one open.
             case 'N':
-                g.number = rand() % max + 1;
-                if (!restart_game())
+            {
+                // Generated boards follow on from the seed so far.
+                int number = g.generated ? g.s->number % max + 1 :
+                                           rand() % max + 1;
+                open_game();
+                g.s->number = number;
+                if (!new_game())
                 {
+                    render_stop();
                     endwin();
                     fprintf(stderr, "Could not load board from disk!\n");
                     return 6;
                 }
+                prepare_game();
+                break;
+            }
+
+            // Open an empty board to make a new puzzle.
+            case 'E':
+                start_editor();
+                break;
+
+            // Save the board being edited, if its solution is unique, and
+            // play it.
+            case 'P':
+                if (g.s->editing && g.s->solved)
+                {
+                    g.s->board_state = save_edit() ? SAVED : SAVE_FAILED;
+                }
+                break;
+
+            // Switch to the game played least recently.
+            case 'S':
+            case '\t':
+                switch_game();
                 break;
 
-            // Restart current game.
+            // Restart current game, or clear the board being edited.
             case 'R':
-                if (!restart_game())
+                restart_game();
+                if (g.s->editing)
                 {
-                    endwin();
-                    fprintf(stderr, "Could not load board from disk!\n");
-                    return 6;
+                    edit_count(-1, 0);
                 }
                 break;
 
             // Let user manually redraw screen with ctrl-L.
             case CTRL('l'):
-                redraw_all();
+                g.redraws++;
                 break;
 
             // Move the cursor with keypad.
             case KEY_LEFT:
-                g.x = (g.x + 8) % 9;
+                g.s->x = (g.s->x + 8) % 9;
                 break;
 
             case KEY_RIGHT:
-                g.x = (g.x + 10) % 9;
+                g.s->x = (g.s->x + 10) % 9;
                 break;
 
             case KEY_UP:
-                g.y = (g.y + 8) % 9;
+                g.s->y = (g.s->y + 8) % 9;
                 break;
 
             case KEY_DOWN:
-                g.y = (g.y + 10) % 9;
+                g.s->y = (g.s->y + 10) % 9;
                 break;
 
             // Enter a number.
@@ -271,42 +695,57 @@ int main(int argc, char *argv[])
             case '7':
             case '8':
             case '9':
-                // Don't allow changes to starting numbers, nor if won already.
-                if (g.board_state != WON && g.start_board[g.y][g.x] == 0)
+                // Don't allow changes to starting numbers, nor if won already,
+                // though every number is a starting one while editing.
+                if (g.s->board_state != WON &&
+                    (g.s->editing ||
+                     !(g.s->cells[CELL(g.s->y, g.s->x)] & CELL_GIVEN)))
                 {
-                    // Store the change for undo.
-                    push(&g.undo, g.y, g.x, g.board[g.y][g.x]);
-
-                    // Redo doesn't branch so must be cleared.
-                    clear_stack(&g.redo);
-
-                    // Print the number and update board.
-                    addch(ch);
-                    g.board[g.y][g.x] = ch - '0';
+                    int cell = CELL(g.s->y, g.s->x);
+
+                    // Redo doesn't branch so must be cleared, freeing its
+                    // nodes for the change stored for undo.
+                    clear_stack(&g.s->redo);
+                    push(&g.s->undo, cell, g.s->cells[cell]);
+
+                    // Update board.
+                    int replaced = g.s->cells[cell];
+                    g.s->cells[cell] = ch - '0';
+
+                    // Count wrong numbers in a tournament's game: those
+                    // not in the solution, or clashing if it has none.
+                    if (competing() &&
+                        (g.s->solved ? DIGIT(g.s->solution[cell]) != ch - '0' :
+                         !valid_placement(cell)))
+                    {
+                        g.mistakes++;
+                    }
 
                     // Update the state of the board.
-                    if (!valid_placement(g.y, g.x))
+                    if (g.s->editing)
+                    {
+                        g.s->cells[cell] |= CELL_GIVEN;
+                        edit_count(cell, replaced);
+                    }
+                    else if (!valid_placement(cell))
                     {
-                        g.board_state = INVALID_PLACEMENT;
+                        g.s->board_state = INVALID_PLACEMENT;
                     }
                     else if (!valid_board())
                     {
-                        g.board_state = INVALID_BOARD;
+                        g.s->board_state = INVALID_BOARD;
                     }
                     else if (is_won())
                     {
-                        g.board_state = WON;
+                        g.s->board_state = WON;
+                        metrics_add(M_GAMES_WON, 1);
                         // Stop the timer.
-                        time(&g.end);
+                        time(&g.s->end);
                     }
                     else
                     {
-                        g.board_state = BOARD_OK;
+                        g.s->board_state = BOARD_OK;
                     }
-
-                    // Change banner and colour numbers.
-                    update_banner();
-                    draw_numbers();
                 }
                 break;
 
@@ -316,32 +755,36 @@ int main(int argc, char *argv[])
             case KEY_BACKSPACE:
             case ALT_KEY_BACKSPACE:
             case '.':
-                // Don't allow changes to starting numbers, nor if won already.
-                if (g.board_state != WON && g.start_board[g.y][g.x] == 0)
+                // Don't allow changes to starting numbers, nor if won already,
+                // though every number is a starting one while editing.
+                if (g.s->board_state != WON &&
+                    (g.s->editing ||
+                     !(g.s->cells[CELL(g.s->y, g.s->x)] & CELL_GIVEN)))
                 {
-                    // Store the change for undo.
-                    push(&g.undo, g.y, g.x, g.board[g.y][g.x]);
+                    int cell = CELL(g.s->y, g.s->x);
 
-                    // Redo doesn't branch so must be cleared.
-                    clear_stack(&g.redo);
+                    // Redo doesn't branch so must be cleared, freeing its
+                    // nodes for the change stored for undo.
+                    clear_stack(&g.s->redo);
+                    push(&g.s->undo, cell, g.s->cells[cell]);
 
-                    // Print the 'empty' and update board.
-                    addch('.');
-                    g.board[g.y][g.x] = 0;
+                    // Update board.
+                    int replaced = g.s->cells[cell];
+                    g.s->cells[cell] = 0;
 
                     // Update the state of the board.
-                    if (!valid_board())
+                    if (g.s->editing)
+                    {
+                        edit_count(cell, replaced);
+                    }
+                    else if (!valid_board())
                     {
-                        g.board_state = INVALID_BOARD;
+                        g.s->board_state = INVALID_BOARD;
                     }
                     else
                     {
-                        g.board_state = BOARD_OK;
+                        g.s->board_state = BOARD_OK;
                     }
-
-                    // Change banner and colour numbers.
-                    update_banner();
-                    draw_numbers();
                 }
                 break;
 
@@ -349,224 +792,236 @@ int main(int argc, char *argv[])
             case 'U':
             case CTRL('Z'):
                 // Check puzzle is not won and there exist moves to undo.
-                if (g.board_state != WON && g.undo)
+                if (g.s->board_state != WON && g.s->undo)
                 {
-                    g.x = g.undo->x;
-                    g.y = g.undo->y;
+                    int cell = g.s->undo->cell;
+                    g.s->y = cell_row[cell];
+                    g.s->x = cell_col[cell];
 
-                    // Store the move in redo stack.
-                    push(&g.redo, g.y, g.x, g.board[g.y][g.x]);
-
-                    // Update the board and pop move from undo stack.
-                    g.board[g.y][g.x] = g.undo->replaced;
-                    pop(&g.undo);
+                    // Update the board and pop move from undo stack, then
+                    // store the move in redo stack in the node just freed.
+                    int replaced = g.s->cells[cell];
+                    g.s->cells[cell] = g.s->undo->replaced;
+                    pop(&g.s->undo);
+                    push(&g.s->redo, cell, replaced);
 
                     // Update the state of the board.
-                    if (!valid_board())
+                    if (g.s->editing)
+                    {
+                        edit_count(cell, replaced);
+                    }
+                    else if (!valid_board())
                     {
-                        g.board_state = INVALID_BOARD;
+                        g.s->board_state = INVALID_BOARD;
                     }
                     // If undoing to satisfy check, continue to display message.
-                    else if (g.board_state == BAD_CHECK && !check())
+                    else if (g.s->board_state == BAD_CHECK && !check())
                     {
-                        g.board_state = BAD_CHECK;
+                        g.s->board_state = BAD_CHECK;
                     }
                     else
                     {
-                        g.board_state = BOARD_OK;
+                        g.s->board_state = BOARD_OK;
                     }
-
-                    // Change banner and colour numbers.
-                    update_banner();
-                    draw_numbers();
                 }
                 break;
 
             // Redo changes to the board.
             case CTRL('r'):
                 // Check we have moves to redo.
-                if (g.redo)
+                if (g.s->redo)
                 {
-                    g.x = g.redo->x;
-                    g.y = g.redo->y;
-
-                    // Store the move in undo stack.
-                    push(&g.undo, g.y, g.x, g.board[g.y][g.x]);
+                    int cell = g.s->redo->cell;
+                    g.s->y = cell_row[cell];
+                    g.s->x = cell_col[cell];
 
-                    // Update board and pop move from redo stack.
-                    g.board[g.y][g.x] = g.redo->replaced;
-                    pop(&g.redo);
+                    // Update board and pop move from redo stack, then store
+                    // the move in undo stack in the node just freed.
+                    int replaced = g.s->cells[cell];
+                    g.s->cells[cell] = g.s->redo->replaced;
+                    pop(&g.s->redo);
+                    push(&g.s->undo, cell, replaced);
 
                     // Update the state of the board.
-                    if (!valid_placement(g.y, g.x))
+                    if (g.s->editing)
                     {
-                        g.board_state = INVALID_PLACEMENT;
+                        edit_count(cell, replaced);
+                    }
+                    else if (!valid_placement(cell))
+                    {
+                        g.s->board_state = INVALID_PLACEMENT;
                     }
                     else if (!valid_board())
                     {
-                        g.board_state = INVALID_BOARD;
+                        g.s->board_state = INVALID_BOARD;
                     }
                     else
                     {
-                        g.board_state = BOARD_OK;
+                        g.s->board_state = BOARD_OK;
                     }
-
-                    // Change banner and colour numbers.
-                    update_banner();
-                    draw_numbers();
                 }
                 break;
 
             // Show or hide the timer.
             case 'T':
                 // Just change the flag here.
-                g.timer_showing = 1 - g.timer_showing;
+                g.s->timer_showing = 1 - g.s->timer_showing;
                 break;
 
             // Check the cells filled so far are indeed correct.
             case 'C':
-                if (g.board_state != WON)
+                if (g.s->board_state != WON && !g.s->editing)
                 {
+                    metrics_add(M_CHECKS, 1);
+
                     // If correct, 'save' the board.
                     if (check())
                     {
                         // Prevent undo/redo.
-                        clear_stack(&g.undo);
-                        clear_stack(&g.redo);
+                        clear_stack(&g.s->undo);
+                        clear_stack(&g.s->redo);
 
                         // Treat filled squares as the starting puzzle to
                         // change colour and prevent alteration.
-                        memcpy(g.start_board, g.board, sizeof(g.board));
-
-                        g.board_state = CHECK;
+                        for (int i = 0; i < 81; i++)
+                        {
+                            if (g.s->cells[i])
+                            {
+                                g.s->cells[i] |= CELL_GIVEN;
+                            }
+                        }
 
-                        // Colour numbers.
-                        draw_numbers();
+                        g.s->board_state = CHECK;
                     }
                     // Else inform user of error.
                     else
                     {
-                        g.board_state = BAD_CHECK;
+                        g.s->board_state = BAD_CHECK;
                     }
-
-                    update_banner();
                 }
                 break;
 
             // Provide hint.
             case 'H':
-                if (g.board_state != WON)
+                if (g.s->board_state != WON && !g.s->editing)
                 {
+                    metrics_add(M_HINTS, 1);
+
                     // Request a hint.
                     if (get_hint())
                     {
                         // Update the state of the board.
                         if (is_won())
                         {
-                            g.board_state = WON;
+                            g.s->board_state = WON;
+                            metrics_add(M_GAMES_WON, 1);
                             // Stop the timer.
-                            time(&g.end);
+                            time(&g.s->end);
                         }
                         else
                         {
-                            g.board_state = HINT;
+                            g.s->board_state = HINT;
                         }
                     }
                     else
                     {
-                        // Correct the mistakes using undos.
-                        while (!check())
+                        // Undo mistakes until the board can be completed.
+                        while (g.s->undo && !check() && !complete_board())
                         {
-                            g.x = g.undo->x;
-                            g.y = g.undo->y;
-                            push(&g.redo, g.y, g.x, g.board[g.y][g.x]);
-                            g.board[g.y][g.x] = g.undo->replaced;
-                            pop(&g.undo);
+                            int cell = g.s->undo->cell;
+                            int replaced = g.s->cells[cell];
+                            g.s->y = cell_row[cell];
+                            g.s->x = cell_col[cell];
+                            g.s->cells[cell] = g.s->undo->replaced;
+                            pop(&g.s->undo);
+                            push(&g.s->redo, cell, replaced);
                         }
-                        g.board_state = FIX_HINT;
-                    }
 
-                    // Change banner and colour numbers.
-                    draw_numbers();
-                    update_banner();
+                        // Mistakes older than the history kept are removed
+                        // outright, still redoable.
+                        for (int cell = 0; cell < 81; cell++)
+                        {
+                            int n = DIGIT(g.s->cells[cell]);
+                            if (n && n != g.s->solution[cell])
+                            {
+                                g.s->y = cell_row[cell];
+                                g.s->x = cell_col[cell];
+                                push(&g.s->redo, cell, g.s->cells[cell]);
+                                g.s->cells[cell] = 0;
+                            }
+                        }
+                        g.s->board_state = FIX_HINT;
+                    }
                 }
                 break;
 
         }
 
-        // Restore the cursor and update the timer.
-        if (g.board_state != WON)
-        {
-            if (g.timer_showing)
-            {
-                show_timer(difftime(time(NULL), g.start));
-            }
-            else
-            {
-                hide_timer();
-            }
-            show_cursor();
-        }
-        else
-        {
-            if (g.timer_showing)
-            {
-                show_timer(difftime(g.end, g.start));
-            }
-            else
-            {
-                hide_timer();
-            }
-            // If game won hide cursor.
-            curs_set(0);
-        }
+        // Let the render thread show the changes, and other players too.
+        publish();
+        report_progress();
+
+        assert(alloc_stats().calls == allocations);
     }
     while (ch != 'Q');
 
-    // Shut down ncurses.
+    // Shut down rendering and ncurses.
+    render_stop();
     endwin();
 
-    // Clear undo and redo stacks.
-    clear_stack(&g.undo);
-    clear_stack(&g.redo);
+    // Keep the last progress on the scoreboard for the others.
+    tournament_leave();
+
+    // Stop generating boards.
+    generator_stop();
+
+    // Export final metrics.
+    if (g.metrics)
+    {
+        metrics_write(g.metrics);
+    }
+
+    // Free the games' histories and close (so remove) the journal.
+    for (int i = 0; i < SESSIONS; i++)
+    {
+        arena_destroy(&sessions[i].history);
+    }
+    if (g.journal >= 0)
+    {
+        close(g.journal);
+    }
+    cache_close();
 
     // Tidy up the screen (using ANSI escape sequences).
     printf("\033[2J");
     printf("\033[%d;%dH", 0, 0);
 
+    if (boot.report)
+    {
+        startup_report();
+    }
     return 0;
 }
 
 /*
- * Returns true iff the number the user placed row y and column x is a valid
- * placement, i.e. that particular number appears only once in the
- * corresponding row, column and box.
+ * Returns true iff the number the user placed in cell is a valid placement,
+ * i.e. that particular number appears only once in the corresponding row,
+ * column and box.
  */
-bool valid_placement(int y, int x)
+bool valid_placement(int cell)
 {
-    // Check the row and column containing (y,x).
-    for (int i = 0; i < 9; i++)
-    {
-        if (i != x && g.board[y][i] == g.board[y][x])
-        {
-            return false;
-        }
-        if (i != y && g.board[i][x] == g.board[y][x])
-        {
-            return false;
-        }
-    }
-
-    // Calculate the co-ordinates of the top left of box containing (y,x).
-    int box_y = y - (y % 3);
-    int box_x = x - (x % 3);
+    int n = DIGIT(g.s->cells[cell]);
+    const uint8_t units[3] = { ROW_UNIT(cell_row[cell]),
+                               COL_UNIT(cell_col[cell]),
+                               BOX_UNIT(cell_box[cell]) };
 
-    // Check the rows and columns of the box.
-    for (int i = box_y; i < 3; i++)
+    // Check the row, column and box containing cell.
+    for (int u = 0; u < 3; u++)
     {
-        for (int j = box_x; j < 3; j++)
+        for (int i = 0; i < 9; i++)
         {
-            if (i != y && j != x && g.board[i][j] == g.board[y][x])
+            int other = unit_cells[units[u]][i];
+            if (other != cell && DIGIT(g.s->cells[other]) == n)
             {
                 return false;
             }
@@ -577,105 +1032,84 @@ bool valid_placement(int y, int x)
 }
 
 /*
- * Returns true iff the given row is currently valid, i.e. each number occurs
- * once, or not at all, in the column.
+ * Returns true iff the given unit (row, column or box) is currently valid,
+ * i.e. each number occurs once, or not at all, in the unit.
  */
-bool valid_row(int row)
+bool valid_unit(int unit)
 {
-    // Array to count occurrences of numbers 1-9.
-    int counts[9] = {0};
+    // Mask of numbers 1-9 seen so far.
+    int seen = 0;
 
-    // Check each column of the row.
-    for (int col = 0; col < 9; col++)
+    // Check each cell of the unit.
+    for (int i = 0; i < 9; i++)
     {
-        if (g.board[row][col])
+        int n = DIGIT(g.s->cells[unit_cells[unit][i]]);
+        if (n)
         {
-            if (counts[g.board[row][col] - 1] == 1)
+            if (seen & 1 << n)
             {
                 // Oops, already seen this number once.
                 return false;
             }
-            else
-            {
-                counts[g.board[row][col] - 1]++;
-            }
+            seen |= 1 << n;
         }
     }
     return true;
 }
 
 /*
- * Returns true iff the given column is currently valid, i.e. each number
- * occurs once, or not at all, in the column.
+ * Returns true iff the whole board is currently valid, i.e. each number occurs
+ * at once, or not at all, in each row, column and box.
  */
-bool valid_column(int column)
+bool valid_board(void)
 {
-    // Array to count occurrences of numbers 1-9.
-    int counts[9] = {0};
-
-    // Check each row of the column.
-    for (int row = 0; row < 9; row++)
+    for (int unit = 0; unit < 27; unit++)
     {
-        if (g.board[row][column])
+        if (!valid_unit(unit))
         {
-            if (counts[g.board[row][column] - 1] == 1)
-            {
-                // Oops, already seen this number once.
-                return false;
-            }
-            else
-            {
-                counts[g.board[row][column] - 1]++;
-            }
+            return false;
         }
     }
     return true;
 }
 
 /*
- * Returns true iff the given box is currently valid, i.e. each number occurs
- * once, or not at all in the 3x3 box. Boxes are numbered 0-8, top-to-bottom
- * then left-to-right.
+ * Returns true iff the puzzle is solved.
  */
-bool valid_box(int box)
+bool is_won(void)
 {
-    // Array to count occurrences of numbers 1-9.
-    int counts[9] = {0};
+    return verify_grid(g.s->puzzle, g.s->cells).result == VERIFY_OK;
+}
 
-    // Check the rows and columns of the box.
-    for (int i = 0; i < 3; i++)
-    {
-        for (int j = 0; j < 3; j++)
-        {
-            // Calculate the rows and columns for the box.
-            int row = i + 3 * (box % 3);
-            int col = j + 3 * (box / 3);
-            if (g.board[row][col])
-            {
-                if (counts[g.board[row][col] - 1] == 1)
-                {
-                    // Oops, already seen this number once.
-                    return false;
-                }
-                else
-                {
-                    counts[g.board[row][col] - 1]++;
-                }
-            }
-        }
-    }
-    return true;
+/*
+ * Solves the puzzle by backtracking search, noting the solution, unless it's
+ * in the solution cache. The search uses the settings tuned for the level's
+ * pack, if its index has any. It looks for a second solution too, as batch
+ * and serve do, so a unique one is cached as such and found there next time.
+ */
+void backtracking(void)
+{
+    char filename[strlen(g.level) + 5];
+    sprintf(filename, "%s.idx", g.level);
+    struct solver_config config = solver_defaults;
+    index_config(filename, &config);
+
+    struct solve_stats stats;
+    g.s->solved = cache_solve(g.s->puzzle, 2, g.s->solution, &config, NULL,
+                              &stats) > 0;
 }
 
 /*
- * Returns true iff the whole board is currently valid, i.e. each number occurs
- * at once, or not at all, in each row, column and box.
+ * Returns true if the numbers currently on the board are correct according to
+ * the solution.
  */
-bool valid_board(void)
+bool check(void)
 {
-    for (int i = 0; i < 9; i++)
+    for (int i = 0; i < 81; i++)
     {
-        if (!(valid_row(i) && valid_column(i) && valid_box(i)))
+        // If a square contains a number but it does not match solution.
+        int n = DIGIT(g.s->cells[i]);
+        if (n && n != g.s->solution[i])
         {
             return false;
         }
@@ -684,166 +1118,333 @@ bool valid_board(void)
 }
 
 /*
- * Returns true iff the puzzle is solved.
+ * Solves the board as the player has it, keeping their numbers, and takes the
+ * completion found as the solution (and plans anew from it), for puzzles with
+ * more than one. Completions are kept in memory by the board's hash, so
+ * asking again from the same board doesn't search. Returns true iff there is
+ * a completion.
  */
-bool is_won(void)
+bool complete_board(void)
 {
-    // Check no unfilled locations.
-    for (int i = 0; i < 9; i++)
+    uint8_t board[81];
+    uint64_t key = 14695981039346656037ULL;
+    for (int i = 0; i < 81; i++)
     {
-        for (int j = 0; j < 9; j++)
-        {
-            if (g.board[i][j] == 0)
-            {
-                return false;
-            }
-        }
+        board[i] = DIGIT(g.s->cells[i]);
+        key = (key ^ board[i]) * 1099511628211ULL;
+    }
+
+    int slot = key % COMPLETIONS;
+    if (completions.keys[slot] != key ||
+        memcmp(completions.boards[slot], board, 81) != 0)
+    {
+        struct solve_stats stats;
+        completions.solvable[slot] = count_solutions_config(
+            g.s->cells, 1, completions.solutions[slot], &edit_config, NULL,
+            &stats) > 0;
+        completions.keys[slot] = key;
+        memcpy(completions.boards[slot], board, 81);
+    }
+    if (!completions.solvable[slot])
+    {
+        return false;
     }
-    // If the board is valid and has no unfilled locations, it is solved.
-    return valid_board();
+    for (int i = 0; i < 81; i++)
+    {
+        g.s->solution[i] = DIGIT(completions.solutions[slot][i]);
+    }
+    g.s->steps = logic_plan(g.s->cells, g.s->solution, g.s->plan);
+    return true;
 }
 
 /*
- * Recursively solves the puzzle in g.board using backtracking trial and error.
+ * Returns true iff a hint is provided. If the board currently has a mistake,
+ * i.e. disagrees with the solution and can't be completed otherwise, returns
+ * false. Otherwise returns true having filled in the cell of the first
+ * step of the board's plan not yet taken, or if there is none (say the plan
+ * couldn't be made), the first step of a plan made for the board as it is.
  */
-void backtracking(void)
+bool get_hint(void)
 {
-    // If the board is invalid we can go back.
-    if (!valid_board())
+    // If the board currently has an error, the hint feature will undo it,
+    // though numbers that fit another solution are kept.
+    if (!check() && !complete_board())
     {
-        return;
+        return false;
     }
-    // If the board is solved, note the solution.
-    else if (is_won())
+
+    // The first step not yet taken only relies on the givens and the steps
+    // before it, all now on the board, whatever order they were filled in.
+    uint16_t step = 0;
+    for (int i = 0; i < g.s->steps && !step; i++)
     {
-        // Use a flag to break out of the recursion.
-        g.solved = true;
+        if (!g.s->cells[STEP_CELL(g.s->plan[i])])
+        {
+            step = g.s->plan[i];
+        }
+    }
 
-        // Copy solution into memory for game's solved board.
-        memcpy(g.solved_board, g.board, sizeof(g.board));
+    // Otherwise plan from here.
+    if (!step)
+    {
+        uint16_t plan[81];
+        if (logic_plan(g.s->cells, g.s->solution, plan) == 0)
+        {
+            return true;
+        }
+        step = plan[0];
+    }
 
-        // Restore the starting unsolved state of the board.
-        memcpy(g.board, g.start_board, sizeof(g.start_board));
+    int cell = STEP_CELL(step);
+    g.s->cells[cell] = STEP_DIGIT(step);
+    g.s->hint = STEP_TECHNIQUE(step);
 
-        return;
-    }
+    // Prepare to move cursor to square.
+    g.s->y = cell_row[cell];
+    g.s->x = cell_col[cell];
+    return true;
+}
 
-    // Search for the first blank square.
-    int c_row = 0;
-    int c_col = 0;
+/*
+ * Returns the next key pressed, with the escape sequences for the arrow and
+ * delete keys decoded into ncurses' KEY_ codes, or ERR if there is no key
+ * within timeout ms (or ever, if timeout is negative). Keys are read straight
+ * from the terminal, so reading never waits on the render thread.
+ */
+int read_key(int timeout)
+{
+    int ch = read_byte(timeout);
+    if (ch != '\033')
+    {
+        return ch;
+    }
 
-    for (int row = 0; row < 9; row++)
+    // A lone escape, or one starting something unknown, is ignored.
+    ch = read_byte(ESCAPE_MS);
+    if (ch != '[' && ch != 'O')
     {
-        for (int col = 0; col < 9; col++)
-        {
-            if (g.board[row][col] == 0)
-            {
-                c_row = row;
-                c_col = col;
-            }
-        }
+        return ERR;
     }
 
-    // For this square, try all nine numbers as candidates.
-    for (int i = 1; i <= 9; i++)
+    ch = read_byte(ESCAPE_MS);
+    switch (ch)
     {
-        g.board[c_row][c_col] = i;
+        case 'A':
+            return KEY_UP;
 
-        // Test this candidate further.
-        backtracking();
+        case 'B':
+            return KEY_DOWN;
 
-        // If puzzle now solved we can exit the loop.
-        if (g.solved)
-        {
+        case 'C':
+            return KEY_RIGHT;
+
+        case 'D':
+            return KEY_LEFT;
+
+        case '3':
+            if (read_byte(ESCAPE_MS) == '~')
+            {
+                return KEY_DC;
+            }
             break;
-        }
     }
 
-    // If the puzzle is not solved, none of the candidates worked so we must
-    // reset that square to 0 and backtrack.
-    if (!g.solved)
+    // Skip the rest of any other sequence, up to its final character.
+    while (ch != ERR && (ch < 0x40 || ch > 0x7e))
     {
-        g.board[c_row][c_col] = 0;
+        ch = read_byte(ESCAPE_MS);
     }
+    return ERR;
 }
 
 /*
- * Returns true if the numbers currently on the board are correct according to
- * the solution.
+ * Returns the next byte of input, or ERR if there is none within timeout ms
+ * (or ever, if timeout is negative). The end of input is read as 'Q'.
  */
-bool check(void)
+int read_byte(int timeout)
 {
-    for (int row = 0; row < 9; row++)
+    static unsigned char buffer[64];
+    static int length, next;
+
+    if (next == length)
     {
-        for (int col = 0; col < 9; col++)
+        struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+        if (poll(&fd, 1, timeout) <= 0)
         {
-            // If a square contains a number but it does not match solution.
-            if (g.board[row][col] &&
-                g.board[row][col] != g.solved_board[row][col])
-            {
-                return false;
-            }
+            return ERR;
+        }
+
+        length = read(STDIN_FILENO, buffer, sizeof(buffer));
+        next = 0;
+        if (length <= 0)
+        {
+            length = 0;
+            return 'Q';
         }
     }
-    return true;
+    return buffer[next++];
 }
 
 /*
- * Returns true iff a hint is provided. If the board currently has a mistake
- * returns false. Otherwise returns true having randomly selected an empty
- * square from the board and filled it with using the solution.
+ * Publishes the current game for the render thread to draw.
  */
-bool get_hint(void)
+void publish(void)
 {
-    // If the board currently has an error, the hint feature will undo it.
-    if (!check())
+    // Note which units need highlighting, so drawing needn't validate.
+    uint32_t invalid = 0;
+    for (int unit = 0; unit < 27; unit++)
     {
-        return false;
+        if (!valid_unit(unit))
+        {
+            invalid |= 1 << unit;
+        }
     }
-    // Otherwise provide a hint.
-    else
+
+    pthread_mutex_lock(&r.lock);
+    for (int i = 0; i < 81; i++)
+    {
+        r.pending.dead[i] = g.s->editing && !g.s->cells[i] &&
+                            !board_candidates(g.s->cells, i);
+    }
+    r.pending.s = *g.s;
+    r.pending.invalid = invalid;
+    r.pending.redraws = g.redraws;
+    r.pending.games = g.games + g.cold_games;
+    r.dirty = true;
+    pthread_cond_signal(&r.changed);
+    pthread_mutex_unlock(&r.lock);
+}
+
+/*
+ * Starts the render thread, returning true iff successful.
+ */
+bool render_start(void)
+{
+    r.stopping = false;
+    return pthread_create(&r.thread, NULL, render, NULL) == 0;
+}
+
+/*
+ * Stops the render thread, waiting for it to finish.
+ */
+void render_stop(void)
+{
+    pthread_mutex_lock(&r.lock);
+    r.stopping = true;
+    pthread_cond_signal(&r.changed);
+    pthread_mutex_unlock(&r.lock);
+    pthread_join(r.thread, NULL);
+}
+
+/*
+ * The render thread. Waits for a new snapshot (or the next tick of the timer)
+ * then draws the latest one, no sooner than FRAME_MS after the last frame.
+ */
+void *render(void *arg)
+{
+    double last_frame = 0;
+    double metrics_written = metrics_now();
+
+    pthread_mutex_lock(&r.lock);
+    while (!r.stopping)
     {
-        // Count the number of empty squares.
-        int empty_squares = 0;
-        for (int row = 0; row < 9; row++)
+        // Wait for a change, but not beyond the next tick of the timer.
+        if (!r.dirty && !resized)
         {
-            for (int col = 0; col < 9; col++)
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += TICK_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000)
             {
-                if (!g.board[row][col])
-                {
-                    empty_squares++;
-                }
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
             }
+            pthread_cond_timedwait(&r.changed, &r.lock, &ts);
+            if (r.stopping)
+            {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&r.lock);
+
+        // Pace frames, letting any further changes accumulate meanwhile.
+        double wait = last_frame + FRAME_MS / 1e3 - metrics_now();
+        if (wait > 0)
+        {
+            usleep(wait * 1e6);
         }
 
-        // Choose a random location in [0, empty_cells - 1].
-        int target = rand() % empty_squares;
+        // Take the latest snapshot.
+        pthread_mutex_lock(&r.lock);
+        r.frame = r.pending;
+        r.dirty = false;
+        pthread_mutex_unlock(&r.lock);
 
-        // Go to that location.
-        empty_squares = 0;
-        for (int row = 0; row < 9; row++)
+        last_frame = metrics_now();
+        draw_frame();
+        metrics_observe(H_RENDER, metrics_now() - last_frame);
+
+        // Periodically export metrics.
+        if (g.metrics && metrics_now() - metrics_written >= METRICS_INTERVAL)
         {
-            for (int col = 0; col < 9; col++)
-            {
-                if (!g.board[row][col] && empty_squares == target)
-                {
-                    // Insert the number from the solution.
-                    g.board[row][col] = g.solved_board[row][col];
-                    // Prepare to move cursor to square.
-                    g.y = row;
-                    g.x = col;
-                    // Break the loop.
-                    row = 9;
-                    break;
-                }
-                else if (!g.board[row][col])
-                {
-                    empty_squares++;
-                }
-            }
+            metrics_write(g.metrics);
+            metrics_written = metrics_now();
         }
+
+        pthread_mutex_lock(&r.lock);
     }
-    return true;
+    pthread_mutex_unlock(&r.lock);
+    return NULL;
+}
+
+/*
+ * Composes the frame in r.frame and flushes it to the terminal.
+ */
+void draw_frame(void)
+{
+    // Redraw everything when asked to or when the window has changed.
+    if (resized || r.redraws != r.frame.redraws)
+    {
+        resized = 0;
+        r.redraws = r.frame.redraws;
+        redraw_all();
+    }
+
+    // The grid also shows the board's number, which may have changed.
+    draw_grid();
+    draw_numbers();
+    update_banner();
+    if (g.tournament)
+    {
+        draw_scoreboard();
+    }
+
+    // Update the timer, stopped once the game is won.
+    if (!r.frame.s.timer_showing)
+    {
+        hide_timer();
+    }
+    else if (r.frame.s.board_state != WON)
+    {
+        show_timer(difftime(time(NULL), r.frame.s.start));
+    }
+    else
+    {
+        show_timer(difftime(r.frame.s.end, r.frame.s.start));
+    }
+
+    // Restore the cursor, hidden if game won.
+    if (r.frame.s.board_state != WON)
+    {
+        curs_set(1);
+        show_cursor();
+    }
+    else
+    {
+        curs_set(0);
+    }
+
+    refresh();
 }
 
 /*
@@ -878,7 +1479,7 @@ void draw_borders(void)
 
     // Draw footer.
     mvaddstr(maxy-1, 1, "[N]ew Game   [R]estart Game   [T]imer show/hide   "
-                        "[U]ndo   [Ctrl-R]edo   [C]heck   [H]int");
+                        "[U]ndo   [Ctrl-R]edo   [C]heck   [H]int   [E]dit");
     mvaddstr(maxy-1, maxx-13, "[Q]uit Game");
 
     // Disable colour if possible (else b&w highlighting).
@@ -933,6 +1534,14 @@ void draw_grid(void)
     g.top = maxy/2 - 7;
     g.left = maxx/2 - 30;
 
+    // Make room for the standings below in a tournament.
+    if (g.tournament)
+    {
+        g.top -= TOURNAMENT_ROWS / 2 + 1;
+        if (g.top < 2)
+            g.top = 2;
+    }
+
     // Enable colour if possible.
     if (has_colors())
         attron(COLOR_PAIR(PAIR_GRID));
@@ -949,7 +1558,11 @@ void draw_grid(void)
 
     // Remind user of level and #.
     char reminder[maxx+1];
-    sprintf(reminder, "   playing %s #%d", g.level, g.number);
+    if (r.frame.s.editing)
+        sprintf(reminder, "   editing new puzzle");
+    else
+        sprintf(reminder, "   playing %s #%d",
+                r.frame.s.custom ? CUSTOM_LEVEL : g.level, r.frame.s.number);
     mvaddstr(g.top + 14, g.left + 25 - strlen(reminder), reminder);
 
     // Disable colour if possible.
@@ -966,39 +1579,31 @@ void draw_grid(void)
 void draw_numbers(void)
 {
     // Have different colours for completed puzzle.
-    int colours = g.board_state == WON ? PAIR_SOLVED : PAIR_BANNER;
+    int colours = r.frame.s.board_state == WON ? PAIR_SOLVED : PAIR_BANNER;
 
     // Iterate over board's numbers.
-    for (int i = 0; i < 9; i++)
+    for (int i = 0; i < 81; i++)
     {
-        for (int j = 0; j < 9; j++)
+        // If we have a completed game or the number was given at the start
+        // of the puzzle.
+        if (colours == PAIR_SOLVED || r.frame.s.cells[i] & CELL_GIVEN)
         {
-            // Determine char.
-            char c = (g.board[i][j] == 0) ? '.' : g.board[i][j] + '0';
-
-            // If we have a completed game or the number was given at the start
-            // of the puzzle.
-            if (colours == PAIR_SOLVED ||
-                (g.board[i][j] && g.board[i][j] == g.start_board[i][j]))
-            {
-                // Enable colour if possible.
-                if (has_colors())
-                    attron(COLOR_PAIR(colours));
+            // Enable colour if possible.
+            if (has_colors())
+                attron(COLOR_PAIR(colours));
 
-                // Add char to window.
-                mvaddch(g.top + i + 1 + i/3, g.left + 2 + 2*(j + j/3), c);
+            // Add char to window.
+            draw_cell(i);
 
-                // Disable colour if possible.
-                if (has_colors())
-                    attroff(COLOR_PAIR(colours));
-            }
+            // Disable colour if possible.
+            if (has_colors())
+                attroff(COLOR_PAIR(colours));
+        }
 
-            // Otherwise use default colours.
-            else
-            {
-                mvaddch(g.top + i + 1 + i/3, g.left + 2 + 2*(j + j/3), c);
-            }
-            refresh();
+        // Otherwise use default colours.
+        else
+        {
+            draw_cell(i);
         }
     }
 
@@ -1007,48 +1612,21 @@ void draw_numbers(void)
     if (has_colors())
         attron(COLOR_PAIR(PAIR_INVALID));
 
-    for (int i = 0; i < 9; i++)
+    for (int unit = 0; unit < 27; unit++)
     {
-        if (!valid_row(i))
+        if (r.frame.invalid & 1 << unit)
         {
-            for (int j = 0; j < 9; j++)
+            for (int i = 0; i < 9; i++)
             {
-                // Determine char.
-                char c = (g.board[i][j] == 0) ? '.' : g.board[i][j] + '0';
-                // Add char to window.
-                mvaddch(g.top + i + 1 + i/3, g.left + 2 + 2*(j + j/3), c);
-                refresh();
+                draw_cell(unit_cells[unit][i]);
             }
         }
-        if (!valid_column(i))
-        {
-            for (int j = 0; j < 9; j++)
-            {
-                // Determine char.
-                char c = (g.board[j][i] == 0) ? '.' : g.board[j][i] + '0';
-                // Add char to window.
-                mvaddch(g.top + j + 1 + j/3, g.left + 2 + 2*(i + i/3), c);
-                refresh();
-            }
-        }
-        if (!valid_box(i))
+    }
+    for (int i = 0; i < 81; i++)
+    {
+        if (r.frame.dead[i])
         {
-            for (int j = 0; j < 3; j++)
-            {
-                for (int k = 0; k < 3; k++)
-                {
-                    // Calculate the rows and columns for the box.
-                    int row = j + 3 * (i % 3);
-                    int col = k + 3 * (i / 3);
-                    // Determine char.
-                    char c = (g.board[row][col] == 0) ?
-                              '.' : g.board[row][col] + '0';
-                    // Add char to window.
-                    mvaddch(g.top + row + 1 + row/3,
-                            g.left + 2 + 2*(col + col/3), c);
-                    refresh();
-                }
-            }
+            draw_cell(i);
         }
     }
 
@@ -1058,16 +1636,33 @@ void draw_numbers(void)
 }
 
 /*
- * Shows cursor at (g.y, g.x).
+ * Draws the number in cell with the current colours.  Must be called after
+ * draw_grid has been called at least once.
+ */
+void draw_cell(int cell)
+{
+    // Determine char.
+    int n = DIGIT(r.frame.s.cells[cell]);
+    char c = (n == 0) ? '.' : n + '0';
+
+    // Add char to window.
+    int y = cell_row[cell], x = cell_col[cell];
+    mvaddch(g.top + y + 1 + y/3, g.left + 2 + 2*(x + x/3), c);
+}
+
+/*
+ * Shows cursor at the location in the frame being drawn.
  */
 void show_cursor(void)
 {
     // Restore cursor's location.
-    move(g.top + g.y + 1 + g.y/3, g.left + 2 + 2*(g.x + g.x/3));
+    int y = r.frame.s.y, x = r.frame.s.x;
+    move(g.top + y + 1 + y/3, g.left + 2 + 2*(x + x/3));
 }
 
 /*
- * (Re)draws everything on the screen except timer and banner.
+ * Clears the screen and, with ncurses reset to the window's current size,
+ * redraws the permanent features. Called on the render thread only.
  */
 void redraw_all(void)
 {
@@ -1082,9 +1677,6 @@ void redraw_all(void)
     draw_borders();
     draw_grid();
     draw_logo();
-    draw_numbers();
-    update_banner();
-    show_cursor();
 }
 
 /*
@@ -1127,8 +1719,8 @@ void update_banner(void)
 {
     hide_banner();
 
-    // Display a different message to the user depending only on g.board_state.
-    switch (g.board_state)
+    // Display a different message to the user depending only on board_state.
+    switch (r.frame.s.board_state)
     {
         case BOARD_OK:
             return;
@@ -1157,12 +1749,69 @@ void update_banner(void)
             break;
 
         case HINT:
-            show_banner("Hope that helps!");
+        {
+            char b[60];
+            sprintf(b, "Hope that helps! (%s)",
+                    technique_names[r.frame.s.hint]);
+            show_banner(b);
             break;
+        }
 
         case FIX_HINT:
             show_banner("Any mistakes are now fixed!");
             break;
+
+        case SWITCHED:
+        {
+            char b[60];
+            if (r.frame.s.editing)
+                sprintf(b, "Back to the new puzzle, one of %d games open.",
+                        r.frame.games);
+            else
+                sprintf(b, "Back to board #%d, one of %d games open.",
+                        r.frame.s.number, r.frame.games);
+            show_banner(b);
+            break;
+        }
+
+        case EDIT_UNIQUE:
+            show_banner("Just one solution! Press 'p' to save and play it.");
+            break;
+
+        case EDIT_MANY:
+            show_banner("More than one solution so far. Add more numbers.");
+            break;
+
+        case EDIT_NONE:
+            show_banner("Oops! That has no solution. Use 'u' to undo moves.");
+            break;
+
+        case EDIT_REPEAT:
+            show_banner("Oops! That number can't go there. "
+                        "Use 'u' to undo moves.");
+            break;
+
+        case EDIT_STUCK:
+            show_banner("Oops! That leaves a cell no number. "
+                        "Use 'u' to undo moves.");
+            break;
+
+        case SAVED:
+        {
+            char b[60];
+            sprintf(b, "Saved as %s #%d. Enjoy!", CUSTOM_LEVEL,
+                    r.frame.s.number);
+            show_banner(b);
+            break;
+        }
+
+        case SAVE_FAILED:
+            show_banner("Oops! The puzzle could not be saved.");
+            break;
+
+        case SWAP_FAILED:
+            show_banner("Oops! A game set aside could not be swapped in.");
+            break;
     }
 }
 
@@ -1201,7 +1850,7 @@ void hide_timer(void)
 }
 
 /*
- * Pop from a stack and free the memory for that node.
+ * Pop from a stack, keeping the node for reuse by push.
  */
 void pop(stack **ptr)
 {
@@ -1213,28 +1862,46 @@ void pop(stack **ptr)
     {
         stack *head = *ptr;
         *ptr = head->next;
-        free(head);
+        head->next = g.s->spare;
+        g.s->spare = head;
     }
 }
 
 /*
- * Push to a stack, allocates new memory for a node.
+ * Push to a stack, reusing a popped node or else taking a new one from the
+ * game's history arena. If the history is full, the stack's oldest move is
+ * forgotten and its node reused, so the move pushed is always kept; callers
+ * free a node before pushing where they can, so there's always one to take.
  */
-void push(stack **ptr, int y, int x, int replaced)
+void push(stack **ptr, int cell, int replaced)
 {
-    stack *new_ptr = malloc(sizeof(stack));
-    if (!new_ptr)
+    stack *new_ptr = g.s->spare;
+    if (new_ptr)
     {
-        return;
+        g.s->spare = new_ptr->next;
     }
     else
     {
-        new_ptr->y = y;
-        new_ptr->x = x;
-        new_ptr->replaced = replaced;
-        new_ptr->next = *ptr;
-        *ptr = new_ptr;
+        new_ptr = arena_alloc(&g.s->history, sizeof(stack));
+    }
+
+    // Take the bottom node of the stack.
+    if (!new_ptr)
+    {
+        stack **bottom = ptr;
+        assert(*bottom);
+        while ((*bottom)->next)
+        {
+            bottom = &(*bottom)->next;
+        }
+        new_ptr = *bottom;
+        *bottom = NULL;
     }
+
+    new_ptr->cell = cell;
+    new_ptr->replaced = replaced;
+    new_ptr->next = *ptr;
+    *ptr = new_ptr;
 }
 
 /*
@@ -1307,9 +1974,6 @@ bool startup(void)
         return false;
     }
 
-    // Wait 100 ms at a time for input and regularity of timer.
-    timeout(100);
-
     return true;
 }
 
@@ -1318,92 +1982,672 @@ bool startup(void)
  */
 bool load_board(void)
 {
-    // Open file with boards of specified level.
+    // Generated boards come with their solution.
+    if (g.generated)
+    {
+        generator_take(g.s->number, g.s->puzzle, g.s->solution);
+        g.s->solved = true;
+        return true;
+    }
+
+    // Read board from the file with boards of specified level, wherever
+    // reordering the file has put it.
     char filename[strlen(g.level) + 5];
     sprintf(filename, "%s.bin", g.level);
-    FILE *fp = fopen(filename, "rb");
-    if (fp == NULL)
+    return pack_read(filename, pack_resolve(filename, g.s->number),
+                     g.s->puzzle);
+}
+
+/*
+ * Starts a game of the current board, returning true iff succesful.
+ */
+bool new_game(void)
+{
+    if (!load_board())
+    {
         return false;
+    }
+    g.s->editing = g.s->custom = false;
+    g.s->steps = 0;
+
+    restart_game();
+    return true;
+}
+
+/*
+ * Solves the current game's puzzle for the hint feature, unless it came with
+ * its solution, and plans its hints. Left until the puzzle is on screen.
+ */
+void prepare_game(void)
+{
+    double start = metrics_now();
+    if (!g.generated)
+    {
+        backtracking();
+    }
+    metrics_observe(H_SOLVE, metrics_now() - start);
+    mark(STAGE_SOLVED);
+
+    // Take the plan for hints from the pack's index, else make it now.
+    if (g.s->solved)
+    {
+        char filename[strlen(g.level) + 5], pack[strlen(g.level) + 5];
+        sprintf(filename, "%s.idx", g.level);
+        sprintf(pack, "%s.bin", g.level);
+        int steps = g.generated ? -1 :
+                    index_read(filename, pack_resolve(pack, g.s->number),
+                               g.s->puzzle, g.s->plan);
+        if (steps < 0)
+        {
+            steps = logic_plan(g.s->puzzle, g.s->solution, g.s->plan);
+        }
+        g.s->steps = steps;
+    }
+    mark(STAGE_PLANNED);
+}
+
+/*
+ * (Re)starts current game from its puzzle.
+ */
+void restart_game(void)
+{
+    memcpy(g.s->cells, g.s->puzzle, sizeof(g.s->cells));
+
+    // Clear undo and redo stacks, and the memory for them.
+    g.s->undo = g.s->redo = g.s->spare = NULL;
+    arena_reset(&g.s->history);
+    metrics_add(M_GAMES_STARTED, 1);
+
+    // Reset timer and board_state.
+    time(&g.s->start);
+    g.s->timer_showing = true;
+    g.s->board_state = BOARD_OK;
+
+    // Move cursor to board's center.
+    g.s->y = g.s->x = 4;
+}
+
+/*
+ * Designed to handles signals (e.g., SIGWINCH).
+ */
+void handle_signal(int signum)
+{
+    // Handle a change in the window (i.e., a resizing) by having the render
+    // thread redraw everything.
+    if (signum == SIGWINCH)
+        resized = 1;
+
+    // Re-register myself so this signal gets handled in future too.
+    signal(signum, (void (*)(int)) handle_signal);
+}
+
+/*
+ * Opens a new game with an empty board to edit into a puzzle.
+ */
+void start_editor(void)
+{
+    open_game();
+    g.s->number = 0;
+    memset(g.s->puzzle, 0, sizeof(g.s->puzzle));
+    g.s->steps = 0;
+    g.s->custom = false;
+    restart_game();
+
+    g.s->editing = true;
+    g.s->timer_showing = false;
+    edit_count(-1, 0);
+}
 
-    // Determine file's size.
-    fseek(fp, 0, SEEK_END);
-    int size = ftell(fp);
+/*
+ * Counts the solutions of the board being edited, as far as two since that's
+ * enough to tell whether its solution is unique, and sets the board's state
+ * to say how many. The board has just had the number replaced in cell
+ * changed, or is counted afresh if cell is negative. Boards repeating a
+ * number or leaving a cell no candidate plainly have none, so aren't
+ * searched, and nor are those whose count follows from the last: adding a
+ * number to a board with no solution leaves none, adding one to a board with
+ * just one either agrees with it or leaves none, and removing one from a
+ * board with many leaves many.
+ */
+void edit_count(int cell, int replaced)
+{
+    int before = g.s->solutions;
+    int digit = cell < 0 ? 0 : DIGIT(g.s->cells[cell]);
+    replaced = DIGIT(replaced);
 
-    // Ensure file is of expected size.
-    if (size % (81 * INTSIZE) != 0)
+    int count = -1;
+    if (!valid_board())
+    {
+        g.s->board_state = EDIT_REPEAT;
+        count = 0;
+    }
+    for (int i = 0; i < 81 && count < 0; i++)
+    {
+        if (!g.s->cells[i] && !board_candidates(g.s->cells, i))
+        {
+            g.s->board_state = EDIT_STUCK;
+            count = 0;
+        }
+    }
+    if (count == 0)
+    {
+        g.s->solutions = 0;
+        g.s->solved = false;
+        return;
+    }
+
+    if (cell >= 0 && digit == replaced)
+    {
+        count = before;
+    }
+    else if (cell >= 0 && !replaced && before < 2)
+    {
+        count = before && digit == g.s->solution[cell];
+    }
+    else if (cell >= 0 && !digit && before == 2)
+    {
+        count = 2;
+    }
+    else
+    {
+        struct solve_stats stats;
+        double start = metrics_now();
+        count = count_solutions_config(g.s->cells, 2, g.s->solution,
+                                       &edit_config, NULL, &stats);
+        metrics_observe(H_SOLVE, metrics_now() - start);
+    }
+
+    g.s->solutions = count;
+    g.s->solved = count == 1;
+    g.s->board_state = count == 0 ? EDIT_NONE :
+                       count == 1 ? EDIT_UNIQUE : EDIT_MANY;
+}
+
+/*
+ * Appends the board being edited, whose solution must be unique, to the
+ * custom level's pack, and starts playing it as that level's newest board.
+ * Returns true iff successful.
+ */
+bool save_edit(void)
+{
+    char filename[strlen(CUSTOM_LEVEL) + 5];
+    sprintf(filename, "%s.bin", CUSTOM_LEVEL);
+    int number = pack_append(filename, g.s->cells);
+    if (number < 0)
     {
-        fclose(fp);
         return false;
     }
 
-    // Compute offset of specified board.
-    int offset = ((g.number - 1) * 81 * INTSIZE);
+    memcpy(g.s->puzzle, g.s->cells, sizeof(g.s->puzzle));
+    g.s->number = number;
+    g.s->steps = logic_plan(g.s->puzzle, g.s->solution, g.s->plan);
+    g.s->editing = false;
+    g.s->custom = true;
+    restart_game();
+    return true;
+}
+
+/*
+ * Makes room at the front of the games open for a new one, which becomes the
+ * current game. If memory is full the game played least recently is spilled
+ * to the journal.
+ */
+void open_game(void)
+{
+    leave_game();
+
+    struct session *s;
+    if (g.games < SESSIONS)
+    {
+        s = &sessions[g.games++];
+    }
+    else
+    {
+        s = g.open[SESSIONS - 1];
+        spill(s);
+        reclaim();
+    }
+
+    memmove(&g.open[1], &g.open[0], (g.games - 1) * sizeof(g.open[0]));
+    g.open[0] = g.s = s;
+}
+
+/*
+ * Switches to the game played least recently, so that switching repeatedly
+ * cycles through every game open. Games in memory are switched to by pointer;
+ * one in the journal is read back in place of the game in memory played least
+ * recently, which is spilled in turn.
+ */
+void switch_game(void)
+{
+    if (g.games + g.cold_games < 2)
+    {
+        return;
+    }
+    leave_game();
+
+    struct session *s = g.open[g.games - 1];
+    bool swapped = true;
+    if (g.cold_games > 0)
+    {
+        // The game in the journal is only taken off its list once the game
+        // it replaces is safely there too.
+        off_t offset = g.cold[g.cold_games - 1];
+        g.cold_games--;
+        if (!spill(s))
+        {
+            g.cold_games++;
+            swapped = false;
+        }
+        else if (!unspill(offset, s))
+        {
+            // Keep the game we have rather than lose both.
+            g.cold_games--;
+            memmove(&g.cold[0], &g.cold[1], g.cold_games * sizeof(g.cold[0]));
+            swapped = false;
+        }
+        reclaim();
+    }
 
-    // Seek to specified board.
-    fseek(fp, offset, SEEK_SET);
+    memmove(&g.open[1], &g.open[0], (g.games - 1) * sizeof(g.open[0]));
+    g.open[0] = g.s = s;
+    enter_game();
 
-    // Read board into memory for game's current board.
-    if (fread(g.board, 81 * INTSIZE, 1, fp) != 1)
+    if (!swapped)
+    {
+        g.s->board_state = SWAP_FAILED;
+    }
+    else if (g.s->board_state != WON)
+    {
+        g.s->board_state = SWITCHED;
+    }
+}
+
+/*
+ * Pauses the current game's timer as it's left for another.
+ */
+void leave_game(void)
+{
+    time(&g.s->paused);
+}
+
+/*
+ * Restarts the current game's timer as it's returned to.
+ */
+void enter_game(void)
+{
+    if (g.s->board_state != WON)
+    {
+        g.s->start += time(NULL) - g.s->paused;
+    }
+}
+
+/*
+ * Appends game s to the journal in compact form: its boards packed, and its
+ * plan and history as they are. Returns true iff successful. If the journal's
+ * list of games is full, the game played longest ago is dropped.
+ */
+bool spill(struct session *s)
+{
+    static uint8_t record[JOURNAL_RECORD_MAX];
+    if (g.journal < 0)
     {
-        fclose(fp);
         return false;
     }
 
-    // Copy board into memory for game's starting board.
-    memcpy(g.start_board, g.board, sizeof(g.board));
+    // Fixed fields, with times relative to the start of the game.
+    uint8_t *p = record + 4;
+    int32_t fields[3] = { s->number, s->paused - s->start, s->end - s->start };
+    for (int i = 0; i < 3; i++)
+    {
+        for (int b = 0; b < 4; b++)
+        {
+            *p++ = (uint32_t) fields[i] >> 8 * b;
+        }
+    }
+    *p++ = s->board_state;
+    *p++ = s->solved | s->timer_showing << 1 | s->editing << 2 |
+           s->custom << 3 | s->solutions << 4;
+    *p++ = s->y;
+    *p++ = s->x;
+    *p++ = s->hint;
+    *p++ = s->steps;
+
+    board_pack(s->puzzle, p);
+    board_pack(s->solution, p + PACKED_SIZE);
+    p += 2 * PACKED_SIZE;
+    memcpy(p, s->cells, 81);
+    p += 81;
+    for (int i = 0; i < s->steps; i++)
+    {
+        *p++ = s->plan[i];
+        *p++ = s->plan[i] >> 8;
+    }
 
-    fclose(fp);
+    // The stacks, top first, each after its length.
+    stack *stacks[2] = { s->undo, s->redo };
+    for (int i = 0; i < 2; i++)
+    {
+        uint8_t *length = p;
+        int n = 0;
+        p += 2;
+        for (stack *node = stacks[i]; node; node = node->next, n++)
+        {
+            *p++ = node->cell;
+            *p++ = node->replaced;
+        }
+        length[0] = n;
+        length[1] = n >> 8;
+    }
+
+    uint32_t size = p - record;
+    for (int b = 0; b < 4; b++)
+    {
+        record[b] = size >> 8 * b;
+    }
+    if (pwrite(g.journal, record, size, g.journal_size) != size)
+    {
+        return false;
+    }
+
+    if (g.cold_games == COLD_GAMES)
+    {
+        g.cold_games--;
+    }
+    memmove(&g.cold[1], &g.cold[0], g.cold_games * sizeof(g.cold[0]));
+    g.cold[0] = g.journal_size;
+    g.cold_games++;
+    g.journal_size += size;
     return true;
 }
 
 /*
- * (Re)starts current game, returning true iff succesful.
+ * Reads the game spilled at offset in the journal back into s, which becomes
+ * the current game. Returns true iff successful.
  */
-bool restart_game(void)
+bool unspill(off_t offset, struct session *s)
 {
-    // Reload current game.
-    if (!load_board())
+    static uint8_t record[JOURNAL_RECORD_MAX];
+    uint8_t head[4];
+    if (pread(g.journal, head, 4, offset) != 4)
+    {
+        return false;
+    }
+    uint32_t size = head[0] | head[1] << 8 | head[2] << 16 |
+                    (uint32_t) head[3] << 24;
+    if (size > sizeof(record) || pread(g.journal, record, size, offset) != size)
     {
         return false;
     }
 
-    // Clear undo and redo stacks.
-    clear_stack(&g.undo);
-    clear_stack(&g.redo);
+    const uint8_t *p = record + 4;
+    int32_t fields[3];
+    for (int i = 0; i < 3; i++, p += 4)
+    {
+        fields[i] = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+    }
+    s->number = fields[0];
+    time(&s->paused);
+    s->start = s->paused - fields[1];
+    s->end = s->start + fields[2];
+
+    s->board_state = *p++;
+    s->solved = *p & 1;
+    s->timer_showing = *p >> 1 & 1;
+    s->editing = *p >> 2 & 1;
+    s->custom = *p >> 3 & 1;
+    s->solutions = *p++ >> 4 & 3;
+    s->y = *p++;
+    s->x = *p++;
+    s->hint = *p++;
+    s->steps = *p++;
+
+    board_unpack(p, s->puzzle);
+    board_unpack(p + PACKED_SIZE, s->solution);
+    p += 2 * PACKED_SIZE;
+    for (int i = 0; i < 81; i++)
+    {
+        s->puzzle[i] |= s->puzzle[i] ? CELL_GIVEN : 0;
+    }
+    memcpy(s->cells, p, 81);
+    p += 81;
+    for (int i = 0; i < s->steps; i++, p += 2)
+    {
+        s->plan[i] = p[0] | p[1] << 8;
+    }
 
-    // Solve the puzzle for hint feature.
-    g.solved = false;
-    backtracking();
+    // Rebuild the stacks bottom first, in the game's own history.
+    g.s = s;
+    s->undo = s->redo = s->spare = NULL;
+    arena_reset(&s->history);
+    stack **stacks[2] = { &s->undo, &s->redo };
+    for (int i = 0; i < 2; i++)
+    {
+        int n = p[0] | p[1] << 8;
+        p += 2;
+        for (int j = n - 1; j >= 0; j--)
+        {
+            push(stacks[i], p[2 * j], p[2 * j + 1]);
+        }
+        p += 2 * n;
+    }
+    return true;
+}
 
-    // Reset timer and board_state.
-    time(&g.start);
-    g.timer_showing = true;
-    g.board_state = BOARD_OK;
+/*
+ * Reclaims the journal's space held by games read back or dropped. It's
+ * emptied once it holds no games, and otherwise the games left are moved down
+ * to its start once they fill less than half of it.
+ */
+void reclaim(void)
+{
+    static uint8_t record[JOURNAL_RECORD_MAX];
+    if (g.journal < 0)
+    {
+        return;
+    }
+    if (g.cold_games == 0)
+    {
+        if (ftruncate(g.journal, 0) == 0)
+        {
+            g.journal_size = 0;
+        }
+        return;
+    }
 
-    // Redraw board.
-    draw_grid();
-    draw_numbers();
-    hide_timer();
-    hide_banner();
-    curs_set(1);
+    // Find each game's size, and the order they're stored in.
+    uint32_t sizes[COLD_GAMES];
+    int order[COLD_GAMES];
+    off_t live = 0;
+    for (int i = 0; i < g.cold_games; i++)
+    {
+        uint8_t head[4];
+        if (pread(g.journal, head, 4, g.cold[i]) != 4)
+        {
+            return;
+        }
+        sizes[i] = head[0] | head[1] << 8 | head[2] << 16 |
+                   (uint32_t) head[3] << 24;
+        live += sizes[i];
 
-    // Move cursor to board's center.
-    g.y = g.x = 4;
-    show_cursor();
+        int j = i;
+        while (j > 0 && g.cold[order[j - 1]] > g.cold[i])
+        {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    if (live * 2 > g.journal_size)
+    {
+        return;
+    }
 
-    return true;
+    // Each game moves no further than down to the end of the one before.
+    off_t end = 0;
+    for (int k = 0; k < g.cold_games; k++)
+    {
+        int i = order[k];
+        if (g.cold[i] != end)
+        {
+            if (sizes[i] > sizeof(record) ||
+                pread(g.journal, record, sizes[i], g.cold[i]) != sizes[i] ||
+                pwrite(g.journal, record, sizes[i], end) != sizes[i])
+            {
+                return;
+            }
+            g.cold[i] = end;
+        }
+        end += sizes[i];
+    }
+    if (ftruncate(g.journal, end) == 0)
+    {
+        g.journal_size = end;
+    }
 }
 
 /*
- * Designed to handles signals (e.g., SIGWINCH).
+ * Returns true iff the current game is the tournament's.
  */
-void handle_signal(int signum)
+bool competing(void)
 {
-    // Handle a change in the window (i.e., a resizing).
-    if (signum == SIGWINCH)
-        redraw_all();
+    return g.tournament && g.s->number == g.tournament_number &&
+           !g.s->editing && !g.s->custom;
+}
 
-    // Re-register myself so this signal gets handled in future too.
-    signal(signum, (void (*)(int)) handle_signal);
+/*
+ * Publishes progress in the tournament's game to the scoreboard, if that's
+ * the game being played.
+ */
+void report_progress(void)
+{
+    if (!competing())
+    {
+        return;
+    }
+
+    int filled = 0, empty = 0;
+    for (int i = 0; i < 81; i++)
+    {
+        if (!g.s->puzzle[i])
+        {
+            empty++;
+            filled += g.s->cells[i] != 0;
+        }
+    }
+    if (!g.tournament_start)
+    {
+        g.tournament_start = g.s->start;
+    }
+    tournament_update(filled, empty, g.mistakes, g.tournament_start,
+                      g.s->board_state == WON ? g.s->end : 0);
+}
+
+/*
+ * Draws the tournament's standings under the grid, as many of the leaders
+ * as fit and the player's own if they aren't among them.
+ */
+void draw_scoreboard(void)
+{
+    // Get window's dimensions.
+    int maxy, maxx;
+    getmaxyx(stdscr, maxy, maxx);
+
+    // Only the render thread ranks, so this needn't be on its stack.
+    static struct standing ranking[TOURNAMENT_SLOTS];
+    int players = tournament_ranking(ranking);
+
+    // Overwrite the last standings with spaces.
+    int top = g.top + 18;
+    for (int y = top; y < maxy - 1; y++)
+        for (int i = 0; i < maxx; i++)
+            mvaddch(y, i, ' ');
+
+    int rows = maxy - 2 - top;
+    if (rows < 0)
+        return;
+    if (rows > TOURNAMENT_ROWS)
+        rows = TOURNAMENT_ROWS;
+    if (rows > players)
+        rows = players;
+
+    char line[maxx + 80];
+    sprintf(line, "Tournament %s: %d player%s", g.tournament, players,
+            players == 1 ? "" : "s");
+    mvaddstr(top, g.left, line);
+
+    // Show the player in the last row if they're further down.
+    int yours = 0;
+    while (yours < players && !ranking[yours].yours)
+        yours++;
+    time_t now = time(NULL);
+    for (int row = 0; row < rows; row++)
+    {
+        int rank = row == rows - 1 && yours > row && yours < players ?
+                   yours : row;
+        const struct standing *p = &ranking[rank];
+        char progress[16];
+        if (p->end)
+            sprintf(progress, "solved");
+        else if (p->left)
+            sprintf(progress, "quit");
+        else
+            sprintf(progress, "%d/%d", p->filled, p->empty);
+        int elapsed = difftime(p->end ? p->end : p->left ? p->left : now,
+                               p->start);
+        sprintf(line, "%3d. %-15s %-6s %2d mistake%s %4d:%02d", rank + 1,
+                p->player, progress, p->mistakes,
+                p->mistakes == 1 ? " " : "s", elapsed / 60, elapsed % 60);
+
+        // Highlight the player's own standing.
+        if (p->yours && has_colors())
+            attron(COLOR_PAIR(PAIR_BANNER));
+        mvaddstr(top + 1 + row, g.left, line);
+        if (p->yours && has_colors())
+            attroff(COLOR_PAIR(PAIR_BANNER));
+    }
 }
 
+/*
+ * Draws the first frame, in full, straight from the snapshot just published,
+ * before the render thread starts.
+ */
+void show_first_frame(void)
+{
+    r.frame = r.pending;
+    r.dirty = false;
+    r.redraws = -1;
+    draw_frame();
+}
+
+/*
+ * Notes the time a stage of starting up ended, unless it already has (as
+ * solving and planning do for every game).
+ */
+void mark(enum stage stage)
+{
+    if (!boot.ended[stage])
+    {
+        boot.ended[stage] = metrics_now();
+    }
+}
+
+/*
+ * Prints when each stage of starting up ended, and how long it took, in ms
+ * since main started.
+ */
+void startup_report(void)
+{
+    printf("Startup, in ms since main():\n");
+    double last = boot.start;
+    for (int i = 0; i < STAGES; i++)
+    {
+        if (boot.ended[i])
+        {
+            printf("  %-18s %8.3f  (+%.3f)\n", stage_names[i],
+                   (boot.ended[i] - boot.start) * 1e3,
+                   (boot.ended[i] - last) * 1e3);
+            last = boot.ended[i];
+        }
+    }
+}
@@ -2,6 +2,8 @@
  * Compile-time options for the game of Sudoku.
  */
 
+#include <stdbool.h>
+
 #define AUTHOR "cs50"
 #define TITLE "Sudoku"
 
@@ -33,3 +35,82 @@
 enum { PAIR_BANNER = 1, PAIR_GRID, PAIR_BORDER, PAIR_LOGO, PAIR_SOLVED,
        PAIR_INVALID };
 
+// Starts up ncurses with the pairs above, as the game and the batch
+// dashboard both do. Returns true iff successful.
+bool startup(void);
+
+
+// Longest time (in ms) to wait for the background thread to finish making a
+// generated puzzle before making it in the foreground instead.
+#define GEN_WAIT_MS 40
+
+// Number of generated puzzles kept ready by the background thread.
+#define GEN_QUEUE_SIZE 4
+
+// Most givens left in generated n00b and l33t puzzles.
+#define GEN_CLUES_N00B 36
+#define GEN_CLUES_L33T 17
+
+// Solutions counted as far as while changing the givens of a puzzle with a
+// fixed pattern, changes tried before starting again, and time (in seconds)
+// to keep trying before giving up on a pattern.
+#define PATTERN_LIMIT 16
+#define PATTERN_STEPS 300
+#define PATTERN_TIMEOUT 60
+
+// Size (as a power of two entries) of the generator's transposition table,
+// and fewest empty cells a board needs for its count to be worth keeping.
+#define GEN_TABLE_BITS 16
+#define TABLE_MIN_EMPTY 8
+
+// File caching solutions for every process, its number of entries, and the
+// most slots a puzzle's entry may be from where its key puts it.
+#define CACHE_FILE ".sudoku.cache"
+#define CACHE_SLOTS 4096
+#define CACHE_PROBES 8
+
+// Size (as a power of two entries) of the transposition table each thread
+// solving a pack keeps when its solver settings say to use one.
+#define SOLVER_TABLE_BITS 16
+
+// Level to which puzzles made in the editor are saved (as custom.bin).
+#define CUSTOM_LEVEL "custom"
+
+// File to which counting every grid is checkpointed, removed once done, and
+// how often (in seconds) to rewrite it.
+#define ENUM_CHECKPOINT ".sudoku.enumerate"
+#define ENUM_CHECKPOINT_S 5
+
+// Environment variable naming the file to export metrics to, if any, and
+// how often (in seconds) to rewrite it.
+#define METRICS_ENV "SUDOKU_METRICS"
+#define METRICS_INTERVAL 5
+
+// Environment variables naming the tournament to join, if any, and the
+// player (else the login name is used), most players in a tournament, the
+// longest description of its puzzle and most players shown under the grid.
+#define TOURNAMENT_ENV "SUDOKU_TOURNAMENT"
+#define PLAYER_ENV "SUDOKU_PLAYER"
+#define TOURNAMENT_SLOTS 512
+#define TOURNAMENT_PUZZLE 32
+#define TOURNAMENT_ROWS 6
+
+// Most moves kept in each game's undo/redo history.
+#define HISTORY_MOVES 4096
+
+// Most games kept in memory, and in the journal once memory is full.
+#define SESSIONS 4
+#define COLD_GAMES 64
+
+// Directory in which each process keeps a private, unnamed file to which
+// games are spilled, and the longest record of a game in it.
+#define JOURNAL_DIR "."
+#define JOURNAL_RECORD_MAX (4 * 4 + 6 + 2 * 41 + 81 + 2 * 81 + \
+                            2 * 2 + 2 * HISTORY_MOVES)
+
+// Least time (in ms) between frames, and longest between redraws of timer.
+#define FRAME_MS 16
+#define TICK_MS 100
+
+// Time (in ms) between refreshes of the batch dashboard.
+#define DASHBOARD_MS 250
@@ -0,0 +1,88 @@
+/**
+ * table.c
+ *
+ * Implements the transposition table. Each entry is two words written and
+ * read with relaxed atomics; the first holds the key XORed with the second,
+ * so a reader seeing half of one writer's entry and half of another's finds
+ * the key doesn't match and treats it as a miss. No locks are needed.
+ */
+
+#include "table.h"
+#include "alloc.h"
+
+#include <string.h>
+
+// Layout of an entry's data: the count, and a flag if it's exact.
+#define COUNT_MASK 0xffff
+#define EXACT_BIT (1u << 16)
+
+/*
+ * Returns the Zobrist key for digit in cell, mixed from the pair by
+ * splitmix64 so that no table of keys need be kept.
+ */
+uint64_t zobrist(int cell, int digit)
+{
+    uint64_t z = (cell * 9 + digit) * 0x9e3779b97f4a7c15ull;
+    z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ z >> 27) * 0x94d049bb133111ebull;
+    return z ^ z >> 31;
+}
+
+/*
+ * Creates an empty table t of 2^bits entries. Returns true iff successful.
+ */
+bool table_create(struct table *t, int bits)
+{
+    t->entries = xcalloc((size_t) 1 << bits, sizeof(struct table_entry));
+    t->mask = ((uint64_t) 1 << bits) - 1;
+    return t->entries != NULL;
+}
+
+/*
+ * Empties table t.
+ */
+void table_clear(struct table *t)
+{
+    memset(t->entries, 0, (t->mask + 1) * sizeof(struct table_entry));
+}
+
+/*
+ * Frees the entries of table t.
+ */
+void table_destroy(struct table *t)
+{
+    xfree(t->entries);
+    t->entries = NULL;
+}
+
+/*
+ * Looks up key in table t. If found returns true, setting *count to the
+ * solutions counted and *exact to whether that's all of them.
+ */
+bool table_probe(const struct table *t, uint64_t key, int *count, bool *exact)
+{
+    const struct table_entry *e = &t->entries[key & t->mask];
+    uint64_t check = __atomic_load_n(&e->check, __ATOMIC_RELAXED);
+    uint64_t data = __atomic_load_n(&e->data, __ATOMIC_RELAXED);
+
+    // An empty entry never matches (so the odd board hashing to 0 with no
+    // solutions just isn't cached).
+    if ((check ^ data) != key || (check == 0 && data == 0))
+    {
+        return false;
+    }
+    *count = data & COUNT_MASK;
+    *exact = data & EXACT_BIT;
+    return true;
+}
+
+/*
+ * Stores count (exact or not) for key in table t.
+ */
+void table_store(struct table *t, uint64_t key, int count, bool exact)
+{
+    struct table_entry *e = &t->entries[key & t->mask];
+    uint64_t data = (count & COUNT_MASK) | (exact ? EXACT_BIT : 0);
+    __atomic_store_n(&e->check, key ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->data, data, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,45 @@
+/**
+ * table.h
+ *
+ * A fixed-size, lock-free transposition table of solution counts for partial
+ * boards, keyed by Zobrist hash. One table may be shared by any number of
+ * threads.
+ */
+
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// One slot. The key is stored XORed with the data, so a slot torn by racing
+// writers simply fails to match.
+struct table_entry
+{
+    uint64_t check, data;
+};
+
+// A table of a power of two entries.
+struct table
+{
+    struct table_entry *entries;
+    uint64_t mask;
+};
+
+// Returns the Zobrist key for digit (1-9) in cell; a board's hash is the XOR
+// of the keys of its filled cells.
+uint64_t zobrist(int cell, int digit);
+
+// Functions for creating, emptying and destroying a table of 2^bits entries.
+bool table_create(struct table *t, int bits);
+void table_clear(struct table *t);
+void table_destroy(struct table *t);
+
+// Looks up the count for the board with hash key: the number of solutions
+// found, and whether that's all of them or just as many as were wanted.
+bool table_probe(const struct table *t, uint64_t key, int *count, bool *exact);
+
+// Records the count for the board with hash key, replacing what was there.
+void table_store(struct table *t, uint64_t key, int count, bool exact);
+
+#endif
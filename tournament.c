@@ -0,0 +1,493 @@
+/**
+ * tournament.c
+ *
+ * Implements the tournament scoreboard, a POSIX shared memory object of fixed
+ * size mapped by every player's process. After a header naming the puzzle
+ * being played, it's an array of slots, one per player, each a cache line of
+ * its own so players never contend.
+ *
+ * A process claims a free slot by swapping its pid in atomically, or takes
+ * back its player's slot from a process that has gone, and from then on is
+ * the only one to write it. Each update is bracketed by bumps of the slot's
+ * sequence number, odd while the update is under way, so readers copy a slot
+ * and keep the copy only if the number was even and unchanged throughout.
+ * Neither side takes a lock: a writer never waits, and a reader that keeps
+ * meeting updates to a slot just leaves it out until next time.
+ *
+ *   header: "STRN", version (4 bytes), slots (4 bytes), ready (4 bytes),
+ *           puzzle (TOURNAMENT_PUZZLE bytes)
+ *   slot:   see struct slot
+ */
+
+#include "tournament.h"
+#include "sudoku.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Version of the format.
+#define TOURNAMENT_VERSION 1
+
+// Longest tournament name.
+#define NAME_MAX_LENGTH 32
+
+// Times a reader tries to copy a slot before leaving it out.
+#define READ_TRIES 64
+
+// Longest (in ms) to wait for another process to finish creating the
+// scoreboard.
+#define CREATE_WAIT_MS 1000
+
+// Header of the scoreboard, ready (1) once filled in, and 2 while it's being.
+struct header
+{
+    char magic[4];
+    uint32_t version, slots, ready;
+    char puzzle[TOURNAMENT_PUZZLE];
+};
+
+// A player's slot, free if pid is 0.
+struct slot
+{
+    // Bumped before and after each update, so odd while one is under way.
+    uint32_t sequence;
+
+    // Process the slot belongs to.
+    int32_t pid;
+
+    // The player's progress, as in struct standing.
+    char player[PLAYER_NAME];
+    int64_t start, end, left;
+    uint16_t filled, empty, mistakes;
+}
+__attribute__((aligned(64)));
+
+// The open scoreboard, and this process's slot in it and latest progress.
+static struct
+{
+    struct header *header;
+    struct slot *slots;
+    size_t size;
+    struct slot *mine;
+    struct slot progress;
+}
+scoreboard;
+
+// Function prototypes.
+static bool shm_name(const char *name, char path[]);
+static int attach(const char *path, bool create, const char *puzzle);
+static void detach(void);
+static struct slot *claim(const char *player);
+static void post(void);
+static bool read_slot(const struct slot *s, struct slot *copy);
+static bool better(const struct standing *a, const struct standing *b);
+
+/*
+ * Joins tournament name as player, creating it for puzzle if need be.
+ * Returns 0 iff successful, else why not as tournament.h describes.
+ */
+int tournament_join(const char *name, const char *player, const char *puzzle,
+                    char *playing)
+{
+    char path[NAME_MAX_LENGTH + 9];
+    if (!shm_name(name, path))
+    {
+        return 1;
+    }
+    int status = attach(path, true, puzzle);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    // Everyone must play the same puzzle.
+    if (strncmp(scoreboard.header->puzzle, puzzle, TOURNAMENT_PUZZLE) != 0)
+    {
+        snprintf(playing, TOURNAMENT_PUZZLE, "%s", scoreboard.header->puzzle);
+        detach();
+        return 3;
+    }
+
+    scoreboard.mine = claim(player);
+    if (!scoreboard.mine)
+    {
+        detach();
+        return 4;
+    }
+    memset(&scoreboard.progress, 0, sizeof(scoreboard.progress));
+    snprintf(scoreboard.progress.player, PLAYER_NAME, "%s", player);
+    post();
+    return 0;
+}
+
+/*
+ * Publishes the player's progress, if in a tournament.
+ */
+void tournament_update(int filled, int empty, int mistakes, time_t start,
+                       time_t end)
+{
+    if (!scoreboard.mine)
+    {
+        return;
+    }
+    scoreboard.progress.filled = filled;
+    scoreboard.progress.empty = empty;
+    scoreboard.progress.mistakes = mistakes;
+    scoreboard.progress.start = start;
+    scoreboard.progress.end = end;
+    post();
+}
+
+/*
+ * Marks the player as gone and leaves the scoreboard, if in a tournament.
+ */
+void tournament_leave(void)
+{
+    if (!scoreboard.mine)
+    {
+        return;
+    }
+    scoreboard.progress.left = time(NULL);
+    post();
+    detach();
+}
+
+/*
+ * Copies every player's progress into ranking, best first, returning how
+ * many players there are.
+ */
+int tournament_ranking(struct standing ranking[])
+{
+    if (!scoreboard.slots)
+    {
+        return 0;
+    }
+
+    int players = 0;
+    for (int i = 0; i < TOURNAMENT_SLOTS; i++)
+    {
+        const struct slot *s = &scoreboard.slots[i];
+        struct slot copy;
+        if (__atomic_load_n(&s->pid, __ATOMIC_RELAXED) == 0 ||
+            !read_slot(s, &copy) || !copy.player[0])
+        {
+            continue;
+        }
+
+        struct standing p;
+        memcpy(p.player, copy.player, PLAYER_NAME);
+        p.player[PLAYER_NAME - 1] = '\0';
+        p.filled = copy.filled;
+        p.empty = copy.empty;
+        p.mistakes = copy.mistakes;
+        p.start = copy.start;
+        p.end = copy.end;
+        p.left = copy.left;
+        p.yours = s == scoreboard.mine;
+
+        // Insert in order; qsort may allocate, and there are only hundreds.
+        int j = players++;
+        while (j > 0 && better(&p, &ranking[j - 1]))
+        {
+            ranking[j] = ranking[j - 1];
+            j--;
+        }
+        ranking[j] = p;
+    }
+    return players;
+}
+
+/*
+ * Shows a tournament's standings, or with --clear, removes it. Returns 0 iff
+ * successful.
+ */
+int tournament_main(int argc, char *argv[])
+{
+    bool clear = argc == 3 && strcmp(argv[2], "--clear") == 0;
+    if (argc < 2 || argc > 3 || (argc == 3 && !clear))
+    {
+        fprintf(stderr, "Usage: sudoku tournament name [--clear]\n");
+        return 1;
+    }
+    char path[NAME_MAX_LENGTH + 9];
+    if (!shm_name(argv[1], path))
+    {
+        fprintf(stderr, "Tournament names are up to %d letters, digits, '-' "
+                        "and '_'.\n", NAME_MAX_LENGTH);
+        return 1;
+    }
+
+    if (clear)
+    {
+        if (shm_unlink(path) != 0)
+        {
+            fprintf(stderr, "No tournament %s!\n", argv[1]);
+            return 2;
+        }
+        printf("Removed tournament %s.\n", argv[1]);
+        return 0;
+    }
+
+    if (attach(path, false, NULL) != 0)
+    {
+        fprintf(stderr, "No tournament %s!\n", argv[1]);
+        return 2;
+    }
+    static struct standing ranking[TOURNAMENT_SLOTS];
+    int players = tournament_ranking(ranking);
+    printf("Tournament %s, playing %.*s, has %d player%s.\n", argv[1],
+           TOURNAMENT_PUZZLE, scoreboard.header->puzzle, players,
+           players == 1 ? "" : "s");
+    time_t now = time(NULL);
+    for (int i = 0; i < players; i++)
+    {
+        const struct standing *p = &ranking[i];
+        int elapsed = (p->end ? p->end : p->left ? p->left : now) - p->start;
+        printf("%4d. %-15s %2d/%-2d %3d mistake%s %5d:%02d%s\n", i + 1,
+               p->player, p->filled, p->empty, p->mistakes,
+               p->mistakes == 1 ? " " : "s", elapsed / 60, elapsed % 60,
+               p->end ? "  solved" : p->left ? "  quit" : "");
+    }
+    detach();
+    return 0;
+}
+
+/*
+ * Writes into path the shared memory object's name for tournament name.
+ * Returns false if name isn't valid.
+ */
+static bool shm_name(const char *name, char path[])
+{
+    int length = strlen(name);
+    if (length == 0 || length > NAME_MAX_LENGTH)
+    {
+        return false;
+    }
+    for (int i = 0; i < length; i++)
+    {
+        if (!isalnum((unsigned char) name[i]) && name[i] != '-' &&
+            name[i] != '_')
+        {
+            return false;
+        }
+    }
+    sprintf(path, "/sudoku-%s", name);
+    return true;
+}
+
+/*
+ * Maps the scoreboard at path, creating it for puzzle if asked to and it
+ * doesn't exist, or finishing it if its creator never did. Returns 0 iff
+ * successful, else 2.
+ */
+static int attach(const char *path, bool create, const char *puzzle)
+{
+    scoreboard.size = sizeof(struct header) +
+                      TOURNAMENT_SLOTS * sizeof(struct slot);
+    bool created = false;
+    int fd = -1;
+    if (create)
+    {
+        fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0666);
+        created = fd >= 0;
+    }
+    if (fd < 0)
+    {
+        fd = shm_open(path, O_RDWR, 0);
+    }
+    if (fd < 0)
+    {
+        return 2;
+    }
+
+    // Let everyone join whatever the umask, else wait for the creator to
+    // size it.
+    struct stat st;
+    int waited = 0;
+    if (created)
+    {
+        if (fchmod(fd, 0666) != 0 || ftruncate(fd, scoreboard.size) != 0)
+        {
+            close(fd);
+            shm_unlink(path);
+            return 2;
+        }
+    }
+    while (!created && fstat(fd, &st) == 0 && st.st_size != scoreboard.size &&
+           waited++ < CREATE_WAIT_MS)
+    {
+        usleep(1000);
+    }
+
+    // A player joining sizes it if its creator never did, having died first.
+    if (!created && (fstat(fd, &st) != 0 ||
+                     (st.st_size != scoreboard.size &&
+                      (!create || ftruncate(fd, scoreboard.size) != 0))))
+    {
+        close(fd);
+        return 2;
+    }
+
+    void *map = mmap(NULL, scoreboard.size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return 2;
+    }
+    scoreboard.header = map;
+    scoreboard.slots = (struct slot *) (scoreboard.header + 1);
+
+    // The header is filled in by whoever swaps ready from 0 to 2, and ready
+    // once that sets it to 1: its creator, or if that never happens, a
+    // player joining who takes over from a creator that died first.
+    struct header *h = scoreboard.header;
+    uint32_t state = 0, unready = 0;
+    for (;;)
+    {
+        if (create && (created || waited >= CREATE_WAIT_MS) &&
+            __atomic_compare_exchange_n(&h->ready, &unready, 2, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            memcpy(h->magic, "STRN", 4);
+            h->version = TOURNAMENT_VERSION;
+            h->slots = TOURNAMENT_SLOTS;
+            snprintf(h->puzzle, TOURNAMENT_PUZZLE, "%s", puzzle);
+            __atomic_store_n(&h->ready, 1, __ATOMIC_RELEASE);
+        }
+        unready = 0;
+        state = __atomic_load_n(&h->ready, __ATOMIC_ACQUIRE);
+        if (state == 1 || waited++ >= 2 * CREATE_WAIT_MS)
+        {
+            break;
+        }
+        usleep(1000);
+    }
+    if (state != 1 ||
+        memcmp(h->magic, "STRN", 4) != 0 ||
+        h->version != TOURNAMENT_VERSION || h->slots != TOURNAMENT_SLOTS)
+    {
+        detach();
+        return 2;
+    }
+    return 0;
+}
+
+/*
+ * Unmaps the scoreboard.
+ */
+static void detach(void)
+{
+    if (scoreboard.header)
+    {
+        munmap(scoreboard.header, scoreboard.size);
+    }
+    scoreboard.header = NULL;
+    scoreboard.slots = scoreboard.mine = NULL;
+}
+
+/*
+ * Claims a slot for player: theirs from before if whoever had it has quit
+ * or died, so a player rejoining keeps a single row, else a free one. Returns
+ * NULL if there's none.
+ */
+static struct slot *claim(const char *player)
+{
+    int32_t pid = getpid();
+    for (int i = 0; i < TOURNAMENT_SLOTS; i++)
+    {
+        struct slot *s = &scoreboard.slots[i];
+        struct slot copy;
+        int32_t owner = __atomic_load_n(&s->pid, __ATOMIC_ACQUIRE);
+        if (owner != 0 && read_slot(s, &copy) &&
+            strncmp(copy.player, player, PLAYER_NAME - 1) == 0 &&
+            (copy.left || (kill(owner, 0) != 0 && errno == ESRCH)) &&
+            __atomic_compare_exchange_n(&s->pid, &owner, pid, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            return s;
+        }
+    }
+    for (int i = 0; i < TOURNAMENT_SLOTS; i++)
+    {
+        int32_t none = 0;
+        if (__atomic_compare_exchange_n(&scoreboard.slots[i].pid, &none, pid,
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED))
+        {
+            return &scoreboard.slots[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Copies this process's progress into its slot, bracketed by bumps of the
+ * slot's sequence number.
+ */
+static void post(void)
+{
+    struct slot *s = scoreboard.mine;
+    const struct slot *p = &scoreboard.progress;
+    uint32_t sequence = s->sequence;
+    __atomic_store_n(&s->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(s->player, p->player, PLAYER_NAME);
+    s->start = p->start;
+    s->end = p->end;
+    s->filled = p->filled;
+    s->empty = p->empty;
+    s->mistakes = p->mistakes;
+    s->left = p->left;
+
+    __atomic_store_n(&s->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies slot s into copy. Returns false if every try met an update.
+ */
+static bool read_slot(const struct slot *s, struct slot *copy)
+{
+    for (int i = 0; i < READ_TRIES; i++)
+    {
+        uint32_t before = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1)
+        {
+            continue;
+        }
+        memcpy(copy, s, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->sequence, __ATOMIC_RELAXED) == before)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Returns true iff a ranks above b: those who've solved the puzzle first,
+ * fastest first, then the rest by most cells filled, fewest mistakes and
+ * least time taken.
+ */
+static bool better(const struct standing *a, const struct standing *b)
+{
+    if ((a->end != 0) != (b->end != 0))
+        return a->end != 0;
+    if (a->end != 0)
+        return a->end - a->start < b->end - b->start;
+    if (a->filled != b->filled)
+        return a->filled > b->filled;
+    if (a->mistakes != b->mistakes)
+        return a->mistakes < b->mistakes;
+    return a->start > b->start;
+}
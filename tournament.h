@@ -0,0 +1,57 @@
+/**
+ * tournament.h
+ *
+ * A live scoreboard in shared memory for players racing through the same
+ * puzzle in separate processes. Each player's process publishes its own
+ * progress and any of them can rank everyone's, without ever waiting on
+ * another.
+ */
+
+#ifndef TOURNAMENT_H
+#define TOURNAMENT_H
+
+#include <stdbool.h>
+#include <time.h>
+
+// Longest player's name kept (longer names are cut short).
+#define PLAYER_NAME 16
+
+// A player's progress: cells filled (of those empty at the start), wrong
+// numbers entered, and when the game started and ended (0 until solved).
+struct standing
+{
+    char player[PLAYER_NAME];
+    int filled, empty, mistakes;
+    time_t start, end;
+
+    // When the player quit (0 if still playing), and whether this is the
+    // calling process's own standing.
+    time_t left;
+    bool yours;
+};
+
+// Joins tournament name (letters, digits, '-' and '_') as player, creating
+// it for puzzle if it doesn't exist. Returns 0 iff successful, else 1 if
+// the name isn't valid, 2 if the scoreboard can't be opened, 3 if the
+// tournament is playing another puzzle (copied into playing, of at least
+// TOURNAMENT_PUZZLE bytes) or 4 if it's full.
+int tournament_join(const char *name, const char *player, const char *puzzle,
+                    char *playing);
+
+// Publishes the player's progress. Never blocks.
+void tournament_update(int filled, int empty, int mistakes, time_t start,
+                       time_t end);
+
+// Marks the player as having quit, keeping their last progress shown, and
+// leaves the scoreboard.
+void tournament_leave(void);
+
+// Fills ranking with every player's latest progress, best first, returning
+// how many there are. ranking must have room for TOURNAMENT_SLOTS. Never
+// blocks; progress being published at that moment is left out.
+int tournament_ranking(struct standing ranking[]);
+
+// Entry point for "sudoku tournament ...".
+int tournament_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,397 @@
+/**
+ * trace.c
+ *
+ * Implements search-tree traces. A trace holds every node the solver visited
+ * solving one board, in the order visited, each with its depth so the tree
+ * can be rebuilt. Numbers are little-endian.
+ *
+ *   header: "STRC", version (4 bytes), nodes (4 bytes), nodes dropped
+ *           (8 bytes)
+ *   node:   depth, cell (255 for the root), digit, outcome (1 byte each),
+ *           nanoseconds spent in the node and below it (8 bytes)
+ *
+ * Traces of version 1 stored each node's time in 4 bytes, saturating at
+ * about 4.3 s; they can still be read.
+ *
+ * Recording writes nothing until the search ends, each node going into a
+ * buffer of a fixed number of nodes set aside beforehand, so the cost of a
+ * node is two clock readings and the whole trace is bounded however hard the
+ * board; nodes beyond the buffer are only counted.
+ */
+
+#include "trace.h"
+#include "alloc.h"
+#include "index.h"
+#include "metrics.h"
+#include "pack.h"
+#include "solver.h"
+#include "sudoku.h"
+#include "table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Version of the format, and sizes (in bytes) of the header and a node (and a
+// node of version 1).
+#define TRACE_VERSION 2
+#define HEADER_SIZE 20
+#define NODE_SIZE 12
+#define NODE_SIZE_V1 8
+
+// Nodes recorded by default, and most nodes worth drawing as a graph.
+#define TRACE_NODES (1 << 20)
+#define DOT_NODES 1000
+
+// Name of each outcome, for display.
+static const char *outcome_names[] = { "solved", "dead end", "cached",
+                                       "branched" };
+
+// Function prototypes.
+static int record(int argc, char *argv[]);
+static int load(const char *filename, struct trace *t);
+static void folded(const struct trace *t);
+static void dot(const struct trace *t);
+static void move_name(const struct trace_node *n, char name[16]);
+static void put32(uint8_t *p, uint32_t n);
+static uint32_t get32(const uint8_t *p);
+
+/*
+ * Records a trace, or converts one, depending on the arguments. Returns 0 iff
+ * successful.
+ */
+int trace_main(int argc, char *argv[])
+{
+    const char *usage =
+        "Usage: sudoku trace n00b|l33t number [file] [--nodes n]\n"
+        "       sudoku trace --folded|--dot file\n";
+    if (argc == 3 && (strcmp(argv[1], "--folded") == 0 ||
+                      strcmp(argv[1], "--dot") == 0))
+    {
+        struct trace t;
+        int status = load(argv[2], &t);
+        if (status != 0)
+        {
+            return status;
+        }
+        if (strcmp(argv[1], "--folded") == 0)
+        {
+            folded(&t);
+        }
+        else if (t.count > DOT_NODES)
+        {
+            fprintf(stderr, "%d nodes are too many to draw (at most %d); use "
+                    "--folded instead.\n", t.count, DOT_NODES);
+            status = 4;
+        }
+        else
+        {
+            dot(&t);
+        }
+        xfree(t.nodes);
+        return status;
+    }
+
+    int status = record(argc, argv);
+    if (status == 1)
+    {
+        fprintf(stderr, usage);
+    }
+    return status;
+}
+
+/*
+ * Solves a board of a level's pack as batch would, with the pack's settings
+ * and a table of its own if they use one, recording the search tree to a
+ * trace file. Returns 0 iff successful, 1 for bad usage.
+ */
+static int record(int argc, char *argv[])
+{
+    // Check usage, allowing --nodes n at the end.
+    int size = TRACE_NODES, number;
+    char c;
+    if (argc > 3 && strcmp(argv[argc - 2], "--nodes") == 0)
+    {
+        if (sscanf(argv[argc - 1], " %d %c", &size, &c) != 1 || size < 1)
+        {
+            return 1;
+        }
+        argc -= 2;
+    }
+    if (argc < 3 || argc > 4 || sscanf(argv[2], " %d %c", &number, &c) != 1)
+    {
+        return 1;
+    }
+
+    char filename[strlen(argv[1]) + 5], path[strlen(argv[1]) + 5];
+    sprintf(filename, "%s.bin", argv[1]);
+    sprintf(path, "%s.idx", argv[1]);
+    uint8_t (*boards)[81];
+    int count = pack_load(filename, &boards);
+    if (count < 0)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", filename);
+        return 2;
+    }
+    int position = pack_resolve(filename, number);
+    if (position < 1 || position > count)
+    {
+        fprintf(stderr, "There is no board %d in %s!\n", number, filename);
+        xfree(boards);
+        return 2;
+    }
+    char output[strlen(argv[1]) + 20];
+    sprintf(output, "%s-%d.trace", argv[1], number);
+
+    struct solver_config config = solver_defaults;
+    index_config(path, &config);
+    struct trace t = { xmalloc(size * sizeof(struct trace_node)), size };
+    uint8_t *raw = xmalloc(HEADER_SIZE + (size_t) size * NODE_SIZE);
+    struct table table = { NULL, 0 };
+    if (!t.nodes || !raw || (config.engine == ENGINE_TABLE &&
+                             !table_create(&table, SOLVER_TABLE_BITS)))
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 3;
+    }
+
+    // Solve it untraced first, to show what tracing costs, once to warm up
+    // then timed, each time with the table (if any) empty.
+    uint8_t solution[81];
+    struct solve_stats stats;
+    double start = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        if (table.entries)
+            table_clear(&table);
+        start = metrics_now();
+        count_solutions_config(boards[position - 1], 2, solution, &config,
+                               &table, &stats);
+    }
+    double plain = metrics_now() - start;
+    if (table.entries)
+        table_clear(&table);
+    start = metrics_now();
+    int solutions = count_solutions_trace(boards[position - 1], 2, solution,
+                                          &config, &table, &t, &stats);
+    double traced = metrics_now() - start;
+
+    memcpy(raw, "STRC", 4);
+    put32(raw + 4, TRACE_VERSION);
+    put32(raw + 8, t.count);
+    put32(raw + 12, t.dropped);
+    put32(raw + 16, t.dropped >> 32);
+    for (int i = 0; i < t.count; i++)
+    {
+        uint8_t *p = raw + HEADER_SIZE + i * NODE_SIZE;
+        p[0] = t.nodes[i].depth;
+        p[1] = t.nodes[i].cell;
+        p[2] = t.nodes[i].digit;
+        p[3] = t.nodes[i].outcome;
+        put32(p + 4, t.nodes[i].ns);
+        put32(p + 8, t.nodes[i].ns >> 32);
+    }
+
+    const char *target = argc == 4 ? argv[3] : output;
+    FILE *fp = fopen(target, "wb");
+    size_t length = HEADER_SIZE + (size_t) t.count * NODE_SIZE;
+    bool written = fp && fwrite(raw, length, 1, fp) == 1;
+    if (fp && fclose(fp) != 0)
+    {
+        written = false;
+    }
+    int status = 0;
+    if (!written)
+    {
+        fprintf(stderr, "Could not write %s!\n", target);
+        status = 4;
+    }
+    else
+    {
+        printf("%s #%d has %s solution%s: %llu nodes, %d recorded (%llu "
+               "dropped) in %s.\n", argv[1], number,
+               solutions == 0 ? "no" : solutions == 1 ? "one" : "several",
+               solutions == 1 ? "" : "s", (unsigned long long) stats.nodes,
+               t.count, (unsigned long long) t.dropped, target);
+        printf("Solved in %.3f ms untraced, %.3f ms traced.\n", plain * 1e3,
+               traced * 1e3);
+    }
+
+    table_destroy(&table);
+    xfree(raw);
+    xfree(t.nodes);
+    xfree(boards);
+    return status;
+}
+
+/*
+ * Reads the trace file filename into t, allocating its nodes. Returns 0 iff
+ * successful.
+ */
+static int load(const char *filename, struct trace *t)
+{
+    FILE *fp = fopen(filename, "rb");
+    uint8_t header[HEADER_SIZE];
+    if (!fp || fread(header, HEADER_SIZE, 1, fp) != 1 ||
+        memcmp(header, "STRC", 4) != 0 || get32(header + 4) < 1 ||
+        get32(header + 4) > TRACE_VERSION || get32(header + 8) > INT32_MAX)
+    {
+        fprintf(stderr, "Could not read a trace from %s!\n", filename);
+        if (fp)
+            fclose(fp);
+        return 2;
+    }
+    int node_size = get32(header + 4) == 1 ? NODE_SIZE_V1 : NODE_SIZE;
+    t->count = t->size = get32(header + 8);
+    t->dropped = get32(header + 12) | (uint64_t) get32(header + 16) << 32;
+    t->nodes = xmalloc((t->count ? t->count : 1) * sizeof(struct trace_node));
+    if (!t->nodes)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        fclose(fp);
+        return 3;
+    }
+
+    // Each node must be no deeper than one below the one before.
+    for (int i = 0; i < t->count; i++)
+    {
+        uint8_t p[NODE_SIZE];
+        if (fread(p, node_size, 1, fp) != 1 || p[3] > NODE_BRANCH ||
+            (i == 0 ? p[0] != 0 : p[0] > t->nodes[i - 1].depth + 1))
+        {
+            fprintf(stderr, "Could not read a trace from %s!\n", filename);
+            xfree(t->nodes);
+            fclose(fp);
+            return 2;
+        }
+        t->nodes[i].depth = p[0];
+        t->nodes[i].cell = p[1];
+        t->nodes[i].digit = p[2];
+        t->nodes[i].outcome = p[3];
+        t->nodes[i].ns = get32(p + 4);
+        if (node_size == NODE_SIZE)
+        {
+            t->nodes[i].ns |= (uint64_t) get32(p + 8) << 32;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Prints t in folded-stack format for flame graphs: each node's path of moves
+ * from the root and the nanoseconds spent in the node itself, leaves also
+ * naming their outcome.
+ */
+static void folded(const struct trace *t)
+{
+    // The path to the current node, and the time of each node's children.
+    int path[256], depth = 0;
+    uint64_t children[256];
+    char *line = xmalloc(256 * 24);
+    if (!line)
+    {
+        return;
+    }
+
+    for (int i = 0; i <= t->count; i++)
+    {
+        // Print the nodes left, deepest first, as the next is beside or
+        // above them.
+        int next = i < t->count ? t->nodes[i].depth : 0;
+        while (depth > next || (i == t->count && depth > 0))
+        {
+            depth--;
+            const struct trace_node *n = &t->nodes[path[depth]];
+            int length = 0;
+            for (int d = 0; d <= depth; d++)
+            {
+                char name[16];
+                move_name(&t->nodes[path[d]], name);
+                length += sprintf(line + length, "%s%s", d ? ";" : "", name);
+            }
+            if (n->outcome != NODE_BRANCH)
+            {
+                length += sprintf(line + length, ";%s",
+                                  outcome_names[n->outcome]);
+            }
+            uint64_t self = n->ns > children[depth] ?
+                            n->ns - children[depth] : 0;
+            printf("%s %llu\n", line, (unsigned long long) self);
+            if (depth > 0)
+            {
+                children[depth - 1] += n->ns;
+            }
+        }
+        if (i < t->count)
+        {
+            path[depth] = i;
+            children[depth] = 0;
+            depth++;
+        }
+    }
+    xfree(line);
+}
+
+/*
+ * Prints t as a Graphviz graph, each node labelled with its move and time and
+ * coloured by its outcome.
+ */
+static void dot(const struct trace *t)
+{
+    static const char *colours[] = { "palegreen", "lightpink", "lightblue",
+                                     "white" };
+    int path[256];
+
+    printf("digraph search {\n");
+    printf("    node [shape=box, style=filled, fontname=monospace];\n");
+    for (int i = 0; i < t->count; i++)
+    {
+        const struct trace_node *n = &t->nodes[i];
+        char name[16];
+        move_name(n, name);
+        printf("    n%d [label=\"%s\\n%.1f us\", fillcolor=%s];\n", i, name,
+               n->ns / 1e3, colours[n->outcome]);
+        path[n->depth] = i;
+        if (n->depth > 0)
+        {
+            printf("    n%d -> n%d;\n", path[n->depth - 1], i);
+        }
+    }
+    printf("}\n");
+}
+
+/*
+ * Names the move leading to node n, e.g. "r1c9=5".
+ */
+static void move_name(const struct trace_node *n, char name[16])
+{
+    if (n->cell == TRACE_ROOT)
+    {
+        strcpy(name, "root");
+    }
+    else
+    {
+        sprintf(name, "r%dc%d=%d", n->cell / 9 + 1, n->cell % 9 + 1,
+                n->digit);
+    }
+}
+
+/*
+ * Stores n at p, little-endian.
+ */
+static void put32(uint8_t *p, uint32_t n)
+{
+    p[0] = n;
+    p[1] = n >> 8;
+    p[2] = n >> 16;
+    p[3] = n >> 24;
+}
+
+/*
+ * Returns the little-endian number at p.
+ */
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
@@ -0,0 +1,14 @@
+/**
+ * trace.h
+ *
+ * Recording of the solver's search tree for one board into a trace file, and
+ * conversion of trace files for flame graphs and Graphviz.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Entry point for "sudoku trace ...".
+int trace_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,487 @@
+/**
+ * verify.c
+ *
+ * Implements bulk verification of grids, 32 at a time. The grids are
+ * transposed so that each vector holds one cell of all 32, one grid to a
+ * byte, and then every unit of all 32 is checked together by mask
+ * arithmetic. A unit is correct iff its digits sum to 45 and have all of 1-8
+ * among them: that leaves one cell, which the sum makes a 9. That holds for
+ * any four-bit digits, so empty cells and digits out of range need no check
+ * of their own. Givens are compared a row of bytes at a time. Only a wrong
+ * grid is looked at again, cell by cell, to find where it first goes wrong.
+ *
+ * This file is built with optimisation (see the Makefile), being the one
+ * whose speed is the point, and the checks are also built for AVX2, whose
+ * byte shuffles make the digits' masks, and picked when the processor has
+ * it.
+ */
+
+#include "verify.h"
+#include "alloc.h"
+#include "metrics.h"
+#include "pack.h"
+#include "solver.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Grids checked at a time, one per byte of a vector.
+#define LANES 32
+
+// Vectors of bytes, for transposing and for checking.
+typedef uint8_t row_vector __attribute__((vector_size(16)));
+typedef uint8_t lane_vector __attribute__((vector_size(LANES)));
+
+// Name of each result, for display.
+const char *verify_names[] = { "correct", "empty cell", "changed given",
+                               "repeated digit" };
+
+// Function prototypes.
+static uint32_t check_lanes(const uint8_t (*puzzles)[81],
+                            const uint8_t (*grids)[81]);
+static inline void transpose(row_vector rows[16]);
+static inline void interleave(row_vector rows[16], int width, row_vector low);
+static struct verdict first_violation(const uint8_t puzzle[81],
+                                      const uint8_t grid[81]);
+static int grade(const char *puzzles_file, const char *grids_file);
+static int bench(const char *level, int count);
+static int verify_cycle(const uint8_t (*puzzles)[81],
+                        const uint8_t (*grids)[81], int n, int count,
+                        struct verdict *verdicts);
+
+/*
+ * Verifies count grids against their puzzles into verdicts, returning the
+ * number correct.
+ */
+int verify_grids(const uint8_t (*puzzles)[81], const uint8_t (*grids)[81],
+                 int count, struct verdict *verdicts)
+{
+    int ok = 0;
+    for (int i = 0; i < count; i += LANES)
+    {
+        // Pad the last few out with copies of the last.
+        uint8_t spare_puzzles[LANES][81], spare_grids[LANES][81];
+        const uint8_t (*p)[81] = puzzles + i, (*g)[81] = grids + i;
+        int n = count - i < LANES ? count - i : LANES;
+        if (n < LANES)
+        {
+            for (int j = 0; j < LANES; j++)
+            {
+                memcpy(spare_puzzles[j], p[j < n ? j : n - 1], 81);
+                memcpy(spare_grids[j], g[j < n ? j : n - 1], 81);
+            }
+            p = (const uint8_t (*)[81]) spare_puzzles;
+            g = (const uint8_t (*)[81]) spare_grids;
+        }
+
+        uint32_t correct = check_lanes(p, g);
+        for (int j = 0; j < n; j++)
+        {
+            if (correct >> j & 1)
+            {
+                verdicts[i + j] = (struct verdict) { VERIFY_OK, 0 };
+                ok++;
+            }
+            else
+            {
+                verdicts[i + j] = first_violation(p[j], g[j]);
+            }
+        }
+    }
+    return ok;
+}
+
+/*
+ * Verifies grid against puzzle.
+ */
+struct verdict verify_grid(const uint8_t puzzle[81], const uint8_t grid[81])
+{
+    struct verdict v;
+    verify_grids((const uint8_t (*)[81]) puzzle,
+                 (const uint8_t (*)[81]) grid, 1, &v);
+    return v;
+}
+
+/*
+ * Grades a pack of grids against a pack of puzzles, or benchmarks grading.
+ * Returns 0 iff successful.
+ */
+int verify_main(int argc, char *argv[])
+{
+    int count = 10000000;
+    char c;
+    if (argc == 3 && strcmp(argv[1], "--bench") != 0)
+    {
+        return grade(argv[1], argv[2]);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench") == 0 &&
+        (argc == 3 || (sscanf(argv[3], " %d %c", &count, &c) == 1 &&
+                       count > 0)))
+    {
+        return bench(argv[2], count);
+    }
+    fprintf(stderr, "Usage: sudoku verify puzzles.bin grids.bin\n"
+            "       sudoku verify --bench n00b|l33t [grids]\n");
+    return 1;
+}
+
+/*
+ * Returns a mask with bit j set iff grids[j] is a solution of puzzles[j], for
+ * LANES grids.
+ */
+__attribute__((target_clones("avx2", "default")))
+static uint32_t check_lanes(const uint8_t (*puzzles)[81],
+                            const uint8_t (*grids)[81])
+{
+    // Note which grids changed a given.
+    uint32_t changed = 0;
+    for (int j = 0; j < LANES; j++)
+    {
+        row_vector bad = {0};
+        for (int i = 0; i < 80; i += 16)
+        {
+            row_vector given, digit;
+            memcpy(&given, puzzles[j] + i, 16);
+            memcpy(&digit, grids[j] + i, 16);
+            given &= CELL_DIGIT;
+            digit &= CELL_DIGIT;
+            bad |= (row_vector) ((given != 0) & (given != digit));
+        }
+        uint64_t halves[2];
+        memcpy(halves, &bad, 16);
+        int last = puzzles[j][80] & CELL_DIGIT;
+        changed |= (uint32_t) ((halves[0] | halves[1]) != 0 ||
+                               (last && last != (grids[j][80] & CELL_DIGIT)))
+                   << j;
+    }
+
+    // Transpose the grids sixteen cells of sixteen grids at a time, so that
+    // cells[i] holds cell i of every grid.
+    lane_vector cells[81];
+    for (int i = 0; i < 80; i += 16)
+    {
+        for (int half = 0; half < LANES; half += 16)
+        {
+            row_vector rows[16];
+            for (int j = 0; j < 16; j++)
+            {
+                memcpy(&rows[j], grids[half + j] + i, 16);
+            }
+            transpose(rows);
+            for (int k = 0; k < 16; k++)
+            {
+                memcpy((uint8_t *) &cells[i + k] + half, &rows[k], 16);
+            }
+        }
+    }
+    for (int j = 0; j < LANES; j++)
+    {
+        cells[80][j] = grids[j][80];
+    }
+
+    // Or together the masks of digits 1-8, and add up the digits, in each
+    // unit, and check each unit as it's finished.
+    const lane_vector masks = { 0, 1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0,
+                                0, 0, 0, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const lane_vector all = ~(lane_vector) {0}, sum = (lane_vector) {0} + 45;
+    lane_vector good = all, col_masks[9] = {{0}}, col_sums[9] = {{0}};
+    for (int band = 0; band < 81; band += 27)
+    {
+        lane_vector box_masks[3] = {{0}}, box_sums[3] = {{0}};
+        for (int y = band; y < band + 27; y += 9)
+        {
+            lane_vector row_mask = {0}, row_sum = {0};
+            for (int x = 0; x < 9; x++)
+            {
+                lane_vector digit = cells[y + x] & CELL_DIGIT;
+                lane_vector mask = __builtin_shuffle(masks, digit);
+                row_mask |= mask;
+                row_sum += digit;
+                col_masks[x] |= mask;
+                col_sums[x] += digit;
+                box_masks[x / 3] |= mask;
+                box_sums[x / 3] += digit;
+            }
+            good &= (lane_vector) ((row_mask == all) & (row_sum == sum));
+        }
+        for (int b = 0; b < 3; b++)
+        {
+            good &= (lane_vector) ((box_masks[b] == all) &
+                                   (box_sums[b] == sum));
+        }
+    }
+    for (int x = 0; x < 9; x++)
+    {
+        good &= (lane_vector) ((col_masks[x] == all) & (col_sums[x] == sum));
+    }
+
+    uint32_t correct = 0;
+    for (int j = 0; j < LANES; j++)
+    {
+        correct |= (uint32_t) (good[j] & 1) << j;
+    }
+    return correct & ~changed;
+}
+
+/*
+ * Transposes sixteen rows of sixteen bytes, so that byte j of row i becomes
+ * byte i of row j, by interleaving pairs of rows' bytes, then pairs of
+ * bytes, then fours, then eights.
+ */
+static inline void transpose(row_vector rows[16])
+{
+    interleave(rows, 1, (row_vector) { 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5,
+                                       21, 6, 22, 7, 23 });
+    interleave(rows, 2, (row_vector) { 0, 1, 16, 17, 2, 3, 18, 19, 4, 5, 20,
+                                       21, 6, 7, 22, 23 });
+    interleave(rows, 4, (row_vector) { 0, 1, 2, 3, 16, 17, 18, 19, 4, 5, 6, 7,
+                                       20, 21, 22, 23 });
+    interleave(rows, 8, (row_vector) { 0, 1, 2, 3, 4, 5, 6, 7, 16, 17, 18, 19,
+                                       20, 21, 22, 23 });
+}
+
+/*
+ * Interleaves each of rows with the one width rows on, in groups of 2 *
+ * width rows, taking the first halves of each pair by low and the second
+ * halves by low + 8. Always inlined, so that the shuffles are constant.
+ */
+static inline __attribute__((always_inline))
+void interleave(row_vector rows[16], int width, row_vector low)
+{
+    row_vector t[16];
+    for (int g = 0; g < 16; g += 2 * width)
+    {
+        for (int k = 0; k < width; k++)
+        {
+            row_vector a = rows[g + k], b = rows[g + width + k];
+            t[g + 2 * k] = __builtin_shuffle(a, b, low);
+            t[g + 2 * k + 1] = __builtin_shuffle(a, b, low + 8);
+        }
+    }
+    memcpy(rows, t, sizeof(t));
+}
+
+/*
+ * Returns the verdict on a grid known to be wrong, finding the first cell at
+ * which it is.
+ */
+static struct verdict first_violation(const uint8_t puzzle[81],
+                                      const uint8_t grid[81])
+{
+    uint16_t cols[9] = {0};
+    for (int band = 0; band < 81; band += 27)
+    {
+        uint16_t boxes[3] = {0};
+        for (int y = band; y < band + 27; y += 9)
+        {
+            uint16_t row = 0;
+            for (int x = 0; x < 9; x++)
+            {
+                int given = puzzle[y + x] & CELL_DIGIT;
+                int digit = grid[y + x] & CELL_DIGIT;
+                uint16_t mask = 1 << digit;
+                if (digit < 1 || digit > 9)
+                {
+                    return (struct verdict) { VERIFY_EMPTY, y + x };
+                }
+                if (given && given != digit)
+                {
+                    return (struct verdict) { VERIFY_GIVEN, y + x };
+                }
+                if ((row | cols[x] | boxes[x / 3]) & mask)
+                {
+                    return (struct verdict) { VERIFY_REPEAT, y + x };
+                }
+                row |= mask;
+                cols[x] |= mask;
+                boxes[x / 3] |= mask;
+            }
+        }
+    }
+
+    // Not reached for a wrong grid.
+    return (struct verdict) { VERIFY_OK, 0 };
+}
+
+/*
+ * Verifies each grid of the pack grids_file against the board of the pack
+ * puzzles_file in the same place, printing the wrong ones. Returns 0 iff
+ * every grid is correct.
+ */
+static int grade(const char *puzzles_file, const char *grids_file)
+{
+    uint8_t (*puzzles)[81], (*grids)[81];
+    int count = pack_load(puzzles_file, &puzzles);
+    if (count < 0)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", puzzles_file);
+        return 2;
+    }
+    int grid_count = pack_load(grids_file, &grids);
+    if (grid_count < 0)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", grids_file);
+        xfree(puzzles);
+        return 2;
+    }
+    if (grid_count < count)
+    {
+        count = grid_count;
+    }
+
+    struct verdict *verdicts = xmalloc((count ? count : 1) *
+                                       sizeof(struct verdict));
+    if (!verdicts)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 3;
+    }
+    double start = metrics_now();
+    int ok = verify_grids((const uint8_t (*)[81]) puzzles,
+                          (const uint8_t (*)[81]) grids, count, verdicts);
+    double elapsed = metrics_now() - start;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (verdicts[i].result != VERIFY_OK)
+        {
+            printf("%d: %s at r%dc%d\n", i + 1,
+                   verify_names[verdicts[i].result], verdicts[i].cell / 9 + 1,
+                   verdicts[i].cell % 9 + 1);
+        }
+    }
+    fprintf(stderr, "%d of %d grids correct, verified in %.6f s.\n", ok, count,
+            elapsed);
+
+    xfree(verdicts);
+    xfree(grids);
+    xfree(puzzles);
+    return ok == count ? 0 : 4;
+}
+
+/*
+ * Times verifying count grids made from the solutions of a level's pack, then
+ * again with every fourth spoilt one way or another, checking the verdicts
+ * are right. The grids are the pack's over and over, so only a pack's worth
+ * is held in memory however many are verified. Returns 0 iff they are.
+ */
+static int bench(const char *level, int count)
+{
+    char filename[strlen(level) + 5];
+    sprintf(filename, "%s.bin", level);
+    uint8_t (*boards)[81];
+    int n = pack_load(filename, &boards);
+    if (n <= 0)
+    {
+        fprintf(stderr, "Could not load boards from %s!\n", filename);
+        return 2;
+    }
+    if (n > count)
+    {
+        n = count;
+    }
+
+    uint8_t (*grids)[81] = xmalloc(n * sizeof(*grids));
+    struct verdict *verdicts = xmalloc(n * sizeof(struct verdict));
+    struct verdict *expected = xmalloc(n * sizeof(struct verdict));
+    if (!grids || !verdicts || !expected)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return 3;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        count_solutions(boards[i], 1, grids[i]);
+        expected[i] = (struct verdict) { VERIFY_OK, 0 };
+    }
+
+    double start = metrics_now();
+    int ok = verify_cycle((const uint8_t (*)[81]) boards,
+                          (const uint8_t (*)[81]) grids, n, count, verdicts);
+    double elapsed = metrics_now() - start;
+    printf("Verified %d correct grids in %.3f s (%.1f million grids/s).\n",
+           count, elapsed, count / elapsed / 1e6);
+    int status = 0;
+    if (ok != count)
+    {
+        fprintf(stderr, "Wrong verdicts!\n");
+        status = 4;
+    }
+
+    // Spoil every fourth grid: empty a cell, change a given, or copy the next
+    // digit in the row into a cell that isn't a given.
+    uint32_t rng = seed_random(count);
+    for (int i = 3; i < n; i += 4)
+    {
+        const uint8_t *puzzle = boards[i];
+        int cell = next_random(&rng) % 81;
+        switch (i % 12)
+        {
+            case 3:
+                grids[i][cell] = 0;
+                expected[i] = (struct verdict) { VERIFY_EMPTY, cell };
+                break;
+
+            case 7:
+                while (!puzzle[cell])
+                {
+                    cell = (cell + 1) % 81;
+                }
+                grids[i][cell] = grids[i][cell] % 9 + 1;
+                expected[i] = (struct verdict) { VERIFY_GIVEN, cell };
+                break;
+
+            case 11:
+                while (puzzle[cell] || cell % 9 == 8)
+                {
+                    cell = (cell + 1) % 81;
+                }
+                grids[i][cell] = grids[i][cell + 1];
+                expected[i] = first_violation(puzzle, grids[i]);
+                break;
+        }
+    }
+
+    start = metrics_now();
+    ok = verify_cycle((const uint8_t (*)[81]) boards,
+                      (const uint8_t (*)[81]) grids, n, count, verdicts);
+    elapsed = metrics_now() - start;
+    printf("Verified them again in %.3f s (%.1f million grids/s) with every "
+           "fourth spoilt.\n", elapsed, count / elapsed / 1e6);
+
+    // Every pass but the last is the whole pack, and the last one's verdicts
+    // are what's left in verdicts.
+    int last = count % n ? count % n : n;
+    int spoilt = (count - last) / n * (n / 4) + last / 4;
+    if (ok != count - spoilt ||
+        memcmp(verdicts, expected, last * sizeof(struct verdict)) != 0)
+    {
+        fprintf(stderr, "Wrong verdicts!\n");
+        status = 4;
+    }
+
+    xfree(expected);
+    xfree(verdicts);
+    xfree(grids);
+    xfree(boards);
+    return status;
+}
+
+/*
+ * Verifies count grids against their puzzles by going through the n in
+ * grids over and over, leaving the last pass's verdicts in verdicts. Returns
+ * how many were correct.
+ */
+static int verify_cycle(const uint8_t (*puzzles)[81],
+                        const uint8_t (*grids)[81], int n, int count,
+                        struct verdict *verdicts)
+{
+    int ok = 0;
+    for (int done = 0; done < count; done += n)
+    {
+        ok += verify_grids(puzzles, grids, count - done < n ? count - done : n,
+                           verdicts);
+    }
+    return ok;
+}
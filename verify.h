@@ -0,0 +1,39 @@
+/**
+ * verify.h
+ *
+ * Bulk verification of completed grids against their puzzles, e.g. to grade
+ * grids submitted by players.
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "board.h"
+
+// Results of verifying a grid: correct, or wrong at some cell because it's
+// empty (or out of range), doesn't hold the puzzle's given there, or repeats
+// a digit of an earlier cell in its row, column or box.
+enum verify_result { VERIFY_OK, VERIFY_EMPTY, VERIFY_GIVEN, VERIFY_REPEAT };
+
+// Verdict on a grid: its result and, if wrong, the first cell (in row-major
+// order) at which it's wrong.
+struct verdict
+{
+    uint8_t result, cell;
+};
+
+// Verifies count grids against their puzzles, pair by pair, filling in a
+// verdict for each. Returns the number correct. Cells' flags are ignored.
+int verify_grids(const uint8_t (*puzzles)[81], const uint8_t (*grids)[81],
+                 int count, struct verdict *verdicts);
+
+// Verifies one grid against its puzzle.
+struct verdict verify_grid(const uint8_t puzzle[81], const uint8_t grid[81]);
+
+// Name of each result, for display.
+extern const char *verify_names[];
+
+// Entry point for "sudoku verify ...".
+int verify_main(int argc, char *argv[]);
+
+#endif